@@ -0,0 +1,70 @@
+#ifndef GDT_INTERNAL_MPSC_QUEUE_HPP
+#define GDT_INTERNAL_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+namespace GDT
+{
+    namespace Internal
+    {
+        /*!
+         * \brief A bounded lock-free queue for many producer threads and one
+         * consumer thread.
+         *
+         * pop may only be called from the consumer thread. Each slot has a
+         * sequence number that tells producers and the consumer whose turn
+         * it is to use it, so producers only contend on claiming a slot.
+         * Values are swapped in and out instead of moved, so buffers given to
+         * push come back out of later pops and keep their capacity.
+         */
+        template <typename T>
+        class MPSCQueue
+        {
+        public:
+            /// The capacity is rounded up to a power of two.
+            explicit MPSCQueue(std::size_t capacity = 1024);
+
+            MPSCQueue(const MPSCQueue& other) = delete;
+            MPSCQueue& operator = (const MPSCQueue& other) = delete;
+
+            /// Swaps value into the queue, returns false if it is full.
+            /**
+                On success, value holds what the slot held before, i.e. a
+                value popped earlier.
+            */
+            bool push(T& value);
+
+            /// Swaps the oldest value into value, returns false if empty.
+            bool pop(T& value);
+
+            bool empty() const;
+
+            std::size_t capacity() const;
+
+        private:
+            struct Slot
+            {
+                std::atomic<std::size_t> sequence;
+                T value;
+            };
+
+            std::vector<Slot> slots;
+            std::size_t mask;
+            // see SPSCQueue for the padding
+            char headPadding[64];
+            // read and written by the consumer
+            std::atomic<std::size_t> head;
+            char tailPadding[64 - sizeof(std::atomic<std::size_t>)];
+            // claimed by producers
+            std::atomic<std::size_t> tail;
+            char endPadding[64 - sizeof(std::atomic<std::size_t>)];
+        };
+    }
+}
+
+#include "MPSCQueue.inl"
+
+#endif
@@ -0,0 +1,81 @@
+template <typename T>
+GDT::Internal::MPSCQueue<T>::MPSCQueue(std::size_t capacity) :
+head(0),
+tail(0)
+{
+    std::size_t size = 2;
+    while(size < capacity)
+    {
+        size *= 2;
+    }
+    slots = std::vector<Slot>(size);
+    mask = size - 1;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        // slot i is free for the producer that claims position i
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool GDT::Internal::MPSCQueue<T>::push(T& value)
+{
+    std::size_t position = tail.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true)
+    {
+        slot = &slots[position & mask];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if(sequence == position)
+        {
+            if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+            // another producer claimed it, position is now the current tail
+        }
+        else if(sequence < position)
+        {
+            // the consumer has not popped the value from a lap ago
+            return false;
+        }
+        else
+        {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::swap(slot->value, value);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool GDT::Internal::MPSCQueue<T>::pop(T& value)
+{
+    std::size_t position = head.load(std::memory_order_relaxed);
+    Slot& slot = slots[position & mask];
+    if(slot.sequence.load(std::memory_order_acquire) != position + 1)
+    {
+        return false;
+    }
+
+    std::swap(slot.value, value);
+    // free for the producer that claims it a lap later
+    slot.sequence.store(position + slots.size(), std::memory_order_release);
+    head.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename T>
+bool GDT::Internal::MPSCQueue<T>::empty() const
+{
+    std::size_t position = head.load(std::memory_order_relaxed);
+    return slots[position & mask].sequence.load(std::memory_order_acquire) != position + 1;
+}
+
+template <typename T>
+std::size_t GDT::Internal::MPSCQueue<T>::capacity() const
+{
+    return slots.size();
+}
@@ -1,6 +1,13 @@
 
 #include "NetworkIdentifiers.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 #include <unistd.h>
 #if PLATFORM != PLATFORM_WINDOWS
  #include <netdb.h>
@@ -17,41 +24,848 @@ std::atomic_uint_fast32_t GDT::Internal::Network::connectionInstanceCount{};
 GDT::Internal::Network::PacketInfo::PacketInfo() :
 address(0),
 id(0),
-isResending(false)
+isResending(false),
+isNotReceivedChecked(false),
+hasBeenReSent(false),
+isCoalesced(false),
+size(0),
+isInFlight(false),
+probeSize(0)
 {}
 
 GDT::Internal::Network::PacketInfo::PacketInfo(
-    const std::vector<char>& data,
+    std::vector<char> data,
     std::chrono::steady_clock::time_point sentTime,
     uint32_t address,
     uint32_t id,
     bool isResending,
-    bool isNotReceivedChecked) :
-data(data),
+    bool isNotReceivedChecked,
+    bool isCoalesced) :
+data(std::move(data)),
 sentTime(sentTime),
 address(address),
 id(id),
 isResending(isResending),
 isNotReceivedChecked(isNotReceivedChecked),
-hasBeenReSent(false)
+hasBeenReSent(false),
+isCoalesced(isCoalesced),
+size(0),
+isInFlight(false),
+probeSize(0)
 {}
 
+GDT::Internal::Network::SentPacketRing::SentPacketRing()
+{
+    isValid.fill(false);
+}
+
+GDT::Internal::Network::PacketInfo& GDT::Internal::Network::SentPacketRing::insert(uint32_t id)
+{
+    uint32_t index = id & (GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE - 1);
+    isValid[index] = true;
+
+    PacketInfo& slot = slots[index];
+    slot.data.clear();
+    slot.sentTime = std::chrono::steady_clock::time_point();
+    slot.id = id;
+    slot.isResending = false;
+    slot.isNotReceivedChecked = false;
+    slot.hasBeenReSent = false;
+    slot.isCoalesced = false;
+    slot.size = 0;
+    slot.isInFlight = false;
+    slot.messages.clear();
+    slot.probeSize = 0;
+    slot.trackingIds.clear();
+    return slot;
+}
+
+GDT::Internal::Network::PacketInfo* GDT::Internal::Network::SentPacketRing::find(uint32_t id)
+{
+    uint32_t index = id & (GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE - 1);
+    if(isValid[index] && slots[index].id == id)
+    {
+        return &slots[index];
+    }
+    return nullptr;
+}
+
+GDT::Internal::Network::Endpoint::Endpoint() :
+address(0),
+port(0)
+{}
+
+GDT::Internal::Network::Endpoint::Endpoint(uint32_t address, uint16_t port) :
+address(address),
+port(port)
+{}
+
+bool GDT::Internal::Network::Endpoint::operator== (const GDT::Internal::Network::Endpoint& other) const
+{
+    return address == other.address && port == other.port;
+}
+
+const uint32_t GDT::Internal::Network::EndpointMap::NOT_FOUND;
+
+GDT::Internal::Network::EndpointMap::EndpointMap() :
+count(0)
+{}
+
+uint32_t GDT::Internal::Network::EndpointMap::find(const Endpoint& endpoint) const
+{
+    if(entries.empty())
+    {
+        return NOT_FOUND;
+    }
+
+    const std::size_t mask = entries.size() - 1;
+    for(std::size_t i = homeOf(endpoint); entries[i].isUsed; i = (i + 1) & mask)
+    {
+        if(entries[i].endpoint == endpoint)
+        {
+            return entries[i].index;
+        }
+    }
+    return NOT_FOUND;
+}
+
+void GDT::Internal::Network::EndpointMap::insert(const Endpoint& endpoint, uint32_t index)
+{
+    // keep the load factor at or below one half
+    if((count + 1) * 2 > entries.size())
+    {
+        std::vector<Entry> previous(entries.size() < 8 ? 16 : entries.size() * 2);
+        for(std::size_t i = 0; i < previous.size(); ++i)
+        {
+            previous[i].isUsed = false;
+        }
+        previous.swap(entries);
+        count = 0;
+        for(std::size_t i = 0; i < previous.size(); ++i)
+        {
+            if(previous[i].isUsed)
+            {
+                insert(previous[i].endpoint, previous[i].index);
+            }
+        }
+    }
+
+    const std::size_t mask = entries.size() - 1;
+    std::size_t i = homeOf(endpoint);
+    for(; entries[i].isUsed; i = (i + 1) & mask)
+    {
+        if(entries[i].endpoint == endpoint)
+        {
+            entries[i].index = index;
+            return;
+        }
+    }
+    entries[i].endpoint = endpoint;
+    entries[i].index = index;
+    entries[i].isUsed = true;
+    ++count;
+}
+
+bool GDT::Internal::Network::EndpointMap::erase(const Endpoint& endpoint)
+{
+    if(entries.empty())
+    {
+        return false;
+    }
+
+    const std::size_t mask = entries.size() - 1;
+    std::size_t i = homeOf(endpoint);
+    for(; entries[i].isUsed; i = (i + 1) & mask)
+    {
+        if(entries[i].endpoint == endpoint)
+        {
+            break;
+        }
+    }
+    if(!entries[i].isUsed)
+    {
+        return false;
+    }
+
+    // move back following entries that would no longer be found past the
+    // emptied slot
+    entries[i].isUsed = false;
+    for(std::size_t j = (i + 1) & mask; entries[j].isUsed; j = (j + 1) & mask)
+    {
+        std::size_t home = homeOf(entries[j].endpoint);
+        bool isBetween = i < j ? (home > i && home <= j) : (home > i || home <= j);
+        if(!isBetween)
+        {
+            entries[i] = entries[j];
+            entries[j].isUsed = false;
+            i = j;
+        }
+    }
+    --count;
+    return true;
+}
+
+void GDT::Internal::Network::EndpointMap::clear()
+{
+    for(std::size_t i = 0; i < entries.size(); ++i)
+    {
+        entries[i].isUsed = false;
+    }
+    count = 0;
+}
+
+std::size_t GDT::Internal::Network::EndpointMap::size() const
+{
+    return count;
+}
+
+std::size_t GDT::Internal::Network::EndpointMap::homeOf(const Endpoint& endpoint) const
+{
+    // fibonacci hashing, the high bits of the product are well mixed
+    uint64_t key = ((uint64_t)endpoint.address << 16) | endpoint.port;
+    return (std::size_t)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (entries.size() - 1);
+}
+
+GDT::Internal::Network::ConnectionHandle::ConnectionHandle() :
+index(0xFFFFFFFF),
+generation(0)
+{}
+
+GDT::Internal::Network::ConnectionHandle::ConnectionHandle(uint32_t index, uint32_t generation) :
+index(index),
+generation(generation)
+{}
+
+bool GDT::Internal::Network::ConnectionHandle::isValid() const
+{
+    return index != 0xFFFFFFFF;
+}
+
+bool GDT::Internal::Network::ConnectionHandle::operator== (const GDT::Internal::Network::ConnectionHandle& other) const
+{
+    return index == other.index && generation == other.generation;
+}
+
+bool GDT::Internal::Network::ConnectionHandle::operator!= (const GDT::Internal::Network::ConnectionHandle& other) const
+{
+    return !(*this == other);
+}
+
+const uint32_t GDT::Internal::Network::TimerWheel::NONE;
+const uint32_t GDT::Internal::Network::TimerWheel::SLOTS;
+
+GDT::Internal::Network::TimerWheel::TimerWheel() :
+currentTick(0),
+count(0)
+{
+    heads.fill(NONE);
+}
+
+void GDT::Internal::Network::TimerWheel::resize(std::size_t count)
+{
+    if(nodes.size() < count)
+    {
+        Node node = Node();
+        node.previous = NONE;
+        node.next = NONE;
+        nodes.resize(count, node);
+    }
+}
+
+void GDT::Internal::Network::TimerWheel::schedule(uint32_t index, uint64_t tick)
+{
+    if(nodes[index].isScheduled)
+    {
+        unlink(index);
+    }
+    else
+    {
+        ++count;
+    }
+
+    nodes[index].expiry = tick > currentTick ? tick : currentTick + 1;
+    place(index);
+}
+
+void GDT::Internal::Network::TimerWheel::cancel(uint32_t index)
+{
+    if(index < nodes.size() && nodes[index].isScheduled)
+    {
+        unlink(index);
+        --count;
+    }
+}
+
+void GDT::Internal::Network::TimerWheel::advance(uint64_t tick, std::vector<uint32_t>& expired)
+{
+    const uint32_t mask = SLOTS - 1;
+    while(currentTick < tick)
+    {
+        if(count == 0)
+        {
+            // nothing to visit
+            currentTick = tick;
+            break;
+        }
+        ++currentTick;
+
+        // move down the next slot of every level whose lower level turned
+        for(uint32_t level = 1; level < GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS; ++level)
+        {
+            if(((currentTick >> ((level - 1) * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS)) & mask) != 0)
+            {
+                break;
+            }
+
+            uint32_t slot = level * SLOTS
+                + ((currentTick >> (level * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS)) & mask);
+            uint32_t index = heads[slot];
+            heads[slot] = NONE;
+            while(index != NONE)
+            {
+                uint32_t next = nodes[index].next;
+                place(index);
+                index = next;
+            }
+        }
+
+        uint32_t slot = currentTick & mask;
+        uint32_t index = heads[slot];
+        heads[slot] = NONE;
+        while(index != NONE)
+        {
+            nodes[index].isScheduled = false;
+            --count;
+            expired.push_back(index);
+            index = nodes[index].next;
+        }
+    }
+}
+
+uint64_t GDT::Internal::Network::TimerWheel::nextExpiry() const
+{
+    if(count == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    const uint32_t mask = SLOTS - 1;
+    for(uint64_t tick = currentTick + 1; tick <= currentTick + SLOTS; ++tick)
+    {
+        if(heads[tick & mask] != NONE)
+        {
+            return tick;
+        }
+    }
+
+    for(uint32_t level = 1; level < GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS; ++level)
+    {
+        const uint32_t shift = level * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS;
+        for(uint64_t turn = (currentTick >> shift) + 1; turn <= (currentTick >> shift) + SLOTS; ++turn)
+        {
+            if(heads[level * SLOTS + (turn & mask)] != NONE)
+            {
+                return turn << shift;
+            }
+        }
+    }
+    return currentTick + 1;
+}
+
+void GDT::Internal::Network::TimerWheel::clear()
+{
+    heads.fill(NONE);
+    for(std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i].isScheduled = false;
+    }
+    count = 0;
+    currentTick = 0;
+}
+
+void GDT::Internal::Network::TimerWheel::place(uint32_t index)
+{
+    Node& node = nodes[index];
+    uint64_t delta = node.expiry > currentTick ? node.expiry - currentTick : 0;
+
+    // too far ahead expiries are placed as far as possible, and placed
+    // again when moved down
+    uint64_t expiry = node.expiry;
+    const uint64_t span = (uint64_t)1 << (GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS);
+    if(delta >= span)
+    {
+        delta = span - 1;
+        expiry = currentTick + delta;
+    }
+
+    uint32_t level = 0;
+    while(level + 1 < GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS
+        && delta >= ((uint64_t)1 << ((level + 1) * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS)))
+    {
+        ++level;
+    }
+
+    node.slot = level * SLOTS
+        + ((expiry >> (level * GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS)) & (SLOTS - 1));
+    node.previous = NONE;
+    node.next = heads[node.slot];
+    if(node.next != NONE)
+    {
+        nodes[node.next].previous = index;
+    }
+    heads[node.slot] = index;
+    node.isScheduled = true;
+}
+
+void GDT::Internal::Network::TimerWheel::unlink(uint32_t index)
+{
+    Node& node = nodes[index];
+    if(node.previous != NONE)
+    {
+        nodes[node.previous].next = node.next;
+    }
+    else
+    {
+        heads[node.slot] = node.next;
+    }
+    if(node.next != NONE)
+    {
+        nodes[node.next].previous = node.previous;
+    }
+    node.isScheduled = false;
+}
+
+GDT::Internal::Network::RateController::RateController() :
+sendRate(GDT_INTERNAL_NETWORK_GOOD_SEND_RATE),
+isSlowStart(true),
+bytesInFlight(0),
+recoveryEnd(0.0)
+{}
+
+double GDT::Internal::Network::RateController::sendInterval() const
+{
+    return 1.0 / sendRate;
+}
+
+uint32_t GDT::Internal::Network::RateController::congestionWindow(std::chrono::milliseconds rtt, uint32_t datagramSize) const
+{
+    double window = 2.0 * sendRate * (rtt.count() / 1000.0) * datagramSize;
+    double minWindow = (double)GDT_INTERNAL_NETWORK_MIN_CONGESTION_WINDOW_DATAGRAMS * datagramSize;
+    return (uint32_t)std::min(std::max(window, minWindow), (double)0xFFFFFFFF);
+}
+
+void GDT::Internal::Network::RateController::acked(uint32_t bytes, float maxRate, std::chrono::milliseconds rtt)
+{
+    bytesInFlight -= std::min(bytes, bytesInFlight);
+
+    // "rate * seconds" datagrams are acked per round trip
+    double seconds = std::max(rtt.count(), (std::chrono::milliseconds::rep)GDT_INTERNAL_NETWORK_MIN_RATE_RTT_MILLISECONDS) / 1000.0;
+    double increase = 1.0 / seconds;
+    if(!isSlowStart)
+    {
+        increase /= sendRate * seconds;
+    }
+    sendRate = std::min((float)(sendRate + increase), std::max(maxRate, GDT_INTERNAL_NETWORK_MIN_SEND_RATE));
+}
+
+void GDT::Internal::Network::RateController::lost(uint32_t bytes, double now, std::chrono::milliseconds rtt)
+{
+    bytesInFlight -= std::min(bytes, bytesInFlight);
+    congested(now, rtt);
+}
+
+void GDT::Internal::Network::RateController::congested(double now, std::chrono::milliseconds rtt)
+{
+    if(now < recoveryEnd)
+    {
+        return;
+    }
+
+    sendRate = std::max(sendRate * GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE, GDT_INTERNAL_NETWORK_MIN_SEND_RATE);
+    isSlowStart = false;
+    recoveryEnd = now + rtt.count() / 1000.0;
+}
+
+GDT::Internal::Network::RttEstimator::RttEstimator() :
+smoothedRtt(GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS),
+rttVariance(0.0),
+hasSample(false)
+{}
+
+void GDT::Internal::Network::RttEstimator::sample(double milliseconds)
+{
+    if(!hasSample)
+    {
+        smoothedRtt = milliseconds;
+        rttVariance = milliseconds / 2.0;
+        hasSample = true;
+        return;
+    }
+
+    // the variance is updated with the difference to the previous estimate
+    rttVariance += (std::abs(smoothedRtt - milliseconds) - rttVariance) / 4.0;
+    smoothedRtt += (milliseconds - smoothedRtt) / 8.0;
+}
+
+std::chrono::milliseconds GDT::Internal::Network::RttEstimator::smoothed() const
+{
+    return std::chrono::milliseconds((long long)(smoothedRtt + 0.5));
+}
+
+std::chrono::milliseconds GDT::Internal::Network::RttEstimator::retransmitTimeout() const
+{
+    if(!hasSample)
+    {
+        return std::chrono::milliseconds(GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS);
+    }
+
+    double timeout = smoothedRtt + 4.0 * rttVariance;
+    timeout = std::max(timeout, (double)GDT_INTERNAL_NETWORK_MIN_RETRANSMIT_TIMEOUT_MILLISECONDS);
+    timeout = std::min(timeout, (double)GDT_INTERNAL_NETWORK_MAX_RETRANSMIT_TIMEOUT_MILLISECONDS);
+    return std::chrono::milliseconds((long long)timeout);
+}
+
+GDT::Internal::Network::PathMtu::PathMtu() :
+low(GDT_INTERNAL_NETWORK_MIN_PATH_MTU - GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE),
+high(GDT_INTERNAL_NETWORK_MAX_PATH_MTU - GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE + 1),
+probeSize(0),
+tries(0),
+isValidated(false)
+{}
+
+uint32_t GDT::Internal::Network::PathMtu::nextProbe() const
+{
+    if(probeSize != 0 || isDone())
+    {
+        return 0;
+    }
+
+    // most paths take the largest size, so it is tried before searching
+    const uint32_t max = GDT_INTERNAL_NETWORK_MAX_PATH_MTU - GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE;
+    return high > max ? max : (low + high) / 2;
+}
+
+bool GDT::Internal::Network::PathMtu::isDone() const
+{
+    return high - low <= GDT_INTERNAL_NETWORK_PATH_MTU_PRECISION;
+}
+
+void GDT::Internal::Network::PathMtu::sent(uint32_t size)
+{
+    probeSize = size;
+}
+
+void GDT::Internal::Network::PathMtu::acked(uint32_t size)
+{
+    if(size != probeSize)
+    {
+        return;
+    }
+
+    low = std::max(low, size);
+    isValidated = true;
+    probeSize = 0;
+    tries = 0;
+}
+
+void GDT::Internal::Network::PathMtu::lost(uint32_t size)
+{
+    if(size != probeSize)
+    {
+        return;
+    }
+
+    probeSize = 0;
+    if(++tries >= GDT_INTERNAL_NETWORK_PATH_MTU_PROBE_TRIES)
+    {
+        high = size;
+        tries = 0;
+    }
+}
+
+uint32_t GDT::Internal::Network::PathMtu::datagramSize(uint32_t configured) const
+{
+    // the configured size is assumed to get through, as it was before, until
+    // the search shows it does not
+    if(isDone())
+    {
+        return low;
+    }
+    return isValidated ? std::max(low, configured) : configured;
+}
+
+GDT::Internal::Network::Pacer::Pacer() :
+rate(0.0),
+tokens(GDT_INTERNAL_NETWORK_PACING_MIN_BURST)
+{}
+
+void GDT::Internal::Network::Pacer::refill(double deltaTime)
+{
+    // keep at most one update's worth, or one tick's if updates are faster
+    double pacedRate = rate * GDT_INTERNAL_NETWORK_PACING_HEADROOM;
+    double capacity = std::max(GDT_INTERNAL_NETWORK_PACING_MIN_BURST,
+        pacedRate * std::max(deltaTime, 1.0 / GDT_INTERNAL_NETWORK_TIMER_TICKS_PER_SECOND));
+    tokens = std::min(tokens + pacedRate * deltaTime, capacity);
+}
+
+bool GDT::Internal::Network::Pacer::take()
+{
+    if(tokens < 1.0)
+    {
+        return false;
+    }
+    tokens -= 1.0;
+    return true;
+}
+
+double GDT::Internal::Network::Pacer::gap() const
+{
+    return rate > 0.0 ? 1.0 / (rate * GDT_INTERNAL_NETWORK_PACING_HEADROOM) : 0.0;
+}
+
+GDT::Internal::Network::Reassembly::Reassembly() :
+firstSequence(0),
+count(0),
+remaining(0),
+isActive(false)
+{}
+
+GDT::Internal::Network::MessageChannel::MessageChannel() :
+nextSequence(0),
+oldestUnacked(0),
+nextReceived(0)
+{
+    isSentUnacked.fill(false);
+    isSentFragment.fill(false);
+    isQueued.fill(false);
+    wasSent.fill(false);
+    isReceived.fill(false);
+    isReceivedFragment.fill(false);
+}
+
+uint32_t GDT::Internal::Network::MessageChannel::keyOf(uint8_t channel, uint16_t sequence)
+{
+    return ((uint32_t)channel << 16) | sequence;
+}
+
+bool GDT::Internal::Network::MessageChannel::push(std::vector<char>& data, bool isFragment, uint16_t& sequence)
+{
+    if((uint16_t)(nextSequence - oldestUnacked) >= GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE)
+    {
+        return false;
+    }
+
+    sequence = nextSequence++;
+    uint32_t slot = slotOf(sequence);
+    sent[slot].swap(data);
+    isSentUnacked[slot] = true;
+    isSentFragment[slot] = isFragment;
+    isQueued[slot] = false;
+    wasSent[slot] = false;
+    return true;
+}
+
+bool GDT::Internal::Network::MessageChannel::isUnacked(uint16_t sequence) const
+{
+    return (uint16_t)(sequence - oldestUnacked) < (uint16_t)(nextSequence - oldestUnacked)
+        && isSentUnacked[slotOf(sequence)];
+}
+
+bool GDT::Internal::Network::MessageChannel::ack(uint16_t sequence)
+{
+    if(!isUnacked(sequence))
+    {
+        return false;
+    }
+
+    uint32_t slot = slotOf(sequence);
+    isSentUnacked[slot] = false;
+    std::vector<char>().swap(sent[slot]);
+    while(oldestUnacked != nextSequence && !isSentUnacked[slotOf(oldestUnacked)])
+    {
+        ++oldestUnacked;
+    }
+    return true;
+}
+
+uint32_t GDT::Internal::Network::MessageChannel::slotOf(uint16_t sequence)
+{
+    return sequence & (GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE - 1);
+}
+
+GDT::Internal::Network::MessageChannel::Receipt GDT::Internal::Network::MessageChannel::receive(uint16_t sequence, const char* data, uint32_t size, bool isOrdered, bool isFragment)
+{
+    // older messages were all received, and the sender never gets a window
+    // ahead
+    if((uint16_t)(sequence - nextReceived) >= GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE)
+    {
+        return DROPPED;
+    }
+
+    uint32_t slot = slotOf(sequence);
+    if(isReceived[slot])
+    {
+        return DROPPED;
+    }
+
+    if(sequence == nextReceived)
+    {
+        ++nextReceived;
+        if(!isOrdered)
+        {
+            // skip past the messages already received ahead of this one
+            while(isReceived[slotOf(nextReceived)])
+            {
+                isReceived[slotOf(nextReceived)] = false;
+                ++nextReceived;
+            }
+        }
+        return DELIVERED;
+    }
+
+    isReceived[slot] = true;
+    if(!isOrdered)
+    {
+        return DELIVERED;
+    }
+    received[slot].assign(data, data + size);
+    isReceivedFragment[slot] = isFragment;
+    return BUFFERED;
+}
+
+uint16_t GDT::Internal::Network::MessageChannel::queuedEnd() const
+{
+    return nextSequence + waiting.size();
+}
+
+bool GDT::Internal::Network::MessageChannel::popTracked(uint32_t& trackingId)
+{
+    // messages before oldestUnacked were all acked
+    if(tracked.empty() || (uint16_t)(oldestUnacked - tracked.front().first) >= 0x8000)
+    {
+        return false;
+    }
+
+    trackingId = tracked.front().second;
+    tracked.pop_front();
+    return true;
+}
+
+bool GDT::Internal::Network::MessageChannel::popReceived(std::vector<char>& data, bool& isFragment, uint16_t& sequence)
+{
+    uint32_t slot = slotOf(nextReceived);
+    if(!isReceived[slot])
+    {
+        return false;
+    }
+
+    // the buffers are swapped so that both keep their capacity
+    isReceived[slot] = false;
+    data.swap(received[slot]);
+    isFragment = isReceivedFragment[slot];
+    sequence = nextReceived++;
+    return true;
+}
+
+bool GDT::Internal::Network::MessageChannel::reassemble(uint16_t sequence, const char* data, uint32_t size, std::vector<char>& message)
+{
+    if(size < GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    uint16_t index;
+    std::memcpy(&index, data, 2);
+    index = ntohs(index);
+    uint16_t count;
+    std::memcpy(&count, data + 2, 2);
+    count = ntohs(count);
+    uint32_t total;
+    std::memcpy(&total, data + 4, 4);
+    total = ntohl(total);
+    data += GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE;
+    size -= GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE;
+
+    // every fragment but the last is "fragmentSize" bytes
+    if(index >= count || total > GDT_INTERNAL_NETWORK_MAX_FRAGMENTED_SIZE)
+    {
+        return false;
+    }
+    uint32_t fragmentSize = (total + count - 1) / count;
+    uint32_t offset = index * fragmentSize;
+    if(offset > total || size != std::min(fragmentSize, total - offset))
+    {
+        return false;
+    }
+
+    uint16_t firstSequence = sequence - index;
+    Reassembly* reassembly = nullptr;
+    Reassembly* unused = nullptr;
+    for(auto iter = reassemblies.begin(); iter != reassemblies.end(); ++iter)
+    {
+        if(iter->isActive && iter->firstSequence == firstSequence)
+        {
+            reassembly = &*iter;
+            break;
+        }
+        else if(!iter->isActive && unused == nullptr)
+        {
+            unused = &*iter;
+        }
+    }
+
+    if(reassembly == nullptr)
+    {
+        if(unused == nullptr)
+        {
+            reassemblies.push_back(Reassembly());
+            unused = &reassemblies.back();
+        }
+        reassembly = unused;
+        reassembly->firstSequence = firstSequence;
+        reassembly->count = count;
+        reassembly->remaining = count;
+        reassembly->isActive = true;
+        reassembly->data.resize(total);
+    }
+    else if(reassembly->count != count || reassembly->data.size() != total)
+    {
+        return false;
+    }
+
+    if(size > 0)
+    {
+        std::memcpy(reassembly->data.data() + offset, data, size);
+    }
+    if(--reassembly->remaining > 0)
+    {
+        return false;
+    }
+
+    // the buffers are swapped so that both keep their capacity
+    reassembly->isActive = false;
+    message.swap(reassembly->data);
+    return true;
+}
+
 GDT::Internal::Network::ConnectionData::ConnectionData() :
 timeSinceLastReceived(std::chrono::steady_clock::now()),
 timeSinceLastSent(std::chrono::steady_clock::now()),
+id(0),
+lSequence(0),
 rSequence(0),
 ackBitfield(0xFFFFFFFF),
 rtt(std::chrono::milliseconds(1000)),
 triggerSend(false),
-timer(0.0f),
-isGood(false),
-isGoodRtt(false),
-toggleTime(30.0f),
-toggleTimer(0.0f),
-toggledTimer(0.0f)
+timerStart(0.0),
+preferMessages(false),
+address(0),
+port(0),
+isConnected(false),
+generation(0)
 {}
 
-GDT::Internal::Network::ConnectionData::ConnectionData(uint32_t id, uint32_t lSequence, uint16_t port) :
+GDT::Internal::Network::ConnectionData::ConnectionData(uint32_t id, uint32_t lSequence, uint32_t address, uint16_t port) :
 timeSinceLastReceived(std::chrono::steady_clock::now()),
 timeSinceLastSent(std::chrono::steady_clock::now()),
 id(id),
@@ -60,13 +874,12 @@ rSequence(0),
 ackBitfield(0xFFFFFFFF),
 rtt(std::chrono::milliseconds(1000)),
 triggerSend(false),
-timer(0.0f),
-isGood(false),
-isGoodRtt(false),
-toggleTime(30.0f),
-toggleTimer(0.0f),
-toggledTimer(0.0f),
-port(port)
+timerStart(0.0),
+preferMessages(false),
+address(address),
+port(port),
+isConnected(true),
+generation(0)
 {}
 
 bool GDT::Internal::Network::ConnectionData::operator== (const GDT::Internal::Network::ConnectionData& other) const
@@ -74,6 +887,395 @@ bool GDT::Internal::Network::ConnectionData::operator== (const GDT::Internal::Ne
     return id == other.id;
 }
 
+GDT::Internal::Network::DatagramBuffers::DatagramBuffers() :
+count(0),
+size(0)
+{}
+
+void GDT::Internal::Network::DatagramBuffers::allocate(unsigned int count, unsigned int size)
+{
+    if(this->count == count && this->size == size)
+    {
+        return;
+    }
+
+    this->count = count;
+    this->size = size;
+    data.assign((std::size_t)count * size, 0);
+    sizes.assign(count, 0);
+    addresses.assign(count, sockaddr_in());
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    iovecs.assign(count, iovec());
+    headers.assign(count, mmsghdr());
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        iovecs[i].iov_base = at(i);
+        iovecs[i].iov_len = size;
+        headers[i].msg_hdr.msg_name = &addresses[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+}
+
+char* GDT::Internal::Network::DatagramBuffers::at(unsigned int index)
+{
+    return data.data() + (std::size_t)index * size;
+}
+
+char* GDT::Internal::Network::SendBatch::stage(std::size_t size, uint32_t address, uint16_t port, Kind kind, bool isCoalesced)
+{
+    Entry entry;
+    entry.offset = arena.size();
+    entry.size = size;
+    entry.payload = nullptr;
+    entry.payloadSize = 0;
+    entry.address = address;
+    entry.port = port;
+    entry.sequenceID = 0;
+    entry.kind = kind;
+    entry.isCoalesced = isCoalesced;
+    entry.sentBytes = -1;
+    entries.push_back(entry);
+
+    arena.resize(arena.size() + size);
+    return arena.data() + entry.offset;
+}
+
+void GDT::Internal::Network::SendBatch::attach(const char* payload, std::size_t size)
+{
+    entries.back().payload = payload;
+    entries.back().payloadSize = size;
+}
+
+void GDT::Internal::Network::SendBatch::hold(std::vector<char>&& payload)
+{
+    heldPayloads.push_back(std::move(payload));
+    attach(heldPayloads.back().data(), heldPayloads.back().size());
+}
+
+void GDT::Internal::Network::SendBatch::prepare()
+{
+    // arena may have been reallocated while staging, so pointers are only
+    // taken now
+    addresses.resize(entries.size());
+#if PLATFORM != PLATFORM_WINDOWS
+    iovecs.resize(entries.size() * 2);
+#endif
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    headers.resize(entries.size());
+#endif
+    for(unsigned int i = 0; i < entries.size(); ++i)
+    {
+        addresses[i] = sockaddr_in();
+        addresses[i].sin_family = AF_INET;
+        addresses[i].sin_addr.s_addr = htonl(entries[i].address);
+        addresses[i].sin_port = htons(entries[i].port);
+#if PLATFORM != PLATFORM_WINDOWS
+        iovecs[i * 2].iov_base = at(i);
+        iovecs[i * 2].iov_len = entries[i].size;
+        iovecs[i * 2 + 1].iov_base = (void*) entries[i].payload;
+        iovecs[i * 2 + 1].iov_len = entries[i].payloadSize;
+#endif
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+        headers[i] = mmsghdr();
+        headers[i].msg_hdr.msg_name = &addresses[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        headers[i].msg_hdr.msg_iov = &iovecs[i * 2];
+        headers[i].msg_hdr.msg_iovlen = entries[i].payloadSize == 0 ? 1 : 2;
+#endif
+    }
+}
+
+void GDT::Internal::Network::SendBatch::clear()
+{
+    arena.clear();
+    entries.clear();
+    heldPayloads.clear();
+}
+
+char* GDT::Internal::Network::SendBatch::at(unsigned int index)
+{
+    return arena.data() + entries[index].offset;
+}
+
+std::size_t GDT::Internal::Network::SendBatch::sizeOf(unsigned int index) const
+{
+    return entries[index].size + entries[index].payloadSize;
+}
+
+GDT::Internal::Network::Impairment::Impairment() :
+loss(0.0f),
+latency(0.0f),
+jitter(0.0f),
+reorder(0.0f),
+reorderDelay(0.0f),
+duplicate(0.0f),
+bandwidth(0),
+queueLimit(0),
+seed(0)
+{}
+
+namespace
+{
+    bool isLater(const GDT::Internal::Network::ImpairmentSimulator::Datagram& a,
+                 const GDT::Internal::Network::ImpairmentSimulator::Datagram& b)
+    {
+        return a.due > b.due || (a.due == b.due && a.order > b.order);
+    }
+}
+
+GDT::Internal::Network::ImpairmentSimulator::ImpairmentSimulator() :
+isEnabled(false),
+nextOrder(0),
+linkFree(0.0)
+{}
+
+void GDT::Internal::Network::ImpairmentSimulator::configure(const Impairment& impairment)
+{
+    settings = impairment;
+    isEnabled = impairment.loss > 0.0f
+        || impairment.latency > 0.0f
+        || impairment.jitter > 0.0f
+        || impairment.reorder > 0.0f
+        || impairment.duplicate > 0.0f
+        || impairment.bandwidth != 0;
+    random.seed(impairment.seed);
+    clear();
+}
+
+bool GDT::Internal::Network::ImpairmentSimulator::isActive() const
+{
+    return isEnabled || !held.empty();
+}
+
+void GDT::Internal::Network::ImpairmentSimulator::send(const char* data, std::size_t size, const char* payload, std::size_t payloadSize, uint32_t address, uint16_t port, double now)
+{
+    if(chance() < settings.loss)
+    {
+        return;
+    }
+
+    double due = now;
+    if(settings.bandwidth != 0)
+    {
+        // datagrams are put on the link one after another
+        double start = std::max(now, linkFree);
+        double queued = (start - now) * settings.bandwidth;
+        if(settings.queueLimit != 0 && queued + size + payloadSize > settings.queueLimit)
+        {
+            return;
+        }
+        linkFree = start + (double)(size + payloadSize) / settings.bandwidth;
+        due = linkFree;
+    }
+
+    unsigned int copies = chance() < settings.duplicate ? 2 : 1;
+    for(unsigned int i = 0; i < copies; ++i)
+    {
+        double delay = (settings.latency + chance() * settings.jitter) / 1000.0;
+        if(chance() < settings.reorder)
+        {
+            delay += settings.reorderDelay / 1000.0;
+        }
+        hold(data, size, payload, payloadSize, address, port, due + delay);
+    }
+}
+
+bool GDT::Internal::Network::ImpairmentSimulator::pop(double now, Datagram& datagram)
+{
+    if(held.empty() || held.front().due > now)
+    {
+        return false;
+    }
+
+    std::pop_heap(held.begin(), held.end(), isLater);
+    datagram = std::move(held.back());
+    held.pop_back();
+    return true;
+}
+
+double GDT::Internal::Network::ImpairmentSimulator::nextDue() const
+{
+    return held.empty() ? -1.0 : held.front().due;
+}
+
+void GDT::Internal::Network::ImpairmentSimulator::clear()
+{
+    held.clear();
+    nextOrder = 0;
+    linkFree = 0.0;
+}
+
+double GDT::Internal::Network::ImpairmentSimulator::chance()
+{
+    // mt19937 is the same everywhere, unlike the standard distributions
+    return (random() >> 8) * (1.0 / 16777216.0);
+}
+
+void GDT::Internal::Network::ImpairmentSimulator::hold(const char* data, std::size_t size, const char* payload, std::size_t payloadSize, uint32_t address, uint16_t port, double due)
+{
+    Datagram datagram;
+    datagram.due = due;
+    datagram.order = nextOrder++;
+    datagram.data.reserve(size + payloadSize);
+    datagram.data.assign(data, data + size);
+    datagram.data.insert(datagram.data.end(), payload, payload + payloadSize);
+    datagram.address = address;
+    datagram.port = port;
+    held.push_back(std::move(datagram));
+    std::push_heap(held.begin(), held.end(), isLater);
+}
+
+GDT::Internal::Network::QueuedSend::QueuedSend() :
+address(0),
+isReceivedChecked(false),
+isMessage(false),
+channel(0),
+isTracked(false),
+trackingId(0)
+{}
+
+GDT::Internal::Network::ConnectionEvent::ConnectionEvent() :
+type(RECEIVED),
+address(0),
+outOfOrder(false),
+isResent(false),
+isReceivedChecked(false),
+trackingId(0)
+{}
+
+GDT::Internal::Network::SocketCounters::SocketCounters() :
+sendCalls(0),
+sentDatagrams(0),
+receiveCalls(0),
+receivedDatagrams(0),
+pacedSends(0),
+sendGaps(0),
+sendGapMicroseconds(0),
+shortSendGaps(0)
+{}
+
+GDT::Internal::Network::ConnectionStats::ConnectionStats() :
+sentDatagrams(0),
+sentBytes(0),
+receivedDatagrams(0),
+receivedBytes(0),
+lostDatagrams(0),
+resentPackets(0),
+resentMessages(0),
+duplicateDatagrams(0),
+outOfOrderDatagrams(0),
+queuedPackets(0),
+queuedMessages(0),
+bytesInFlight(0)
+{}
+
+void GDT::Internal::Network::ConnectionStats::add(const ConnectionStats& other)
+{
+    sentDatagrams += other.sentDatagrams;
+    sentBytes += other.sentBytes;
+    receivedDatagrams += other.receivedDatagrams;
+    receivedBytes += other.receivedBytes;
+    lostDatagrams += other.lostDatagrams;
+    resentPackets += other.resentPackets;
+    resentMessages += other.resentMessages;
+    duplicateDatagrams += other.duplicateDatagrams;
+    outOfOrderDatagrams += other.outOfOrderDatagrams;
+    queuedPackets += other.queuedPackets;
+    queuedMessages += other.queuedMessages;
+    bytesInFlight += other.bytesInFlight;
+}
+
+GDT::Internal::Network::NetworkStats::NetworkStats() :
+connections(0),
+connects(0),
+disconnects(0),
+maxQueued(0),
+sentBytesPerSecond(0.0),
+receivedBytesPerSecond(0.0),
+updates(0),
+updateMicroseconds(0),
+maxUpdateMicroseconds(0)
+{}
+
+void GDT::Internal::Network::NetworkStats::add(const NetworkStats& other)
+{
+    total.add(other.total);
+    connections += other.connections;
+    connects += other.connects;
+    disconnects += other.disconnects;
+    maxQueued = std::max(maxQueued, other.maxQueued);
+    sentBytesPerSecond += other.sentBytesPerSecond;
+    receivedBytesPerSecond += other.receivedBytesPerSecond;
+    updates += other.updates;
+    updateMicroseconds += other.updateMicroseconds;
+    maxUpdateMicroseconds = std::max(maxUpdateMicroseconds, other.maxUpdateMicroseconds);
+}
+
+namespace
+{
+    // the names and values of the fields of NetworkStats, in the order of
+    // the CSV columns, with the rates rounded to whole bytes
+    template <typename Field>
+    void forEachStat(const GDT::Internal::Network::NetworkStats& stats, Field field)
+    {
+        field("connections", stats.connections);
+        field("connects", stats.connects);
+        field("disconnects", stats.disconnects);
+        field("sentDatagrams", stats.total.sentDatagrams);
+        field("sentBytes", stats.total.sentBytes);
+        field("receivedDatagrams", stats.total.receivedDatagrams);
+        field("receivedBytes", stats.total.receivedBytes);
+        field("lostDatagrams", stats.total.lostDatagrams);
+        field("resentPackets", stats.total.resentPackets);
+        field("resentMessages", stats.total.resentMessages);
+        field("duplicateDatagrams", stats.total.duplicateDatagrams);
+        field("outOfOrderDatagrams", stats.total.outOfOrderDatagrams);
+        field("queuedPackets", stats.total.queuedPackets);
+        field("queuedMessages", stats.total.queuedMessages);
+        field("bytesInFlight", stats.total.bytesInFlight);
+        field("maxQueued", stats.maxQueued);
+        field("sentBytesPerSecond", (uint64_t)std::llround(stats.sentBytesPerSecond));
+        field("receivedBytesPerSecond", (uint64_t)std::llround(stats.receivedBytesPerSecond));
+        field("updates", stats.updates);
+        field("updateMicroseconds", stats.updateMicroseconds);
+        field("maxUpdateMicroseconds", stats.maxUpdateMicroseconds);
+    }
+}
+
+std::string GDT::Internal::Network::statsCsvHeader()
+{
+    std::string header = "time";
+    forEachStat(NetworkStats(), [&header] (const char* name, uint64_t) {
+        header += ',';
+        header += name;
+    });
+    return header;
+}
+
+std::string GDT::Internal::Network::statsToCsv(const NetworkStats& stats, double time)
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3) << time;
+    forEachStat(stats, [&line] (const char*, uint64_t value) {
+        line << ',' << value;
+    });
+    return line.str();
+}
+
+std::string GDT::Internal::Network::statsToJson(const NetworkStats& stats, double time)
+{
+    std::ostringstream line;
+    line << "{\"time\":" << std::fixed << std::setprecision(3) << time;
+    forEachStat(stats, [&line] (const char* name, uint64_t value) {
+        line << ",\"" << name << "\":" << value;
+    });
+    line << '}';
+    return line.str();
+}
+
 bool GDT::Internal::Network::MoreRecent(uint32_t current, uint32_t previous)
 {
     return (((current > previous) && (current - previous <= 0x7FFFFFFF)) ||
@@ -102,6 +1304,15 @@ void GDT::Internal::Network::CleanupSockets()
 #endif
 }
 
+bool GDT::Internal::Network::lastErrorIsWouldBlock()
+{
+#if PLATFORM == PLATFORM_WINDOWS
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
 std::string GDT::Internal::Network::addressToString(const uint32_t& address)
 {
     return
@@ -241,6 +1452,35 @@ uint32_t GDT::Internal::Network::getBroadcastAddress()
 #endif
 }
 
+bool GDT::Internal::Network::getCachedBroadcastAddress(uint32_t& address)
+{
+    static std::mutex mutex;
+    static std::future<uint32_t> lookup;
+    static uint32_t cachedAddress = 0;
+    static bool hasAddress = false;
+    static std::chrono::steady_clock::time_point lookedUp;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    if(lookup.valid())
+    {
+        if(lookup.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            cachedAddress = lookup.get();
+            hasAddress = true;
+            lookedUp = now;
+        }
+    }
+    else if(!hasAddress
+        || now - lookedUp >= std::chrono::seconds(GDT_INTERNAL_NETWORK_BROADCAST_ADDRESS_REFRESH_SECONDS))
+    {
+        lookup = std::async(std::launch::async, getBroadcastAddress);
+    }
+
+    address = cachedAddress;
+    return hasAddress;
+}
+
 std::size_t std::hash<GDT::Internal::Network::ConnectionData>::operator() (const GDT::Internal::Network::ConnectionData& connectionData) const
 {
     return connectionData.id;
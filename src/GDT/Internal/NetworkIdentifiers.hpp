@@ -8,24 +8,82 @@
  #define GDT_INTERNAL_NETWORK_PROTOCOL_ID 1357924680
 #endif
 #define GDT_INTERNAL_NETWORK_SERVER_PORT 12084
+// the retransmission timeout until a round-trip-time was measured
 #define GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS 1000
-#define GDT_INTERNAL_NETWORK_SENT_PACKET_LIST_MAX_SIZE 34
+#define GDT_INTERNAL_NETWORK_MIN_RETRANSMIT_TIMEOUT_MILLISECONDS 50
+#define GDT_INTERNAL_NETWORK_MAX_RETRANSMIT_TIMEOUT_MILLISECONDS 3000
+#define GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE 64
 #define GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS 10000
 #define GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS 5.0f
+// the cached broadcast address is looked up again after this long
+#define GDT_INTERNAL_NETWORK_BROADCAST_ADDRESS_REFRESH_SECONDS 30
 #define GDT_INTERNAL_NETWORK_GOOD_RTT_LIMIT_MILLISECONDS 250
 #define GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE 8192
 #define GDT_INTERNAL_NETWORK_HEARTBEAT_SEND_INTERVAL_MILLISECONDS 150
+#define GDT_INTERNAL_NETWORK_RECEIVE_BUDGET 512
+#define GDT_INTERNAL_NETWORK_RECEIVE_BATCH_SIZE 32
+// consecutive receive errors after which an update stops reading, as an
+// error that persists would be returned again on every read
+#define GDT_INTERNAL_NETWORK_MAX_RECEIVE_ERRORS 8
+#define GDT_INTERNAL_NETWORK_SEND_BATCH_MAX_SIZE 1024
+#define GDT_INTERNAL_NETWORK_DEFAULT_MAX_DATAGRAM_SIZE 1200
+#define GDT_INTERNAL_NETWORK_ID_MASK 0x03FFFFFF
+#define GDT_INTERNAL_NETWORK_THREAD_QUEUE_SIZE 4096
+// datagrams a LoopbackTransport holds before it drops more
+#define GDT_INTERNAL_NETWORK_LOOPBACK_QUEUE_SIZE 1024
+#define GDT_INTERNAL_NETWORK_LOOPBACK_FIRST_EPHEMERAL_PORT 49152
+#define GDT_INTERNAL_NETWORK_TIMER_TICKS_PER_SECOND 1000
+#define GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS 4
+#define GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS 6
 
-#define GDT_INTERNAL_NETWORK_GOOD_MODE_SEND_INTERVAL 1.0f/30.0f
-#define GDT_INTERNAL_NETWORK_BAD_MODE_SEND_INTERVAL 1.0f/10.0f
+// send rates are in datagrams per second
+#define GDT_INTERNAL_NETWORK_MIN_SEND_RATE 10.0f
+#define GDT_INTERNAL_NETWORK_GOOD_SEND_RATE 30.0f
+#define GDT_INTERNAL_NETWORK_DEFAULT_MAX_SEND_RATE 120.0f
+// round-trip-times below this are taken as this when growing the send rate
+#define GDT_INTERNAL_NETWORK_MIN_RATE_RTT_MILLISECONDS 10
+#define GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE 0.5f
+#define GDT_INTERNAL_NETWORK_MAX_SEND_BURST 4
+#define GDT_INTERNAL_NETWORK_LOSS_REORDER_THRESHOLD 3
+#define GDT_INTERNAL_NETWORK_MIN_CONGESTION_WINDOW_DATAGRAMS 4
+#define GDT_INTERNAL_NETWORK_PACING_HEADROOM 1.25
+#define GDT_INTERNAL_NETWORK_PACING_MIN_BURST 2.0
+
+// reliable messages of a channel that may be unacked at once
+#define GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE 256
+#define GDT_INTERNAL_NETWORK_RELIABLE_CHANNEL_COUNT 2
+// channel, sequence and length in front of every message of a datagram
+#define GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE 5
+// set in the channel of a message that is a fragment of a larger one
+#define GDT_INTERNAL_NETWORK_MESSAGE_FRAGMENT_FLAG 0x80
+// index, count and total size in front of the data of every fragment
+#define GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE 8
+#define GDT_INTERNAL_NETWORK_MAX_FRAGMENTED_SIZE 0x1000000
+
+// path MTUs include the IPv4 and UDP headers in front of every datagram
+#define GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE 28
+#define GDT_INTERNAL_NETWORK_MIN_PATH_MTU 576
+#define GDT_INTERNAL_NETWORK_MAX_PATH_MTU 1500
+// the search stops once the path MTU is known within this many bytes
+#define GDT_INTERNAL_NETWORK_PATH_MTU_PRECISION 16
+#define GDT_INTERNAL_NETWORK_PATH_MTU_PROBE_TRIES 3
+// sent and received snapshots kept per peer of a SnapshotReplicator as
+// baselines for deltas
+#define GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE 32
+// tag, sequence, baseline sequence and size of a snapshot packet
+#define GDT_INTERNAL_NETWORK_SNAPSHOT_HEADER_SIZE 13
 
 #include <list>
+#include <deque>
 #include <vector>
+#include <array>
 #include <cstdlib>
 #include <cstdint>
 #include <chrono>
 #include <atomic>
 #include <string>
+#include <utility>
+#include <random>
 
 #include "Platform.hpp"
 
@@ -35,7 +93,25 @@
 #elif PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
  #include <sys/socket.h>
  #include <netinet/in.h>
+ #include <sys/uio.h>
  #include <fcntl.h>
+ #include <cerrno>
+#endif
+
+#if PLATFORM == PLATFORM_UNIX && defined(__linux__)
+ // recvmmsg/sendmmsg are available
+ #define GDT_INTERNAL_NETWORK_HAS_MMSG
+ // epoll and timerfd are available
+ #define GDT_INTERNAL_NETWORK_HAS_EPOLL
+ // sockets may share a port with SO_REUSEPORT, and the kernel balances
+ // datagrams between them by source address and port
+ #define GDT_INTERNAL_NETWORK_HAS_REUSEPORT
+ // the fq qdisc paces a socket to SO_MAX_PACING_RATE
+ #define GDT_INTERNAL_NETWORK_HAS_PACING_RATE
+ #include <sys/epoll.h>
+ #include <sys/timerfd.h>
+#elif PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+ #include <poll.h>
 #endif
 
 namespace GDT
@@ -50,13 +126,14 @@ extern std::atomic_uint_fast32_t connectionInstanceCount;
 struct PacketInfo
 {
     PacketInfo();
-    PacketInfo(const std::vector<char>& data = std::vector<char>(),
+    PacketInfo(std::vector<char> data,
         std::chrono::steady_clock::time_point sentTime =
             std::chrono::steady_clock::time_point(),
         uint32_t address = 0,
         uint32_t id = 0,
         bool isResending = false,
-        bool isNotReceivedChecked = false);
+        bool isNotReceivedChecked = false,
+        bool isCoalesced = false);
 
     std::vector<char> data;
     std::chrono::steady_clock::time_point sentTime;
@@ -65,12 +142,480 @@ struct PacketInfo
     bool isResending;
     bool isNotReceivedChecked;
     bool hasBeenReSent;
+    bool isCoalesced;
+    /// The size of the sent datagram, counted in flight until acked or lost.
+    uint32_t size;
+    bool isInFlight;
+    /// The reliable messages sent in this datagram (see MessageChannel::keyOf).
+    std::vector<uint32_t> messages;
+    /// The size of this datagram if it is a path MTU probe, or 0.
+    uint32_t probeSize;
+    /// The ids of the tracked packets in this datagram (or of this queued
+    /// packet), reported once it is acked.
+    std::vector<uint32_t> trackingIds;
+};
+
+/// The most recently sent packets of a connection, indexed by sequence id.
+/**
+    Packet "id" is stored in slot "id % GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE"
+    so lookups are O(1). Storing a packet replaces the packet sent
+    GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE sequence ids before it. Slots
+    keep their data buffer so that storing packets does not allocate once
+    each slot has held a packet of the same size.
+*/
+struct SentPacketRing
+{
+    static_assert((GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE
+            & (GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE - 1)) == 0,
+        "GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE must be a power of two");
+    static_assert(GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE > 33,
+        "GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE must cover an ack and its bitfield");
+
+    SentPacketRing();
+
+    /// Returns the slot for packet "id" with its data cleared and flags reset.
+    PacketInfo& insert(uint32_t id);
+
+    /// Returns the stored packet "id" or nullptr if it is not stored.
+    PacketInfo* find(uint32_t id);
+
+    std::array<PacketInfo, GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE> slots;
+    std::array<bool, GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE> isValid;
+};
+
+/// The IPv4 address and port of a peer.
+struct Endpoint
+{
+    Endpoint();
+    Endpoint(uint32_t address, uint16_t port);
+
+    uint32_t address;
+    uint16_t port;
+
+    bool operator== (const Endpoint& other) const;
+};
+
+/// An open addressing hash map from endpoints to connection slot indices.
+/**
+    Entries are stored in one power of two sized array and found by linear
+    probing, so a lookup usually touches a single cache line. Erasing shifts
+    the following entries back instead of leaving tombstones.
+*/
+struct EndpointMap
+{
+    static const uint32_t NOT_FOUND = 0xFFFFFFFF;
+
+    struct Entry
+    {
+        Endpoint endpoint;
+        uint32_t index;
+        bool isUsed;
+    };
+
+    EndpointMap();
+
+    /// Returns the index mapped to "endpoint" or EndpointMap::NOT_FOUND.
+    uint32_t find(const Endpoint& endpoint) const;
+
+    /// Maps "endpoint" to "index", replacing any previous mapping.
+    void insert(const Endpoint& endpoint, uint32_t index);
+
+    /// Returns true if "endpoint" was mapped.
+    bool erase(const Endpoint& endpoint);
+
+    void clear();
+
+    std::size_t size() const;
+
+    /// The slot "endpoint" is placed at when there are no collisions.
+    std::size_t homeOf(const Endpoint& endpoint) const;
+
+    std::vector<Entry> entries;
+    std::size_t count;
+};
+
+/// Identifies a connection of a NetworkConnection.
+/**
+    Unlike an IP address, a handle tells apart peers that share an address
+    (i.e. multiple clients behind the same NAT). A handle stays valid until
+    its peer disconnects; handles of disconnected peers are never reused for
+    new peers, so they can be cached safely. A default constructed handle
+    does not refer to any connection.
+*/
+struct ConnectionHandle
+{
+    ConnectionHandle();
+    ConnectionHandle(uint32_t index, uint32_t generation);
+
+    /// Returns false if this handle was default constructed.
+    bool isValid() const;
+
+    bool operator== (const ConnectionHandle& other) const;
+    bool operator!= (const ConnectionHandle& other) const;
+
+    /// The slot of the connection.
+    uint32_t index;
+    /// Incremented every time the slot is reused for a new connection.
+    uint32_t generation;
+};
+
+/// A hierarchical timer wheel of connection slot indices.
+/**
+    Each index may be scheduled to expire at one tick. Level 0 has one slot
+    per tick, and each following level has slots covering a whole turn of the
+    level below it; when a level turns, the next slot of the level above is
+    moved down. Scheduling, cancelling and expiring are O(1), and advancing
+    only visits the slots of the ticks passed. Nodes are linked by index so
+    that they stay valid when the connection slots are reallocated.
+*/
+struct TimerWheel
+{
+    static const uint32_t NONE = 0xFFFFFFFF;
+    static const uint32_t SLOTS = 1 << GDT_INTERNAL_NETWORK_TIMER_WHEEL_SLOT_BITS;
+
+    struct Node
+    {
+        uint64_t expiry;
+        uint32_t previous;
+        uint32_t next;
+        uint32_t slot;
+        bool isScheduled;
+    };
+
+    TimerWheel();
+
+    /// Makes room for indices below "count".
+    void resize(std::size_t count);
+
+    /// Schedules "index" at "tick", replacing its previous schedule.
+    /**
+        Ticks that are not after the current tick expire on the next tick.
+    */
+    void schedule(uint32_t index, uint64_t tick);
+
+    void cancel(uint32_t index);
+
+    /// Advances to "tick", appending every index that expired to "expired".
+    void advance(uint64_t tick, std::vector<uint32_t>& expired);
+
+    /// Returns a tick at or before the earliest expiry, or UINT64_MAX if
+    /// nothing is scheduled.
+    /**
+        Exact for expiries within one turn of level 0, otherwise the tick at
+        which the expiry is moved down a level.
+    */
+    uint64_t nextExpiry() const;
+
+    void clear();
+
+    void place(uint32_t index);
+    void unlink(uint32_t index);
+
+    uint64_t currentTick;
+    std::size_t count;
+    std::vector<Node> nodes;
+    std::array<uint32_t, GDT_INTERNAL_NETWORK_TIMER_WHEEL_LEVELS * SLOTS> heads;
+};
+
+/// An AIMD controller of the send rate and bytes in flight of a connection.
+/**
+    The rate starts at GDT_INTERNAL_NETWORK_GOOD_SEND_RATE. Until the first
+    decrease, every acked datagram adds one datagram per round trip to the
+    rate, doubling it every round trip. After that, the acked datagrams of a
+    round trip add about one datagram per round trip. A lost datagram, or a
+    round-trip-time over GDT_INTERNAL_NETWORK_GOOD_RTT_LIMIT_MILLISECONDS,
+    multiplies the rate by GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE, at most
+    once per round trip. The congestion window allows twice the datagrams
+    the rate sends in a round trip to be in flight.
+*/
+struct RateController
+{
+    RateController();
+
+    /// Returns the seconds between datagrams at the current rate.
+    double sendInterval() const;
+
+    /// Returns the bytes that may be in flight.
+    uint32_t congestionWindow(std::chrono::milliseconds rtt, uint32_t datagramSize) const;
+
+    /// Removes an acked datagram from flight and increases the rate.
+    void acked(uint32_t bytes, float maxRate, std::chrono::milliseconds rtt);
+
+    /// Removes a lost datagram from flight and decreases the rate.
+    void lost(uint32_t bytes, double now, std::chrono::milliseconds rtt);
+
+    /// Decreases the rate unless it was decreased within the last round trip.
+    void congested(double now, std::chrono::milliseconds rtt);
+
+    float sendRate;
+    /// True until the rate is first decreased.
+    bool isSlowStart;
+    uint32_t bytesInFlight;
+    /// Until when (in NetworkConnection time) the rate is not decreased again.
+    double recoveryEnd;
+};
+
+/// A smoothed round-trip-time and its variance, as in RFC 6298.
+/**
+    The first sample sets the smoothed round-trip-time, and half of it the
+    variance. Later samples move the smoothed time by 1/8 and the variance by
+    1/4 of their difference. The retransmission timeout is the smoothed time
+    plus four times the variance, clamped to
+    GDT_INTERNAL_NETWORK_MIN_RETRANSMIT_TIMEOUT_MILLISECONDS and
+    GDT_INTERNAL_NETWORK_MAX_RETRANSMIT_TIMEOUT_MILLISECONDS, or
+    GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS before any sample.
+*/
+struct RttEstimator
+{
+    RttEstimator();
+
+    /// Adds a measured round-trip-time of "milliseconds".
+    void sample(double milliseconds);
+
+    std::chrono::milliseconds smoothed() const;
+
+    /// Returns how long an unacked datagram waits before it is resent.
+    std::chrono::milliseconds retransmitTimeout() const;
+
+    /// In milliseconds.
+    double smoothedRtt;
+    /// In milliseconds.
+    double rttVariance;
+    bool hasSample;
+};
+
+/// A binary search for the largest datagram that reaches a peer unfragmented.
+/**
+    Sizes are of whole datagrams, including the 20 byte header but not the
+    IP and UDP headers. The largest possible size is probed first, then the
+    middle between the largest size acked and the smallest size lost. A size
+    is only taken as too large once GDT_INTERNAL_NETWORK_PATH_MTU_PROBE_TRIES
+    probes of it were lost, and one probe is sent at a time.
+*/
+struct PathMtu
+{
+    PathMtu();
+
+    /// Returns the size of the next probe, or 0 if none should be sent now.
+    uint32_t nextProbe() const;
+
+    /// Returns true once the search is done.
+    bool isDone() const;
+
+    void sent(uint32_t size);
+    void acked(uint32_t size);
+    void lost(uint32_t size);
+
+    /// Returns the largest datagram to send, "configured" until it is known.
+    uint32_t datagramSize(uint32_t configured) const;
+
+    /// The largest size known to get through.
+    uint32_t low;
+    /// The smallest size known not to.
+    uint32_t high;
+    /// The size of the probe in flight, or 0.
+    uint32_t probeSize;
+    unsigned int tries;
+    /// Whether a probe of size "low" was acked.
+    bool isValidated;
+};
+
+/// A token bucket spreading the datagrams of all connections over time.
+/**
+    Tokens are added at the sum of the send rates of all connections (plus
+    GDT_INTERNAL_NETWORK_PACING_HEADROOM), and every datagram with queued
+    packets takes one. Since at most one update's worth of tokens is kept,
+    connections that become due at the same time are spread over the
+    following ticks instead of being sent back to back.
+*/
+struct Pacer
+{
+    Pacer();
+
+    /// Adds the tokens of "deltaTime" seconds.
+    void refill(double deltaTime);
+
+    /// Takes a token, returns false if there is none.
+    bool take();
+
+    /// Returns the seconds between datagrams at the paced rate.
+    double gap() const;
+
+    /// The sum of the send rates of all connections.
+    double rate;
+    double tokens;
+};
+
+/// A message received in fragments, put together as they arrive.
+struct Reassembly
+{
+    Reassembly();
+
+    /// The sequence of fragment 0, which identifies the message.
+    uint16_t firstSequence;
+    uint16_t count;
+    uint16_t remaining;
+    /// Inactive reassemblies keep their buffer for the next message.
+    bool isActive;
+    std::vector<char> data;
+};
+
+/// The reliable messages of one channel of a connection, in both directions.
+/**
+    Sent messages are kept in a ring indexed by their 16 bit sequence until
+    they are acked, and at most GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE
+    messages may be unacked at once; further messages wait until the oldest
+    are acked. Received messages are tracked in a window of the same size
+    starting at the oldest sequence not yet received, so duplicates are
+    dropped, and ordered channels buffer messages received ahead of a
+    missing one until it arrives.
+
+    Messages larger than a datagram are sent as fragments with consecutive
+    sequences, each starting with its index, the fragment count and the size
+    of the whole message. All fragments but the last have the same size, so
+    each is copied straight to its place in the reassembled message.
+*/
+struct MessageChannel
+{
+    enum Receipt
+    {
+        /// Already received or outside of the window.
+        DROPPED,
+        /// To be delivered now.
+        DELIVERED,
+        /// Stored until the messages before it are delivered.
+        BUFFERED
+    };
+
+    static_assert((GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE
+            & (GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE - 1)) == 0
+        && GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE <= 0x8000,
+        "GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE must be a power of two up to 0x8000");
+
+    MessageChannel();
+
+    /// Identifies message "sequence" of channel "channel" in one integer.
+    static uint32_t keyOf(uint8_t channel, uint16_t sequence);
+
+    /// Stores "data" as the next sent message.
+    /**
+        \return false if the window is full, in which case "data" is left
+            untouched.
+    */
+    bool push(std::vector<char>& data, bool isFragment, uint16_t& sequence);
+
+    /// Returns true if sent message "sequence" is waiting to be acked.
+    bool isUnacked(uint16_t sequence) const;
+
+    /// Releases sent message "sequence", returns false if it was not unacked.
+    bool ack(uint16_t sequence);
+
+    /// Returns the ring slot of sent or received message "sequence".
+    static uint32_t slotOf(uint16_t sequence);
+
+    /// Checks received message "sequence", storing it if it is BUFFERED.
+    Receipt receive(uint16_t sequence, const char* data, uint32_t size, bool isOrdered, bool isFragment);
+
+    /// Returns the sequence the next message pushed or waiting will have.
+    uint16_t queuedEnd() const;
+
+    /// Takes the id of the oldest tracked message if it and every message
+    /// before it were acked.
+    bool popTracked(uint32_t& trackingId);
+
+    /// Moves the next buffered message into "data" if it is due.
+    bool popReceived(std::vector<char>& data, bool& isFragment, uint16_t& sequence);
+
+    /// Adds received fragment "sequence" to the message it is part of.
+    /**
+        \return true if the message is complete, in which case it is swapped
+            into "message". Malformed fragments are ignored.
+    */
+    bool reassemble(uint16_t sequence, const char* data, uint32_t size, std::vector<char>& message);
+
+    uint16_t nextSequence;
+    uint16_t oldestUnacked;
+    std::array<std::vector<char>, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> sent;
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> isSentUnacked;
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> isSentFragment;
+    /// Whether a sent message is in the send queue of its connection.
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> isQueued;
+    /// Whether a sent message has been sent at least once.
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> wasSent;
+    /// Messages that did not fit in the window yet, and whether they are
+    /// fragments.
+    std::list<std::pair<std::vector<char>, bool> > waiting;
+    /// The sequence after the last fragment of each tracked message, and its
+    /// tracking id, oldest first.
+    std::deque<std::pair<uint16_t, uint32_t> > tracked;
+
+    uint16_t nextReceived;
+    std::array<std::vector<char>, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> received;
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> isReceived;
+    std::array<bool, GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE> isReceivedFragment;
+    std::vector<Reassembly> reassemblies;
+};
+
+/// Counts of the datagrams exchanged with one peer, and its queues.
+struct ConnectionStats
+{
+    ConnectionStats();
+
+    /// Adds the counts and queue depths of "other", i.e. to sum peers.
+    void add(const ConnectionStats& other);
+
+    uint64_t sentDatagrams;
+    uint64_t sentBytes;
+    /// Valid datagrams received from the peer, including duplicates.
+    uint64_t receivedDatagrams;
+    uint64_t receivedBytes;
+    /// Sent datagrams carrying packets or messages that were found lost.
+    uint64_t lostDatagrams;
+    /// Checked packets queued to be sent again because they were lost.
+    uint64_t resentPackets;
+    /// Reliable messages queued to be sent again because they were lost.
+    uint64_t resentMessages;
+    /// Received datagrams that were received before, which are ignored.
+    uint64_t duplicateDatagrams;
+    /// Received datagrams older than one received before them.
+    uint64_t outOfOrderDatagrams;
+    /// The packets and messages waiting to be sent, and the sent bytes not
+    /// yet acked or found lost, when the stats were taken.
+    uint64_t queuedPackets;
+    uint64_t queuedMessages;
+    uint64_t bytesInFlight;
+};
+
+/// Stats of a NetworkConnection summed over all of its peers.
+struct NetworkStats
+{
+    NetworkStats();
+
+    /// Adds "other", keeping the larger of the maximums, i.e. to sum
+    /// NetworkConnections.
+    void add(const NetworkStats& other);
+
+    /// The sums of the stats of every peer, including disconnected peers.
+    ConnectionStats total;
+    uint64_t connections;
+    uint64_t connects;
+    uint64_t disconnects;
+    /// The most packets and messages queued for one peer.
+    uint64_t maxQueued;
+    /// The bytes sent and received per second over the last whole second.
+    double sentBytesPerSecond;
+    double receivedBytesPerSecond;
+    /// The updates done (by the network thread if threaded) and the time
+    /// spent in them.
+    uint64_t updates;
+    uint64_t updateMicroseconds;
+    uint64_t maxUpdateMicroseconds;
 };
 
 struct ConnectionData
 {
     ConnectionData();
-    ConnectionData(uint32_t id, uint32_t lSequence, uint16_t port);
+    ConnectionData(uint32_t id, uint32_t lSequence, uint32_t address, uint16_t port);
 
     std::chrono::steady_clock::time_point timeSinceLastReceived;
     std::chrono::steady_clock::time_point timeSinceLastSent;
@@ -78,42 +623,310 @@ struct ConnectionData
     uint32_t lSequence;
     uint32_t rSequence;
     uint32_t ackBitfield;
-    std::list<PacketInfo> sentPackets;
+    SentPacketRing sentPackets;
     std::list<PacketInfo> sendPacketQueue;
+    /// The smoothed round-trip-time of rttEstimator.
     std::chrono::milliseconds rtt;
+    RttEstimator rttEstimator;
+    PathMtu pathMtu;
     bool triggerSend;
-    float timer;
-    bool isGood;
-    bool isGoodRtt;
-    float toggleTime;
-    float toggleTimer;
-    float toggledTimer;
+    /// When the current send interval started (in NetworkConnection time).
+    double timerStart;
+    RateController rate;
+    /// The reliable channels, indexed by channel - 1.
+    std::array<MessageChannel, GDT_INTERNAL_NETWORK_RELIABLE_CHANNEL_COUNT> channels;
+    /// Keys of reliable messages to send (again), in order.
+    std::deque<uint32_t> messageQueue;
+    /// Alternates datagrams of messages and of queued packets.
+    bool preferMessages;
+    uint32_t address;
     uint16_t port;
+    bool isConnected;
+    uint32_t generation;
+    /// Counted since the connection was made; the queue depths are filled
+    /// in when the stats are taken.
+    ConnectionStats stats;
 
     bool operator== (const ConnectionData& other) const;
 };
 
+/// Fixed buffers that datagrams are received into, reused every update.
+struct DatagramBuffers
+{
+    DatagramBuffers();
+
+    /// Allocates "count" buffers of "size" bytes each. Only allocates once.
+    void allocate(unsigned int count, unsigned int size);
+
+    char* at(unsigned int index);
+
+    unsigned int count;
+    unsigned int size;
+    std::vector<char> data;
+    // the size and sender of each received datagram
+    std::vector<uint32_t> sizes;
+    std::vector<sockaddr_in> addresses;
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    std::vector<iovec> iovecs;
+    std::vector<mmsghdr> headers;
+#endif
+};
+
+/// Datagrams staged during an update to be sent together.
+/**
+    All staged datagrams are stored back to back in one arena that keeps its
+    capacity between updates. A datagram may also reference a payload stored
+    elsewhere, which is sent after its staged bytes without being copied.
+*/
+struct SendBatch
+{
+    enum Kind
+    {
+        CONNECT,
+        HEARTBEAT,
+        NOT_CHECKED,
+        CHECKED,
+        PROBE
+    };
+
+    struct Entry
+    {
+        std::size_t offset;
+        std::size_t size;
+        const char* payload;
+        std::size_t payloadSize;
+        uint32_t address;
+        uint16_t port;
+        uint32_t sequenceID;
+        Kind kind;
+        bool isCoalesced;
+        long int sentBytes;
+    };
+
+    /// Reserves "size" bytes for a datagram and returns where to write it.
+    /**
+        The returned pointer is only valid until the next call to stage. The
+        caller sets the sequence id of entries.back() once the header has
+        been written.
+    */
+    char* stage(std::size_t size, uint32_t address, uint16_t port, Kind kind, bool isCoalesced = false);
+
+    /// Appends "size" bytes at "payload" to the last staged datagram.
+    /**
+        The payload is not copied and must stay valid until clear().
+    */
+    void attach(const char* payload, std::size_t size);
+
+    /// Appends "payload" to the last staged datagram, keeping it until clear().
+    void hold(std::vector<char>&& payload);
+
+    /// Fills in the destinations (and headers for sendmmsg) of all entries.
+    void prepare();
+
+    void clear();
+
+    char* at(unsigned int index);
+
+    /// The size of entry "index" including its attached payload.
+    std::size_t sizeOf(unsigned int index) const;
+
+    std::vector<char> arena;
+    std::vector<Entry> entries;
+    std::vector<std::vector<char> > heldPayloads;
+    std::vector<sockaddr_in> addresses;
+#if PLATFORM == PLATFORM_WINDOWS
+    std::vector<char> contiguous;
+#else
+    std::vector<iovec> iovecs;
+#endif
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    std::vector<mmsghdr> headers;
+#endif
+};
+
+/// Settings of the simulated network a NetworkConnection sends through.
+struct Impairment
+{
+    Impairment();
+
+    /// The chance of each datagram to be dropped, from 0 to 1.
+    float loss;
+    /// The delay of every datagram in milliseconds.
+    float latency;
+    /// Up to this many milliseconds are added to the delay of each datagram
+    /// at random, so datagrams may arrive out of order.
+    float jitter;
+    /// The chance of a datagram to be held back by reorderDelay more, from 0
+    /// to 1, so that later datagrams overtake it.
+    float reorder;
+    float reorderDelay;
+    /// The chance of a datagram to be sent twice, from 0 to 1.
+    float duplicate;
+    /// The bytes per second the link sends, or 0 for no limit. Datagrams
+    /// queue behind each other, and are dropped if more than queueLimit
+    /// bytes are queued (0 for no limit).
+    uint32_t bandwidth;
+    uint32_t queueLimit;
+    /// Seeds the random choices, so that the same datagrams sent at the same
+    /// times are impaired the same way.
+    uint32_t seed;
+};
+
+/// Holds back outgoing datagrams to simulate a bad network.
+/**
+    Times are in seconds of the elapsed time of the NetworkConnection, which
+    is advanced by the deltaTime of each update.
+*/
+struct ImpairmentSimulator
+{
+    struct Datagram
+    {
+        double due;
+        uint64_t order;
+        std::vector<char> data;
+        uint32_t address;
+        uint16_t port;
+    };
+
+    ImpairmentSimulator();
+
+    /// Replaces the settings, dropping all held datagrams.
+    void configure(const Impairment& impairment);
+
+    /// Returns false if datagrams pass through unchanged.
+    bool isActive() const;
+
+    /// Drops, delays or duplicates a datagram sent at "now".
+    void send(const char* data, std::size_t size, const char* payload, std::size_t payloadSize, uint32_t address, uint16_t port, double now);
+
+    /// Moves the earliest held datagram due at "now" into "datagram".
+    bool pop(double now, Datagram& datagram);
+
+    /// Returns when the earliest held datagram is due, or a negative value if
+    /// none are held.
+    double nextDue() const;
+
+    /// Drops all held datagrams.
+    void clear();
+
+    Impairment settings;
+    bool isEnabled;
+    std::mt19937 random;
+    /// A min heap of held datagrams by due time, then order sent.
+    std::vector<Datagram> held;
+    uint64_t nextOrder;
+    /// When the simulated link has sent all queued datagrams.
+    double linkFree;
+
+private:
+    /// Returns a random number in [0, 1), the same on every platform.
+    double chance();
+
+    void hold(const char* data, std::size_t size, const char* payload, std::size_t payloadSize, uint32_t address, uint16_t port, double due);
+};
+
+/// A packet passed from the game thread to the network thread to be queued.
+struct QueuedSend
+{
+    QueuedSend();
+
+    std::vector<char> data;
+    uint32_t address;
+    /// If valid, used instead of address.
+    ConnectionHandle connection;
+    bool isReceivedChecked;
+    /// If true, data is a message of channel "channel" instead of a packet.
+    bool isMessage;
+    uint8_t channel;
+    bool isTracked;
+    uint32_t trackingId;
+};
+
+/// A callback passed from the network thread to be called on the game thread.
+struct ConnectionEvent
+{
+    enum Type
+    {
+        RECEIVED,
+        CONNECTED,
+        DISCONNECTED,
+        ACKED
+    };
+
+    ConnectionEvent();
+
+    Type type;
+    std::vector<char> data;
+    uint32_t address;
+    ConnectionHandle connection;
+    bool outOfOrder;
+    bool isResent;
+    bool isReceivedChecked;
+    uint32_t trackingId;
+};
+
+/// Counts of datagrams and the socket system calls used to move them.
+struct SocketCounters
+{
+    SocketCounters();
+
+    uint64_t sendCalls;
+    uint64_t sentDatagrams;
+    uint64_t receiveCalls;
+    uint64_t receivedDatagrams;
+    /// Sends that were delayed to a later tick by pacing.
+    uint64_t pacedSends;
+    /// The number and sum of the gaps between datagrams handed to the socket.
+    uint64_t sendGaps;
+    uint64_t sendGapMicroseconds;
+    /// Gaps shorter than half the paced gap, i.e. datagrams sent in a burst.
+    uint64_t shortSendGaps;
+};
+
 enum SpecialIDs
 {
     NONE =          0,
     CONNECT =       0x80000000,
     PING =          0x40000000,
     NO_REC_CHK =    0x20000000,
-    RESENDING =     0x10000000
+    RESENDING =     0x10000000,
+    COALESCED =     0x08000000,
+    CHANNELED =     0x04000000
 };
 
+/// Returns the names of the columns of NetworkStats written by statsToCsv.
+std::string statsCsvHeader();
+/// Returns "stats" as a line of comma separated values, prefixed by "time".
+std::string statsToCsv(const NetworkStats& stats, double time);
+/// Returns "stats" as a JSON object on one line, with "time".
+std::string statsToJson(const NetworkStats& stats, double time);
+
 bool MoreRecent(uint32_t current, uint32_t previous);
 //bool IsSpecialID(uint32_t ID);
 
 bool InitializeSockets();
 void CleanupSockets();
 
+bool lastErrorIsWouldBlock();
+
 std::string addressToString(const uint32_t& address);
 
 uint32_t getLocalIP();
 
 uint32_t getBroadcastAddress();
 
+/// Gets the broadcast address from a cache refreshed in the background.
+/**
+    getBroadcastAddress resolves the host name and lists the interfaces,
+    which may block for seconds. This instead returns the result of the last
+    lookup, and starts a new lookup on another thread if there was none yet
+    or it is older than GDT_INTERNAL_NETWORK_BROADCAST_ADDRESS_REFRESH_SECONDS.
+
+    \return false while the first lookup is running, else true with
+        "address" set to what getBroadcastAddress returned.
+*/
+bool getCachedBroadcastAddress(uint32_t& address);
+
 } // namespace Network
 } // namespace Internal
 } // namespace GDT
@@ -0,0 +1,60 @@
+#ifndef GDT_INTERNAL_SPSC_QUEUE_HPP
+#define GDT_INTERNAL_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+namespace GDT
+{
+    namespace Internal
+    {
+        /*!
+         * \brief A bounded lock-free queue for one producer and one consumer
+         * thread.
+         *
+         * push may only be called from the producer thread and pop from the
+         * consumer thread. Values are moved in and out of a fixed ring of
+         * slots allocated on construction.
+         */
+        template <typename T>
+        class SPSCQueue
+        {
+        public:
+            /// The capacity is rounded up to a power of two.
+            explicit SPSCQueue(std::size_t capacity = 1024);
+
+            SPSCQueue(const SPSCQueue& other) = delete;
+            SPSCQueue& operator = (const SPSCQueue& other) = delete;
+
+            /// Moves value into the queue, returns false if it is full.
+            bool push(T&& value);
+
+            /// Moves the oldest value into value, returns false if empty.
+            bool pop(T& value);
+
+            bool empty() const;
+
+            std::size_t capacity() const;
+
+        private:
+            std::vector<T> slots;
+            std::size_t mask;
+            // head and tail are kept on separate cache lines, padding is
+            // used instead of alignas so that the queue (and its owner) can
+            // be allocated with new before C++17
+            char headPadding[64];
+            // read and written by the consumer
+            std::atomic<std::size_t> head;
+            char tailPadding[64 - sizeof(std::atomic<std::size_t>)];
+            // read and written by the producer
+            std::atomic<std::size_t> tail;
+            char endPadding[64 - sizeof(std::atomic<std::size_t>)];
+        };
+    }
+}
+
+#include "SPSCQueue.inl"
+
+#endif
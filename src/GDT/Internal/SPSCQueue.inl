@@ -0,0 +1,53 @@
+template <typename T>
+GDT::Internal::SPSCQueue<T>::SPSCQueue(std::size_t capacity) :
+head(0),
+tail(0)
+{
+    std::size_t size = 2;
+    while(size < capacity)
+    {
+        size *= 2;
+    }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool GDT::Internal::SPSCQueue<T>::push(T&& value)
+{
+    std::size_t currentTail = tail.load(std::memory_order_relaxed);
+    if(currentTail - head.load(std::memory_order_acquire) == slots.size())
+    {
+        return false;
+    }
+
+    slots[currentTail & mask] = std::move(value);
+    tail.store(currentTail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool GDT::Internal::SPSCQueue<T>::pop(T& value)
+{
+    std::size_t currentHead = head.load(std::memory_order_relaxed);
+    if(currentHead == tail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    value = std::move(slots[currentHead & mask]);
+    head.store(currentHead + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool GDT::Internal::SPSCQueue<T>::empty() const
+{
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+template <typename T>
+std::size_t GDT::Internal::SPSCQueue<T>::capacity() const
+{
+    return slots.size();
+}
@@ -0,0 +1,239 @@
+#include "LoopbackTransport.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+GDT::LoopbackNetwork::Datagram::Datagram() :
+port(0)
+{}
+
+GDT::LoopbackNetwork::Endpoint::Endpoint() :
+queue(GDT_INTERNAL_NETWORK_LOOPBACK_QUEUE_SIZE),
+isOpen(false),
+isWaiting(false)
+{}
+
+GDT::LoopbackNetwork::LoopbackNetwork() :
+endpoints(65536),
+nextEphemeralPort(GDT_INTERNAL_NETWORK_LOOPBACK_FIRST_EPHEMERAL_PORT),
+droppedDatagrams(0)
+{
+    for(auto iter = endpoints.begin(); iter != endpoints.end(); ++iter)
+    {
+        iter->store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+GDT::LoopbackNetwork::~LoopbackNetwork()
+{
+    for(auto iter = endpoints.begin(); iter != endpoints.end(); ++iter)
+    {
+        delete iter->load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t GDT::LoopbackNetwork::getDroppedDatagrams() const
+{
+    return droppedDatagrams.load(std::memory_order_relaxed);
+}
+
+GDT::LoopbackNetwork::Endpoint* GDT::LoopbackNetwork::bind(unsigned short port, unsigned short& boundPort)
+{
+    std::lock_guard<std::mutex> lock(bindMutex);
+
+    auto isFree = [this] (uint32_t port) {
+        Endpoint* endpoint = endpoints[port].load(std::memory_order_relaxed);
+        return endpoint == nullptr || !endpoint->isOpen.load(std::memory_order_relaxed);
+    };
+
+    if(port == 0)
+    {
+        // like the operating system, hand out the ephemeral ports in turn
+        const uint32_t ephemeralCount = 65536 - GDT_INTERNAL_NETWORK_LOOPBACK_FIRST_EPHEMERAL_PORT;
+        for(uint32_t i = 0; i < ephemeralCount && port == 0; ++i)
+        {
+            uint32_t candidate = nextEphemeralPort;
+            nextEphemeralPort = candidate == 65535 ? GDT_INTERNAL_NETWORK_LOOPBACK_FIRST_EPHEMERAL_PORT : candidate + 1;
+            if(isFree(candidate))
+            {
+                port = candidate;
+            }
+        }
+    }
+    if(port == 0 || !isFree(port))
+    {
+        return nullptr;
+    }
+
+    Endpoint* endpoint = endpoints[port].load(std::memory_order_relaxed);
+    if(endpoint == nullptr)
+    {
+        endpoint = new Endpoint();
+        endpoints[port].store(endpoint, std::memory_order_release);
+    }
+
+    // drop what was sent to the port before it was bound again
+    Datagram discarded;
+    while(endpoint->queue.pop(discarded));
+
+    endpoint->isOpen.store(true, std::memory_order_release);
+    boundPort = port;
+    return endpoint;
+}
+
+void GDT::LoopbackNetwork::unbind(Endpoint* endpoint)
+{
+    std::lock_guard<std::mutex> lock(bindMutex);
+    endpoint->isOpen.store(false, std::memory_order_release);
+}
+
+void GDT::LoopbackNetwork::deliver(Datagram& datagram, unsigned short port)
+{
+    Endpoint* endpoint = endpoints[port].load(std::memory_order_acquire);
+    if(endpoint == nullptr
+        || !endpoint->isOpen.load(std::memory_order_acquire)
+        || !endpoint->queue.push(datagram))
+    {
+        droppedDatagrams.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // pairs with the fence in LoopbackTransport::wait, so that either the
+    // waiting transport sees the datagram or this sees it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(endpoint->isWaiting.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(endpoint->waitMutex);
+        endpoint->received.notify_one();
+    }
+}
+
+GDT::LoopbackTransport::LoopbackTransport(std::shared_ptr<LoopbackNetwork> network) :
+network(network),
+endpoint(nullptr),
+port(0),
+dontFragment(false)
+{}
+
+GDT::LoopbackTransport::~LoopbackTransport()
+{
+    close();
+}
+
+bool GDT::LoopbackTransport::open(unsigned short port, const Options& options)
+{
+    close();
+
+    if(options.reusePort)
+    {
+        std::clog << "Warning: LoopbackTransport does not share ports!" << std::endl;
+    }
+
+    endpoint = network->bind(port, this->port);
+    if(endpoint == nullptr)
+    {
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to bind loopback port!" << std::endl;
+#endif
+        return false;
+    }
+    dontFragment = options.dontFragment;
+    return true;
+}
+
+void GDT::LoopbackTransport::close()
+{
+    if(endpoint == nullptr)
+    {
+        return;
+    }
+
+    network->unbind(endpoint);
+    endpoint = nullptr;
+    port = 0;
+    dontFragment = false;
+}
+
+void GDT::LoopbackTransport::send(SendBatch& batch, SocketCounters& counters)
+{
+    for(unsigned int i = 0; i < batch.entries.size(); ++i)
+    {
+        SendBatch::Entry& entry = batch.entries[i];
+        const char* data = batch.at(i);
+        outgoing.data.assign(data, data + entry.size);
+        outgoing.data.insert(outgoing.data.end(), entry.payload, entry.payload + entry.payloadSize);
+        outgoing.port = port;
+        network->deliver(outgoing, entry.port);
+        entry.sentBytes = entry.size + entry.payloadSize;
+    }
+    ++counters.sendCalls;
+    counters.sentDatagrams += batch.entries.size();
+}
+
+long int GDT::LoopbackTransport::send(const char* data, std::size_t size, uint32_t, uint16_t port, SocketCounters& counters)
+{
+    outgoing.data.assign(data, data + size);
+    outgoing.port = this->port;
+    network->deliver(outgoing, port);
+    ++counters.sendCalls;
+    ++counters.sentDatagrams;
+    return size;
+}
+
+int GDT::LoopbackTransport::receive(DatagramBuffers& buffers, unsigned int count, SocketCounters& counters)
+{
+    ++counters.receiveCalls;
+    unsigned int received = 0;
+    while(received < count && endpoint->queue.pop(incoming))
+    {
+        // like a socket, truncates datagrams larger than the buffer
+        uint32_t size = std::min<std::size_t>(incoming.data.size(), buffers.size);
+        std::memcpy(buffers.at(received), incoming.data.data(), size);
+        buffers.sizes[received] = size;
+        sockaddr_in& sender = buffers.addresses[received];
+        sender = sockaddr_in();
+        sender.sin_family = AF_INET;
+        sender.sin_addr.s_addr = htonl(0x7F000001);
+        sender.sin_port = htons(incoming.port);
+        ++received;
+    }
+    counters.receivedDatagrams += received;
+    return received;
+}
+
+void GDT::LoopbackTransport::wait(float maxWait)
+{
+    if(maxWait == 0.0f)
+    {
+        return;
+    }
+
+    LoopbackNetwork::Endpoint* endpoint = this->endpoint;
+    std::unique_lock<std::mutex> lock(endpoint->waitMutex);
+    endpoint->isWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto isReceived = [endpoint] () {
+        return !endpoint->queue.empty();
+    };
+    if(maxWait < 0.0f)
+    {
+        endpoint->received.wait(lock, isReceived);
+    }
+    else
+    {
+        endpoint->received.wait_for(lock, std::chrono::duration<float>(maxWait), isReceived);
+    }
+    endpoint->isWaiting.store(false, std::memory_order_relaxed);
+}
+
+bool GDT::LoopbackTransport::isDontFragmentSet() const
+{
+    return dontFragment;
+}
+
+unsigned short GDT::LoopbackTransport::getPort() const
+{
+    return port;
+}
@@ -0,0 +1,135 @@
+#ifndef GDT_LOOPBACK_TRANSPORT_HPP
+#define GDT_LOOPBACK_TRANSPORT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Transport.hpp"
+#include "Internal/MPSCQueue.hpp"
+
+namespace GDT
+{
+
+/// The ports that LoopbackTransports pass datagrams between.
+/**
+    Every LoopbackTransport of a network binds a port of its own, and a
+    datagram sent to a port is queued in memory for the transport bound to
+    it, whatever the address it was sent to. Transports are seen by their
+    peers at 127.0.0.1, so clients connect to a server with
+    NetworkConnection::connectToServer(127, 0, 0, 1).
+
+    Ports are separate from those of the operating system, so tests in one
+    process never collide with sockets of other processes. Datagrams sent to
+    a port no transport is bound to, or to a transport that holds 1024
+    unreceived datagrams, are dropped.
+*/
+class LoopbackNetwork
+{
+public:
+    LoopbackNetwork();
+    ~LoopbackNetwork();
+
+    LoopbackNetwork(const LoopbackNetwork& other) = delete;
+    LoopbackNetwork& operator=(const LoopbackNetwork& other) = delete;
+
+    /// The number of datagrams dropped because no transport was bound to
+    /// their port or its queue was full.
+    uint64_t getDroppedDatagrams() const;
+
+private:
+    friend class LoopbackTransport;
+
+    struct Datagram
+    {
+        Datagram();
+
+        std::vector<char> data;
+        uint16_t port;
+    };
+
+    /// The queue of a port, kept until the network is destroyed so that
+    /// senders never see it deleted.
+    struct Endpoint
+    {
+        Endpoint();
+
+        Internal::MPSCQueue<Datagram> queue;
+        std::atomic<bool> isOpen;
+        // set while the bound transport waits for a datagram
+        std::atomic<bool> isWaiting;
+        std::mutex waitMutex;
+        std::condition_variable received;
+    };
+
+    // indexed by port, created on the first bind to the port
+    std::vector<std::atomic<Endpoint*> > endpoints;
+    std::mutex bindMutex;
+    uint32_t nextEphemeralPort;
+    std::atomic<uint64_t> droppedDatagrams;
+
+    /// Opens the endpoint of "port", or of a free ephemeral port if 0.
+    /**
+        \return nullptr if the port is taken.
+    */
+    Endpoint* bind(unsigned short port, unsigned short& boundPort);
+    void unbind(Endpoint* endpoint);
+
+    /// Queues "datagram" for the transport bound to "port", swapping in an
+    /// earlier buffer for the next send.
+    void deliver(Datagram& datagram, unsigned short port);
+
+};
+
+/// Sends datagrams to the other transports of a LoopbackNetwork in memory.
+/**
+    Sending and receiving never make system calls: each bound port has a
+    lock-free queue that any thread may send to, and received buffers are
+    handed back to senders so their capacity is reused. Many
+    NetworkConnections, i.e. a server and hundreds of clients, can thereby be
+    simulated in one process and updated from any threads.
+
+    Options::reusePort is not supported. Datagrams are never fragmented, so
+    path MTU probes up to 1500 bytes always arrive.
+*/
+class LoopbackTransport : public Transport
+{
+public:
+    explicit LoopbackTransport(std::shared_ptr<LoopbackNetwork> network);
+    ~LoopbackTransport();
+
+    LoopbackTransport(const LoopbackTransport& other) = delete;
+    LoopbackTransport& operator=(const LoopbackTransport& other) = delete;
+
+    bool open(unsigned short port, const Options& options) override;
+    void close() override;
+
+    void send(SendBatch& batch, SocketCounters& counters) override;
+    long int send(const char* data, std::size_t size, uint32_t address, uint16_t port, SocketCounters& counters) override;
+
+    int receive(DatagramBuffers& buffers, unsigned int count, SocketCounters& counters) override;
+
+    void wait(float maxWait) override;
+
+    bool isDontFragmentSet() const override;
+
+    /// Gets the port the transport is bound to, or 0 if it is closed.
+    unsigned short getPort() const;
+
+private:
+    std::shared_ptr<LoopbackNetwork> network;
+    LoopbackNetwork::Endpoint* endpoint;
+    unsigned short port;
+    bool dontFragment;
+    // swapped through the queues of the network
+    LoopbackNetwork::Datagram outgoing;
+    LoopbackNetwork::Datagram incoming;
+
+};
+
+} // namespace GDT
+
+#endif
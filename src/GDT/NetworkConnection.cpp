@@ -1,14 +1,28 @@
 
 #include "NetworkConnection.hpp"
+#include "UdpTransport.hpp"
 
 #include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
 #include <unistd.h>
 
 GDT::NetworkConnection::NetworkConnection(Mode mode, unsigned short serverPort, unsigned short clientPort, bool clientBroadcast) :
 acceptNewConnections(true),
 ignoreOutOfSequence(false),
 resendTimedOutPackets(true),
+maxReceivedPerUpdate(GDT_INTERNAL_NETWORK_RECEIVE_BUDGET),
+coalescePackets(false),
+maxDatagramSize(GDT_INTERNAL_NETWORK_DEFAULT_MAX_DATAGRAM_SIZE),
+maxSendRate(GDT_INTERNAL_NETWORK_DEFAULT_MAX_SEND_RATE),
+pacePackets(false),
 mode(mode),
+appliedPacingRate(~0U),
+rateWindowSentBytes(0),
+rateWindowReceivedBytes(0),
+statsFormat(STATS_CSV),
+clientSentAddress(0),
 clientSentAddressSet(false),
 initialized(false),
 validState(false),
@@ -16,7 +30,15 @@ invalidNoticeTimer(INVALID_NOTICE_TIME),
 serverPort(serverPort),
 clientPort(clientPort),
 clientRetryTimer(GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS),
-clientBroadcast(clientBroadcast)
+elapsedTime(0.0),
+clientBroadcast(clientBroadcast),
+reusePort(false),
+discoverPathMtu(false),
+isProbingPathMtu(false),
+threaded(false),
+threadRunning(false),
+sendQueue(GDT_INTERNAL_NETWORK_THREAD_QUEUE_SIZE),
+eventQueue(GDT_INTERNAL_NETWORK_THREAD_QUEUE_SIZE)
 {
     if(GDT::Internal::Network::connectionInstanceCount++ == 0)
     {
@@ -31,15 +53,16 @@ clientBroadcast(clientBroadcast)
 
 GDT::NetworkConnection::~NetworkConnection()
 {
-    if(validState)
+    if(threaded)
     {
-#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
-        close(socketHandle);
-#else
-        closesocket(socketHandle);
-#endif
+        // callbacks are not called while destructing
+        threadRunning = false;
+        networkThread.join();
+        threaded = false;
     }
 
+    closeSocket();
+
     if(--GDT::Internal::Network::connectionInstanceCount == 0)
     {
         GDT::Internal::Network::CleanupSockets();
@@ -47,6 +70,115 @@ GDT::NetworkConnection::~NetworkConnection()
 }
 
 void GDT::NetworkConnection::update(float deltaTime)
+{
+    if(threaded)
+    {
+        // retry packets that did not fit in the queue
+        while(!sendOverflow.empty() && sendQueue.push(std::move(sendOverflow.front())))
+        {
+            sendOverflow.pop_front();
+        }
+        deliverEvents();
+        writeStatsLine();
+        return;
+    }
+
+    updateConnection(deltaTime);
+    writeStatsLine();
+}
+
+float GDT::NetworkConnection::waitAndUpdate(float maxWait)
+{
+    if(threaded)
+    {
+        update(0.0f);
+        return 0.0f;
+    }
+
+    if(!initialized)
+    {
+        initialize();
+        initialized = true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if(lastWaitUpdate == std::chrono::steady_clock::time_point())
+    {
+        lastWaitUpdate = now;
+    }
+
+    float wait = nextDeadline();
+    if(maxWait >= 0.0f && (wait < 0.0f || wait > maxWait))
+    {
+        wait = maxWait;
+    }
+    waitForActivity(wait);
+
+    now = std::chrono::steady_clock::now();
+    float deltaTime = std::chrono::duration<float>(now - lastWaitUpdate).count();
+    lastWaitUpdate = now;
+    updateConnection(deltaTime);
+    writeStatsLine();
+    return deltaTime;
+}
+
+bool GDT::NetworkConnection::startThread(float interval)
+{
+    if(threaded)
+    {
+        return false;
+    }
+
+    // open the socket now so that it receives from the moment this returns
+    if(!initialized)
+    {
+        initialize();
+        initialized = true;
+    }
+
+    threaded = true;
+    threadRunning = true;
+    networkThread = std::thread(&NetworkConnection::threadLoop, this, interval);
+    return true;
+}
+
+void GDT::NetworkConnection::stopThread()
+{
+    if(!threaded)
+    {
+        return;
+    }
+
+    threadRunning = false;
+    networkThread.join();
+    threaded = false;
+
+    // queue the packets the thread did not get to
+    QueuedSend queued;
+    while(sendQueue.pop(queued))
+    {
+        queuePacket(queued);
+    }
+    while(!sendOverflow.empty())
+    {
+        queuePacket(sendOverflow.front());
+        sendOverflow.pop_front();
+    }
+
+    deliverEvents();
+}
+
+bool GDT::NetworkConnection::isThreaded() const
+{
+    return threaded;
+}
+
+bool GDT::NetworkConnection::isOpen() const
+{
+    return validState;
+}
+
+void GDT::NetworkConnection::updateConnection(float deltaTime)
 {
     if(!initialized)
     {
@@ -68,599 +200,112 @@ void GDT::NetworkConnection::update(float deltaTime)
         return;
     }
 
-    for(auto iter = connectionData.begin(); iter != connectionData.end(); ++iter)
-    {
-        iter->second.toggleTimer += deltaTime;
-        iter->second.toggledTimer += deltaTime;
-
-        if(iter->second.isGood && !iter->second.isGoodRtt)
-        {
-            // good status, rtt is bad
-#ifndef NDEBUG
-            std::cout << "Switching to bad network mode for " << GDT::Internal::Network::addressToString(iter->first) << '\n';
-#endif
-            iter->second.isGood = false;
-            if(iter->second.toggledTimer <= 10.0f)
-            {
-                iter->second.toggleTime *= 2.0f;
-                if(iter->second.toggleTime > 60.0f)
-                {
-                    iter->second.toggleTime = 60.0f;
-                }
-            }
-            iter->second.toggledTimer = 0.0f;
-        }
-        else if(iter->second.isGood)
-        {
-            // good status, rtt is good
-            if(iter->second.toggleTimer >= 10.0f)
-            {
-                iter->second.toggleTimer = 0.0f;
-                iter->second.toggleTime /= 2.0f;
-                if(iter->second.toggleTime < 1.0f)
-                {
-                    iter->second.toggleTime = 1.0f;
-                }
-            }
-        }
-        else if(!iter->second.isGood && iter->second.isGoodRtt)
-        {
-            // bad status, rtt is good
-            if(iter->second.toggledTimer >= iter->second.toggleTime)
-            {
-                iter->second.toggleTimer = 0.0f;
-                iter->second.toggledTimer = 0.0f;
-#ifndef NDEBUG
-                std::cout << "Switching to good network mode for " << GDT::Internal::Network::addressToString(iter->first) << '\n';
-#endif
-                iter->second.isGood = true;
-            }
-        }
-        else
-        {
-            // bad status, rtt is bad
-            iter->second.toggledTimer = 0.0f;
-        }
+    auto updateStart = std::chrono::steady_clock::now();
+    elapsedTime += deltaTime;
+    pacer.refill(deltaTime);
 
-        iter->second.timer += deltaTime;
-        if(iter->second.timer >= (iter->second.isGood ? GDT_INTERNAL_NETWORK_GOOD_MODE_SEND_INTERVAL : GDT_INTERNAL_NETWORK_BAD_MODE_SEND_INTERVAL))
-        {
-            iter->second.timer = 0.0f;
-            iter->second.triggerSend = true;
-        }
-    }
+    // only connections with a due deadline, or with a send requested since
+    // the previous update, are visited
+    dueConnections.clear();
+    dueConnections.swap(triggeredConnections);
+    timerWheel.advance((uint64_t)(elapsedTime * GDT_INTERNAL_NETWORK_TIMER_TICKS_PER_SECOND), dueConnections);
 
-    if(mode == SERVER)
+    auto now = std::chrono::steady_clock::now();
+    for(auto iter = dueConnections.begin(); iter != dueConnections.end(); ++iter)
     {
-        // check if clients have timed out
-        std::list<uint32_t> disconnectQueue;
-        for(auto iter = connectionData.begin(); iter != connectionData.end(); ++iter)
+        ConnectionData& connection = connections[*iter];
+        if(!connection.isConnected)
         {
-            auto duration = std::chrono::steady_clock::now() - iter->second.timeSinceLastReceived;
-            if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() >= GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS)
-            {
-                disconnectQueue.push_front(iter->first);
-            }
+            continue;
         }
 
-        for(auto iter = disconnectQueue.begin(); iter != disconnectQueue.end(); ++iter)
+        // check if timed out
+        auto silence = std::chrono::duration_cast<std::chrono::milliseconds>(now - connection.timeSinceLastReceived).count();
+        if(mode == SERVER ? silence >= GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS
+            : silence > GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS)
         {
 #ifndef NDEBUG
-            std::cout << "Disconnected " << GDT::Internal::Network::addressToString(*iter) << std::endl;
+            std::cout << "Disconnected " << GDT::Internal::Network::addressToString(connection.address) << std::endl;
 #endif
-            unregisterConnection(*iter);
+            unregisterConnection(connection);
+            continue;
         }
 
-        // send packet as server to each client
-        for(auto iter = connectionData.begin(); iter != connectionData.end(); ++iter)
+        // send once for every interval passed at the connection's rate,
+        // catching up on intervals missed between updates up to a burst
+        double interval = connection.rate.sendInterval();
+        if(elapsedTime - connection.timerStart > interval * GDT_INTERNAL_NETWORK_MAX_SEND_BURST)
         {
-            if(iter->second.triggerSend)
-            {
-                iter->second.triggerSend = false;
-                if(!iter->second.sendPacketQueue.empty())
-                {
-                    auto pInfo = iter->second.sendPacketQueue.back();
-                    iter->second.sendPacketQueue.pop_back();
-
-                    std::vector<char> data;
-                    uint32_t sequenceID;
-
-                    preparePacket(data, sequenceID, iter->first, false, pInfo.isResending, pInfo.isNotReceivedChecked);
-                    // append packetInfo's data to prepared data
-                    data.insert(data.end(), pInfo.data.begin(), pInfo.data.end());
-
-                    // send data
-                    sockaddr_in destinationInfo;
-                    destinationInfo.sin_family = AF_INET;
-                    destinationInfo.sin_addr.s_addr = htonl(iter->first);
-                    destinationInfo.sin_port = htons(iter->second.port);
-                    long int sentBytes = sendto(socketHandle,
-                        (const char*) data.data(),
-                        data.size(),
-                        0,
-                        (sockaddr*) &destinationInfo,
-                        sizeof(sockaddr_in));
-
-                    if(sentBytes < 0)
-                    {
-                        std::cerr << "Failed to send packet to client!" << std::endl;
-                    }
-                    else
-                    {
-                        unsigned long int u_sentBytes = sentBytes;
-                        if(u_sentBytes != data.size())
-                        {
-                            std::cerr << "Failed to send packet to client!" << std::endl;
-                        }
-                        else
-                        {
-                            if(!pInfo.isNotReceivedChecked)
-                            {
-                                // store current packet info in sentPackets
-                                iter->second.sentPackets.push_front(PacketInfo(data, std::chrono::steady_clock::now(), iter->first, sequenceID));
-                                checkSentPacketsSize(iter->first);
-                            }
-                            else
-                            {
-                                iter->second.sentPackets.push_front(PacketInfo(std::vector<char>(), std::chrono::steady_clock::now(), iter->first, sequenceID, false, true));
-                                checkSentPacketsSize(iter->first);
-                            }
-                            iter->second.timeSinceLastSent = std::chrono::steady_clock::now();
-                        }
-                    }
-                }
-                else
-                {
-                    auto duration = std::chrono::steady_clock::now() - iter->second.timeSinceLastSent;
-                    if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() < GDT_INTERNAL_NETWORK_HEARTBEAT_SEND_INTERVAL_MILLISECONDS)
-                    {
-                        continue;
-                    }
-                    // send a heartbeat(empty) packet because the queue is empty
-
-                    std::vector<char> data;
-                    uint32_t sequenceID;
-                    preparePacket(data, sequenceID, iter->first, false, false, true);
-
-                    sockaddr_in destinationInfo;
-                    destinationInfo.sin_family = AF_INET;
-                    destinationInfo.sin_addr.s_addr = htonl(iter->first);
-                    destinationInfo.sin_port = htons(iter->second.port);
-                    long int sentBytes = sendto(socketHandle,
-                        (const char*) data.data(),
-                        data.size(),
-                        0,
-                        (sockaddr*) &destinationInfo,
-                        sizeof(sockaddr_in));
-
-                    if(sentBytes < 0)
-                    {
-                        std::cerr << "Failed to send heartbeat packet to client!" << std::endl;
-                    }
-                    else
-                    {
-                        unsigned long int u_sentBytes = sentBytes;
-                        if(u_sentBytes != data.size())
-                        {
-                            std::cerr << "Failed to send heartbeat packet to client!" << std::endl;
-                        }
-                        else
-                        {
-                            iter->second.sentPackets.push_front(PacketInfo(std::vector<char>(), std::chrono::steady_clock::now(), iter->first, sequenceID, false, true));
-                            checkSentPacketsSize(iter->first);
-                            iter->second.timeSinceLastSent = std::chrono::steady_clock::now();
-                        }
-                    }
-                }
-            }
+            connection.timerStart = elapsedTime - interval * GDT_INTERNAL_NETWORK_MAX_SEND_BURST;
         }
-
-        // receive packet
-        std::vector<char> data(GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE);
-#if PLATFORM == PLATFORM_WINDOWS
-        typedef int socklen_t;
-#endif
-        sockaddr_in receivedData;
-        socklen_t receivedDataSize = sizeof(receivedData);
-
-        int bytes = recvfrom(socketHandle,
-            data.data(),
-            GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE,
-            0,
-            (sockaddr*) &receivedData,
-            &receivedDataSize);
-
-        if(bytes >= 20)
+        bool isPaced = false;
+        while(connection.triggerSend || elapsedTime - connection.timerStart >= interval)
         {
-            uint32_t address = ntohl(receivedData.sin_addr.s_addr);
-            uint16_t port = ntohs(receivedData.sin_port);
-
-            uint32_t* tempPtr = (uint32_t*)data.data();
-            uint32_t protocolID = ntohl(*tempPtr);
-
-            // check protocol ID
-            if(protocolID != GDT_INTERNAL_NETWORK_PROTOCOL_ID)
-                return;
-
-            tempPtr = (uint32_t*)(data.data() + 4);
-            uint32_t ID = ntohl(*tempPtr);
-            tempPtr = (uint32_t*)(data.data() + 8);
-            uint32_t sequence = ntohl(*tempPtr);
-            tempPtr = (uint32_t*)(data.data() + 12);
-            uint32_t ack = ntohl(*tempPtr);
-            tempPtr = (uint32_t*)(data.data() + 16);
-            uint32_t ackBitfield = ntohl(*tempPtr);
-
-            bool isConnect = (ID & GDT::Internal::Network::CONNECT) != 0;
-            bool isPing = (ID & GDT::Internal::Network::PING) != 0;
-            bool isNotReceivedChecked = (ID & GDT::Internal::Network::NO_REC_CHK) != 0;
-            bool isResent = (ID & GDT::Internal::Network::RESENDING) != 0;
-
-            ID = ID & 0x0FFFFFFF;
-
-            if(isConnect && acceptNewConnections)
-            {
-                if(connectionData.find(address) == connectionData.end())
-                {
-#ifndef NDEBUG
-                    std::cout << "SERVER: Establishing new connection with " << GDT::Internal::Network::addressToString(address) << '\n';
-#endif
-                    // Establish connection
-                    registerConnection(address, 0, port);
-                    connectionData.at(address).triggerSend = true;
-                }
-                return;
-            }
-            else if(isPing)
+            if(pacePackets && canSendQueued(connection) && !pacer.take())
             {
-                connectionData.at(address).triggerSend = true;
+                // out of tokens, try again on the next tick
+                isPaced = true;
+                ++socketCounters.pacedSends;
+                break;
             }
-            else if(connectionData.find(address) == connectionData.end())
+
+            if(connection.triggerSend)
             {
-                // Unknown client not attemping to connect, ignoring
-                return;
+                connection.triggerSend = false;
             }
-            else if(ID != connectionData.at(address).id)
+            else
             {
-                // ID and address doesn't match, ignoring
-                return;
+                connection.timerStart += interval;
             }
 
-            // packet is valid
-#ifndef NDEBUG
-            std::cout << "Valid packet " << sequence << " received from " << GDT::Internal::Network::addressToString(address) << std::endl;;
-#endif
-
-            bool outOfOrder = false;
-
-            lookupRtt(address, ack);
-
-            connectionData.at(address).timeSinceLastReceived = std::chrono::steady_clock::now();
-            checkSentPackets(ack, ackBitfield, address);
-
-            uint32_t diff = 0;
-            if(sequence > connectionData.at(address).rSequence)
+            if(!stagePacket(connection))
             {
-                diff = sequence - connectionData.at(address).rSequence;
-                if(diff <= 0x7FFFFFFF)
-                {
-                    // sequence is more recent
-                    connectionData.at(address).rSequence = sequence;
-                    shiftBitfield(address, diff);
-                }
-                else
+                // nothing more to send, don't catch up later
+                if(elapsedTime - connection.timerStart >= interval)
                 {
-                    // sequence is older packet id, diff requires recalc
-                    diff = 0xFFFFFFFF - sequence + connectionData.at(address).rSequence + 1;
-
-                    if((connectionData.at(address).ackBitfield & (0x100000000 >> diff)) != 0x0)
-                    {
-                        // already received packet
-                        return;
-                    }
-                    connectionData.at(address).ackBitfield |= (0x100000000 >> diff);
-
-                    if(ignoreOutOfSequence)
-                        return;
-
-                    outOfOrder = true;
+                    connection.timerStart = elapsedTime;
                 }
+                break;
             }
-            else if(connectionData.at(address).rSequence > sequence)
-            {
-                diff = connectionData.at(address).rSequence - sequence;
-                if(diff > 0x7FFFFFFF)
-                {
-                    // sequence is more recent, diff requires recalc
-                    diff = 0xFFFFFFFF - connectionData.at(address).rSequence + sequence + 1;
+        }
 
-                    connectionData.at(address).rSequence = sequence;
-                    shiftBitfield(address, diff);
-                }
-                else
-                {
-                    // sequence is older packet id
-                    if((connectionData.at(address).ackBitfield & (0x100000000 >> diff)) != 0x0)
-                    {
-                        // already received packet
-                        return;
-                    }
-                    connectionData.at(address).ackBitfield |= (0x100000000 >> diff);
+        if(isProbingPathMtu)
+        {
+            stageProbe(connection);
+        }
 
-                    if(ignoreOutOfSequence)
-                        return;
+        scheduleConnection(connection, (GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS - silence) / 1000.0);
+        if(isPaced)
+        {
+            timerWheel.schedule(*iter, timerWheel.currentTick + 1);
+        }
+    }
 
-                    outOfOrder = true;
-                }
-            }
-            else
-            {
-                // duplicate packet, ignoring
-                return;
-            }
+    updatePacingRate();
 
-#ifndef NDEBUG
-            if(outOfOrder)
-            {
-                std::cout << "Out of order packet\n";
-            }
-#endif
+    if(impairment.isActive())
+    {
+        releaseImpaired();
+    }
 
-            receivedPacket(data.data() + 20, bytes - 20, address, outOfOrder, isResent, isNotReceivedChecked);
-        }
+    if(mode == SERVER)
+    {
+        flushSendBatch();
+
+        receivePackets();
+        packetsAcked();
     } // if(mode == SERVER)
     else if(mode == CLIENT)
     {
         uint32_t& serverAddress = clientSentAddress;
+        ConnectionData* server = findConnection(serverAddress, serverPort);
         // connection established
-        if(connectionData.size() > 0)
+        if(server != nullptr)
         {
-            // check if timed out
-            auto duration = std::chrono::steady_clock::now() - connectionData.at(serverAddress).timeSinceLastReceived;
-            if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() > GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS)
-            {
-#ifndef NDEBUG
-                std::cout << "Disconnected from server " << GDT::Internal::Network::addressToString(serverAddress) << '\n';
-#endif
-                unregisterConnection(serverAddress);
-                return;
-            }
-
-            // send packet as client to server
-            if(connectionData.at(serverAddress).triggerSend)
-            {
-                connectionData.at(serverAddress).triggerSend = false;
-                if(!connectionData.at(serverAddress).sendPacketQueue.empty())
-                {
-                    PacketInfo pInfo = connectionData.at(serverAddress).sendPacketQueue.back();
-                    connectionData.at(serverAddress).sendPacketQueue.pop_back();
-
-
-                    std::vector<char> data;
-                    uint32_t sequenceID;
-
-                    preparePacket(data, sequenceID, serverAddress, false, pInfo.isResending, pInfo.isNotReceivedChecked);
-
-                    data.insert(data.end(), pInfo.data.begin(), pInfo.data.end());
-
-                    // send data
-                    sockaddr_in destinationInfo;
-                    destinationInfo.sin_family = AF_INET;
-                    destinationInfo.sin_addr.s_addr = htonl(serverAddress);
-                    destinationInfo.sin_port = htons(serverPort);
-                    long int sentBytes = sendto(socketHandle,
-                        (const char*) data.data(),
-                        data.size(),
-                        0,
-                        (sockaddr*) &destinationInfo,
-                        sizeof(sockaddr_in));
+            flushSendBatch();
 
-                    if(sentBytes < 0)
-                    {
-                        std::cerr << "Failed to send packet to server!" << std::endl;
-                    }
-                    else
-                    {
-                        unsigned long int u_sentBytes = sentBytes;
-                        if(u_sentBytes != data.size())
-                        {
-                            std::cerr << "Failed to send packet to server!" << std::endl;
-                        }
-                        else
-                        {
-                            if(!pInfo.isNotReceivedChecked)
-                            {
-                                connectionData.at(serverAddress).sentPackets.push_front(PacketInfo(data, std::chrono::steady_clock::now(), serverAddress, sequenceID));
-                                checkSentPacketsSize(serverAddress);
-                            }
-                            else
-                            {
-                                connectionData.at(serverAddress).sentPackets.push_front(PacketInfo(std::vector<char>(), std::chrono::steady_clock::now(), serverAddress, sequenceID, false, true));
-                                checkSentPacketsSize(serverAddress);
-                            }
-                            connectionData.at(serverAddress).timeSinceLastSent = std::chrono::steady_clock::now();
-                        }
-                    }
-                }
-                else
-                {
-                    auto duration = std::chrono::steady_clock::now() - connectionData.at(serverAddress).timeSinceLastSent;
-                    if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() < GDT_INTERNAL_NETWORK_HEARTBEAT_SEND_INTERVAL_MILLISECONDS)
-                    {
-                        goto NETWORK_CLIENT_RECEIVE;
-                    }
-                    // send a heartbeat(empty) packet because the queue is empty
-
-                    std::vector<char> data;
-                    uint32_t sequenceID;
-                    preparePacket(data, sequenceID, serverAddress, false, false, true);
-
-                    // send data
-                    sockaddr_in destinationInfo;
-                    destinationInfo.sin_family = AF_INET;
-                    destinationInfo.sin_addr.s_addr = htonl(serverAddress);
-                    destinationInfo.sin_port = htons(serverPort);
-                    long int sentBytes = sendto(socketHandle,
-                        (const char*) data.data(),
-                        data.size(),
-                        0,
-                        (sockaddr*) &destinationInfo,
-                        sizeof(sockaddr_in));
-
-                    if(sentBytes < 0)
-                    {
-                        std::cerr << "Failed to send heartbeat packet to server!" << std::endl;
-                    }
-                    else
-                    {
-                        unsigned long int u_sentBytes = sentBytes;
-                        if(u_sentBytes != data.size())
-                        {
-                            std::cerr << "Failed to send heartbeat packet to server!" << std::endl;
-                        }
-                        else
-                        {
-                            connectionData.at(serverAddress).sentPackets.push_front(PacketInfo(std::vector<char>(), std::chrono::steady_clock::now(), serverAddress, sequenceID, false, true));
-                            checkSentPacketsSize(serverAddress);
-                            connectionData.at(serverAddress).timeSinceLastSent = std::chrono::steady_clock::now();
-                        }
-                    }
-                }
-            }
-
-NETWORK_CLIENT_RECEIVE:
-            // receive
-            std::vector<char> data(GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE);
-#if PLATFORM == PLATFORM_WINDOWS
-            typedef int socklen_t;
-#endif
-            sockaddr_in receivedData;
-            socklen_t receivedDataSize = sizeof(receivedData);
-
-            int bytes = recvfrom(socketHandle,
-                data.data(),
-                GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE,
-                0,
-                (sockaddr*) &receivedData,
-                &receivedDataSize);
-
-            uint32_t address = ntohl(receivedData.sin_addr.s_addr);
-            uint16_t port = ntohs(receivedData.sin_port);
-
-            if(bytes >= 20 && address == serverAddress && port == serverPort)
-            {
-                uint32_t* tempPtr = (uint32_t*)data.data();
-                uint32_t protocolID = ntohl(*tempPtr);
-
-                if(protocolID != GDT_INTERNAL_NETWORK_PROTOCOL_ID)
-                    return;
-
-                tempPtr = (uint32_t*)(data.data() + 4);
-                uint32_t ID = ntohl(*tempPtr);
-                tempPtr = (uint32_t*)(data.data() + 8);
-                uint32_t sequence = ntohl(*tempPtr);
-                tempPtr = (uint32_t*)(data.data() + 12);
-                uint32_t ack = ntohl(*tempPtr);
-                tempPtr = (uint32_t*)(data.data() + 16);
-                uint32_t bitfield = ntohl(*tempPtr);
-
-                bool isConnect = (ID & GDT::Internal::Network::CONNECT) != 0;
-                bool isPing = (ID & GDT::Internal::Network::PING) != 0;
-                bool isNotReceivedChecked = (ID & GDT::Internal::Network::NO_REC_CHK) != 0;
-                bool isResent = (ID & GDT::Internal::Network::RESENDING) != 0;
-
-                ID = ID & 0x0FFFFFFF;
-
-                if(isPing)
-                {
-                    connectionData.at(serverAddress).triggerSend = true;
-                }
-                else if(ID != connectionData.at(serverAddress).id
-                        || isConnect)
-                    return;
-
-                // packet is valid
-#ifndef NDEBUG
-                std::cout << "Valid packet " << sequence << " received from " << GDT::Internal::Network::addressToString(serverAddress) << std::endl;
-#endif
-
-                bool outOfOrder = false;
-
-                lookupRtt(serverAddress, ack);
-
-                connectionData.at(serverAddress).timeSinceLastReceived = std::chrono::steady_clock::now();
-                checkSentPackets(ack, bitfield, serverAddress);
-
-                uint32_t diff = 0;
-                if(sequence > connectionData.at(serverAddress).rSequence)
-                {
-                    diff = sequence - connectionData.at(serverAddress).rSequence;
-                    if(diff <= 0x7FFFFFFF)
-                    {
-                        // sequence is more recent
-                        connectionData.at(serverAddress).rSequence = sequence;
-                        shiftBitfield(address, diff);
-                    }
-                    else
-                    {
-                        // sequence is older packet id, diff requires recalc
-                        diff = sequence + (0xFFFFFFFF - connectionData.at(serverAddress).rSequence) + 1;
-
-                        if((connectionData.at(serverAddress).ackBitfield & (0x100000000 >> diff)) != 0x0)
-                        {
-                            // already received packet
-                            return;
-                        }
-                        connectionData.at(serverAddress).ackBitfield |= (0x100000000 >> diff);
-
-                        if(ignoreOutOfSequence)
-                            return;
-
-                        outOfOrder = true;
-                    }
-                }
-                else if(connectionData.at(serverAddress).rSequence > sequence)
-                {
-                    diff = connectionData.at(serverAddress).rSequence - sequence;
-                    if(diff > 0x7FFFFFFF)
-                    {
-                        // sequence is more recent, diff requires recalc
-                        diff = sequence + (0xFFFFFFFF - connectionData.at(serverAddress).rSequence) + 1;
-
-                        connectionData.at(serverAddress).rSequence = sequence;
-                        shiftBitfield(address, diff);
-                    }
-                    else
-                    {
-                        // sequence is older packet id
-                        if((connectionData.at(serverAddress).ackBitfield & (0x100000000 >> diff)) != 0x0)
-                        {
-                            // already received packet
-                            return;
-                        }
-                        connectionData.at(serverAddress).ackBitfield |= (0x100000000 >> diff);
-
-                        if(ignoreOutOfSequence)
-                            return;
-
-                        outOfOrder = true;
-                    }
-                }
-                else
-                {
-                    // duplicate packet, ignoring
-                    return;
-                }
-
-#ifndef NDEBUG
-                if(outOfOrder)
-                {
-                    std::cout << "Out of order packet\n";
-                }
-#endif
-
-                receivedPacket(data.data() + 20, bytes - 20, serverAddress, outOfOrder, isResent, isNotReceivedChecked);
-            }
+            receivePackets();
+            packetsAcked();
         }
         // connection not yet established
         else if(acceptNewConnections)
@@ -684,87 +329,133 @@ NETWORK_CLIENT_RECEIVE:
                 temp = 0xFFFFFFFF;
                 memcpy(data + 16, &temp, 4);
 
-                // send data
-                sockaddr_in destinationInfo;
-                destinationInfo.sin_family = AF_INET;
-                destinationInfo.sin_port = htons(serverPort);
+                uint32_t destinationAddress;
                 if(clientBroadcast)
                 {
-                    uint32_t broadcastAddress = GDT::Internal::Network::getBroadcastAddress();
-                    if(broadcastAddress == 0)
+                    // the address is looked up in the background, so the
+                    // first attempts go to the limited broadcast address
+                    if(!GDT::Internal::Network::getCachedBroadcastAddress(destinationAddress))
                     {
-                        std::cerr << "WARNING: Failed to get local address!" << std::endl;
-                        destinationInfo.sin_addr.s_addr = 0xFFFFFFFF;
+                        destinationAddress = 0xFFFFFFFF;
                     }
-                    else
+                    else if(destinationAddress == 0)
                     {
-                        destinationInfo.sin_addr.s_addr = htonl(broadcastAddress);
+                        std::cerr << "WARNING: Failed to get local address!" << std::endl;
+                        destinationAddress = 0xFFFFFFFF;
                     }
                 }
                 else
                 {
-                    destinationInfo.sin_addr.s_addr = htonl(serverAddress);
-                }
-                int sentBytes = sendto(socketHandle,
-                    (const char*) data,
-                    20,
-                    0,
-                    (sockaddr*) &destinationInfo,
-                    sizeof(sockaddr_in));
-                if(sentBytes != 20)
-                {
-                    std::cerr << "ERROR: Failed to send initiate connection packet to server!" << std::endl;
+                    destinationAddress = serverAddress;
                 }
+
+                // send data
+                std::memcpy(sendBatch.stage(20, destinationAddress, serverPort, SendBatch::CONNECT), data, 20);
+                flushSendBatch();
             }
 
-            // receive
-            std::vector<char> data(GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE);
-#if PLATFORM == PLATFORM_WINDOWS
-            typedef int socklen_t;
-#endif
-            sockaddr_in receivedData;
-            socklen_t receivedDataSize = sizeof(receivedData);
+            receivePackets();
+            packetsAcked();
+        }
+    } // elif(mode == CLIENT)
 
-            int bytes = recvfrom(socketHandle,
-                data.data(),
-                GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE,
-                0,
-                (sockaddr*) &receivedData,
-                &receivedDataSize);
+    updateStats(updateStart);
+}
 
-            uint32_t address = ntohl(receivedData.sin_addr.s_addr);
-            uint16_t port = ntohs(receivedData.sin_port);
+void GDT::NetworkConnection::updateStats(std::chrono::steady_clock::time_point start)
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+    ++stats.updates;
+    stats.updateMicroseconds += microseconds;
+    stats.maxUpdateMicroseconds = std::max(stats.maxUpdateMicroseconds, microseconds);
 
-            if(bytes >= 20 && port == serverPort
-                && (clientBroadcast || address == serverAddress))
+    if(rateWindowStart == std::chrono::steady_clock::time_point())
+    {
+        rateWindowStart = now;
+    }
+    double seconds = std::chrono::duration<double>(now - rateWindowStart).count();
+    if(seconds >= 1.0)
+    {
+        uint64_t sentBytes = stats.total.sentBytes;
+        uint64_t receivedBytes = stats.total.receivedBytes;
+        for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+        {
+            if(iter->isConnected)
             {
-#ifndef NDEBUG
-                std::cout << "." << std::flush;
-#endif
-                uint32_t* tempPtr = (uint32_t*)data.data();
-                uint32_t protocolID = ntohl(*tempPtr);
+                sentBytes += iter->stats.sentBytes;
+                receivedBytes += iter->stats.receivedBytes;
+            }
+        }
+        // totals may have been reset since the window started
+        stats.sentBytesPerSecond = sentBytes >= rateWindowSentBytes ? (sentBytes - rateWindowSentBytes) / seconds : 0.0;
+        stats.receivedBytesPerSecond = receivedBytes >= rateWindowReceivedBytes ? (receivedBytes - rateWindowReceivedBytes) / seconds : 0.0;
+        rateWindowSentBytes = sentBytes;
+        rateWindowReceivedBytes = receivedBytes;
+        rateWindowStart = now;
+    }
+}
 
-                if(protocolID != GDT_INTERNAL_NETWORK_PROTOCOL_ID)
-                    return;
+void GDT::NetworkConnection::scheduleConnection(ConnectionData& connection, double timeout)
+{
+    double deadline = std::min(connection.timerStart + connection.rate.sendInterval(),
+        elapsedTime + timeout);
 
-                tempPtr = (uint32_t*)(data.data() + 4);
-                uint32_t ID = ntohl(*tempPtr) & 0x0FFFFFFF;
-//                tempPtr = (uint32_t*)(data.data() + 8);
-//                uint32_t sequence = ntohl(*tempPtr);
-//                tempPtr = (uint32_t*)(data.data() + 12);
-//                uint32_t ack = ntohl(*tempPtr);
-//                tempPtr = (uint32_t*)(data.data() + 16);
-//                uint32_t bitfield = ntohl(*tempPtr);
+    timerWheel.schedule(&connection - connections.data(),
+        (uint64_t)std::ceil(deadline * GDT_INTERNAL_NETWORK_TIMER_TICKS_PER_SECOND));
+}
 
-                if(clientBroadcast)
-                {
-                    clientSentAddress = address;
-                    clientSentAddressSet = true;
-                }
-                registerConnection(address, ID, serverPort);
-            }
-        }
-    } // elif(mode == CLIENT)
+bool GDT::NetworkConnection::canSendQueued(ConnectionData& connection)
+{
+    std::size_t size;
+    if(nextIsMessage(connection))
+    {
+        uint32_t key = connection.messageQueue.front();
+        const GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[(key >> 16) - 1];
+        size = 20 + GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE
+            + messageChannel.sent[messageChannel.slotOf(key & 0xFFFF)].size();
+    }
+    else if(!connection.sendPacketQueue.empty())
+    {
+        size = 20 + connection.sendPacketQueue.back().data.size();
+    }
+    else
+    {
+        return false;
+    }
+
+    // queued packets wait while the congestion window is full, except for a
+    // single packet larger than the whole window
+    return connection.rate.bytesInFlight == 0
+        || connection.rate.bytesInFlight + size
+            <= connection.rate.congestionWindow(connection.rtt, datagramSizeOf(connection));
+}
+
+void GDT::NetworkConnection::updatePacingRate()
+{
+    uint32_t pacingRate = ~0U;
+    if(pacePackets)
+    {
+        double bytesPerSecond = pacer.rate * GDT_INTERNAL_NETWORK_PACING_HEADROOM * maxDatagramSize;
+        pacingRate = (uint32_t)std::min(std::max(bytesPerSecond, 1.0), (double)(~0U - 1));
+    }
+
+    // only tell the transport about changes of more than an eighth
+    uint32_t difference = pacingRate > appliedPacingRate ? pacingRate - appliedPacingRate : appliedPacingRate - pacingRate;
+    if(difference > appliedPacingRate / 8 || (pacingRate == ~0U) != (appliedPacingRate == ~0U))
+    {
+        transport->setPacingRate(pacingRate);
+        appliedPacingRate = pacingRate;
+    }
+}
+
+void GDT::NetworkConnection::requestSend(ConnectionData& connection)
+{
+    if(!connection.triggerSend)
+    {
+        connection.triggerSend = true;
+        triggeredConnections.push_back(&connection - connections.data());
+    }
 }
 
 void GDT::NetworkConnection::connectToServer(unsigned char a,
@@ -781,6 +472,8 @@ void GDT::NetworkConnection::connectToServer(uint32_t address)
     if(mode != CLIENT)
         return;
 
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+
 #ifndef NDEBUG
     std::cout << "CLIENT: storing server ip as " << GDT::Internal::Network::addressToString(address) << '\n';
 #endif
@@ -791,58 +484,161 @@ void GDT::NetworkConnection::connectToServer(uint32_t address)
 
 void GDT::NetworkConnection::sendPacket(const std::vector<char>& packetData, uint32_t address, bool isReceivedChecked)
 {
-    if(connectionData.find(address) == connectionData.end())
+    sendPacket(std::vector<char>(packetData), address, isReceivedChecked);
+}
+
+void GDT::NetworkConnection::sendPacket(std::vector<char>&& packetData, uint32_t address, bool isReceivedChecked)
+{
+    QueuedSend queued;
+    queued.data = std::move(packetData);
+    queued.address = address;
+    queued.isReceivedChecked = isReceivedChecked;
+    if(threaded)
     {
-        std::clog << "WARNING: Tried to queue packet to nonexistent recipient!" << std::endl;
+        pushSend(std::move(queued));
     }
     else
     {
-        connectionData.at(address).sendPacketQueue.push_front(PacketInfo(
-            packetData,
-            std::chrono::steady_clock::time_point(),
-            address, 0, false, !isReceivedChecked));
+        queuePacket(queued);
     }
 }
 
-void GDT::NetworkConnection::resendPacket(const std::vector<char>& packetData, uint32_t address)
+void GDT::NetworkConnection::sendPacket(const char* packetData, uint32_t packetSize, uint32_t address, bool isReceivedChecked)
+{
+    sendPacket(std::vector<char>(packetData, packetData + packetSize), address, isReceivedChecked);
+}
+
+void GDT::NetworkConnection::sendPacket(const std::vector<char>& packetData, ConnectionHandle connection, bool isReceivedChecked)
 {
-    if(connectionData.find(address) == connectionData.end())
+    sendPacket(std::vector<char>(packetData), connection, isReceivedChecked);
+}
+
+void GDT::NetworkConnection::sendPacket(std::vector<char>&& packetData, ConnectionHandle connection, bool isReceivedChecked)
+{
+    QueuedSend queued;
+    queued.data = std::move(packetData);
+    queued.connection = connection;
+    queued.isReceivedChecked = isReceivedChecked;
+    if(threaded)
     {
-        std::clog << "WARNING: Tried to queue packet to nonexistent recipient!" << std::endl;
+        pushSend(std::move(queued));
     }
     else
     {
-        connectionData.at(address).sendPacketQueue.push_front(PacketInfo(
-            packetData,
-            std::chrono::steady_clock::time_point(),
-            address,
-            0,
-            true));
+        queuePacket(queued);
     }
 }
 
-void GDT::NetworkConnection::sendPacket(const char* packetData, uint32_t packetSize, uint32_t address, bool isReceivedChecked)
+void GDT::NetworkConnection::sendPacket(const char* packetData, uint32_t packetSize, ConnectionHandle connection, bool isReceivedChecked)
+{
+    sendPacket(std::vector<char>(packetData, packetData + packetSize), connection, isReceivedChecked);
+}
+
+void GDT::NetworkConnection::sendMessage(const std::vector<char>& messageData, ConnectionHandle connection, Channel channel)
+{
+    sendMessage(std::vector<char>(messageData), connection, channel);
+}
+
+void GDT::NetworkConnection::sendMessage(std::vector<char>&& messageData, ConnectionHandle connection, Channel channel)
+{
+    QueuedSend queued;
+    queued.data = std::move(messageData);
+    queued.connection = connection;
+    queued.isReceivedChecked = channel != UNRELIABLE;
+    queued.isMessage = true;
+    queued.channel = channel;
+    if(threaded)
+    {
+        pushSend(std::move(queued));
+    }
+    else
+    {
+        queuePacket(queued);
+    }
+}
+
+void GDT::NetworkConnection::sendMessage(const char* messageData, uint32_t messageSize, ConnectionHandle connection, Channel channel)
 {
-    std::vector<char> data(packetData, packetData + packetSize);
-    sendPacket(data, address, isReceivedChecked);
+    sendMessage(std::vector<char>(messageData, messageData + messageSize), connection, channel);
+}
+
+void GDT::NetworkConnection::sendTrackedPacket(const std::vector<char>& packetData, ConnectionHandle connection, uint32_t trackingId)
+{
+    sendTrackedPacket(std::vector<char>(packetData), connection, trackingId);
+}
+
+void GDT::NetworkConnection::sendTrackedPacket(std::vector<char>&& packetData, ConnectionHandle connection, uint32_t trackingId)
+{
+    QueuedSend queued;
+    queued.data = std::move(packetData);
+    queued.connection = connection;
+    queued.isTracked = true;
+    queued.trackingId = trackingId;
+    if(threaded)
+    {
+        pushSend(std::move(queued));
+    }
+    else
+    {
+        queuePacket(queued);
+    }
 }
 
 float GDT::NetworkConnection::getRtt()
 {
-    if(connectionData.empty())
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
     {
-        return 0;
+        if(iter->isConnected)
+        {
+            return iter->rtt.count() / 1000.0f;
+        }
     }
-    return connectionData.begin()->second.rtt.count() / 1000.0f;
+    return 0;
 }
 
 float GDT::NetworkConnection::getRtt(uint32_t address)
 {
-    if(connectionData.find(address) == connectionData.end())
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(address);
+    if(connection == nullptr)
+    {
+        return 0;
+    }
+    return connection->rtt.count() / 1000.0f;
+}
+
+float GDT::NetworkConnection::getRtt(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return 0;
+    }
+    return connectionPtr->rtt.count() / 1000.0f;
+}
+
+uint32_t GDT::NetworkConnection::getMaxPayload(uint32_t address)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(address);
+    if(connection == nullptr)
+    {
+        return 0;
+    }
+    return datagramSizeOf(*connection) - 20;
+}
+
+uint32_t GDT::NetworkConnection::getMaxPayload(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
     {
         return 0;
     }
-    return connectionData.at(address).rtt.count() / 1000.0f;
+    return datagramSizeOf(*connectionPtr) - 20;
 }
 
 void GDT::NetworkConnection::setReceivedCallback(std::function<void(const char*, uint32_t, uint32_t, bool, bool, bool)> callback)
@@ -860,296 +656,1919 @@ void GDT::NetworkConnection::setDisconnectedCallback(std::function<void(uint32_t
     disconnectedCallback = callback;
 }
 
-std::vector<uint32_t> GDT::NetworkConnection::getConnected()
-{
-    std::vector<uint32_t> connectedList;
+void GDT::NetworkConnection::setHandleReceivedCallback(std::function<void(const char*, uint32_t, ConnectionHandle, bool, bool, bool)> callback)
+{
+    handleReceivedCallback = callback;
+}
+
+void GDT::NetworkConnection::setHandleConnectedCallback(std::function<void(ConnectionHandle)> callback)
+{
+    handleConnectedCallback = callback;
+}
+
+void GDT::NetworkConnection::setHandleDisconnectedCallback(std::function<void(ConnectionHandle)> callback)
+{
+    handleDisconnectedCallback = callback;
+}
+
+void GDT::NetworkConnection::setHandleAckedCallback(std::function<void(ConnectionHandle, uint32_t)> callback)
+{
+    handleAckedCallback = callback;
+}
+
+std::vector<uint32_t> GDT::NetworkConnection::getConnected()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    std::vector<uint32_t> connectedList;
+
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        if(iter->isConnected)
+        {
+            connectedList.push_back(iter->address);
+        }
+    }
+
+    return connectedList;
+}
+
+std::vector<GDT::NetworkConnection::ConnectionHandle> GDT::NetworkConnection::getConnectedHandles()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    std::vector<ConnectionHandle> connectedList;
+
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        if(iter->isConnected)
+        {
+            connectedList.push_back(handleOf(*iter));
+        }
+    }
+
+    return connectedList;
+}
+
+GDT::NetworkConnection::ConnectionHandle GDT::NetworkConnection::getHandle(uint32_t address, unsigned short port)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(address, port);
+    if(connection == nullptr)
+    {
+        return ConnectionHandle();
+    }
+    return handleOf(*connection);
+}
+
+uint32_t GDT::NetworkConnection::getAddress(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return 0;
+    }
+    return connectionPtr->address;
+}
+
+unsigned short GDT::NetworkConnection::getPort(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return 0;
+    }
+    return connectionPtr->port;
+}
+
+unsigned int GDT::NetworkConnection::getPacketQueueSize(uint32_t destinationAddress)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(destinationAddress);
+    if(connection == nullptr)
+    {
+        return 0;
+    }
+
+    return connection->sendPacketQueue.size();
+}
+
+void GDT::NetworkConnection::clearPacketQueue(uint32_t destinationAddress)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(destinationAddress);
+    if(connection == nullptr)
+    {
+        return;
+    }
+
+    connection->sendPacketQueue.clear();
+}
+
+unsigned int GDT::NetworkConnection::getPacketQueueSize(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return 0;
+    }
+
+    return connectionPtr->sendPacketQueue.size();
+}
+
+void GDT::NetworkConnection::clearPacketQueue(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return;
+    }
+
+    connectionPtr->sendPacketQueue.clear();
+}
+
+bool GDT::NetworkConnection::connectionIsGood()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        if(iter->isConnected)
+        {
+            return iter->rate.sendRate >= GDT_INTERNAL_NETWORK_GOOD_SEND_RATE;
+        }
+    }
+    return false;
+}
+
+bool GDT::NetworkConnection::connectionIsGood(uint32_t destinationAddress)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connection = findConnection(destinationAddress);
+    if(connection == nullptr)
+    {
+        return false;
+    }
+
+    return connection->rate.sendRate >= GDT_INTERNAL_NETWORK_GOOD_SEND_RATE;
+}
+
+bool GDT::NetworkConnection::connectionIsGood(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return false;
+    }
+
+    return connectionPtr->rate.sendRate >= GDT_INTERNAL_NETWORK_GOOD_SEND_RATE;
+}
+
+float GDT::NetworkConnection::getSendRate(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* connectionPtr = findConnection(connection);
+    if(connectionPtr == nullptr)
+    {
+        return 0.0f;
+    }
+
+    return connectionPtr->rate.sendRate;
+}
+
+bool GDT::NetworkConnection::isConnected(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    return findConnection(connection) != nullptr;
+}
+
+GDT::NetworkConnection::SocketCounters GDT::NetworkConnection::getSocketCounters() const
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    return socketCounters;
+}
+
+void GDT::NetworkConnection::resetSocketCounters()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    socketCounters = SocketCounters();
+}
+
+GDT::NetworkConnection::ConnectionStats GDT::NetworkConnection::getStats(ConnectionHandle connection)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    ConnectionData* peer = findConnection(connection);
+    if(peer == nullptr)
+    {
+        return ConnectionStats();
+    }
+
+    ConnectionStats peerStats = peer->stats;
+    peerStats.queuedPackets = peer->sendPacketQueue.size();
+    peerStats.queuedMessages = peer->messageQueue.size();
+    peerStats.bytesInFlight = peer->rate.bytesInFlight;
+    return peerStats;
+}
+
+GDT::NetworkConnection::NetworkStats GDT::NetworkConnection::getStats()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    return collectStats();
+}
+
+void GDT::NetworkConnection::resetStats()
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    stats = NetworkStats();
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        iter->stats = ConnectionStats();
+    }
+    rateWindowStart = std::chrono::steady_clock::time_point();
+    rateWindowSentBytes = 0;
+    rateWindowReceivedBytes = 0;
+}
+
+void GDT::NetworkConnection::setStatsSink(std::function<void(const std::string&)> sink, float interval, StatsFormat format)
+{
+    statsSink = sink;
+    statsFormat = format;
+    statsInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(interval));
+    statsSinkStart = std::chrono::steady_clock::now();
+    nextStatsLine = statsSinkStart + statsInterval;
+    if(statsSink && statsFormat == STATS_CSV)
+    {
+        statsSink(GDT::Internal::Network::statsCsvHeader());
+    }
+}
+
+GDT::NetworkConnection::NetworkStats GDT::NetworkConnection::collectStats()
+{
+    NetworkStats collected = stats;
+    for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        if(!iter->isConnected)
+        {
+            continue;
+        }
+
+        ++collected.connections;
+        collected.total.add(iter->stats);
+        collected.total.queuedPackets += iter->sendPacketQueue.size();
+        collected.total.queuedMessages += iter->messageQueue.size();
+        collected.total.bytesInFlight += iter->rate.bytesInFlight;
+        collected.maxQueued = std::max<uint64_t>(collected.maxQueued,
+            iter->sendPacketQueue.size() + iter->messageQueue.size());
+    }
+    return collected;
+}
+
+void GDT::NetworkConnection::writeStatsLine()
+{
+    if(!statsSink)
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if(now < nextStatsLine)
+    {
+        return;
+    }
+    nextStatsLine += statsInterval;
+    if(nextStatsLine <= now)
+    {
+        // fell behind, don't write the missed lines
+        nextStatsLine = now + statsInterval;
+    }
+
+    double time = std::chrono::duration<double>(now - statsSinkStart).count();
+    NetworkStats current = getStats();
+    statsSink(statsFormat == STATS_JSON ? GDT::Internal::Network::statsToJson(current, time)
+        : GDT::Internal::Network::statsToCsv(current, time));
+}
+
+void GDT::NetworkConnection::reset(NetworkConnection::Mode mode, unsigned short serverPort, unsigned short clientPort, bool clientBroadcast)
+{
+    stopThread();
+
+    this->mode = mode;
+    this->serverPort = serverPort;
+    this->clientPort = clientPort;
+    closeSocket();
+    // slots are kept so that handles from before the reset stay invalid
+    freeConnections.clear();
+    for(uint32_t i = connections.size(); i-- > 0;)
+    {
+        if(connections[i].isConnected)
+        {
+            stats.total.add(connections[i].stats);
+            ++stats.disconnects;
+            connections[i].isConnected = false;
+            ++connections[i].generation;
+            connections[i].sendPacketQueue.clear();
+        }
+        freeConnections.push_back(i);
+    }
+    connectionMap.clear();
+    timerWheel.clear();
+    triggeredConnections.clear();
+    ackedPackets.clear();
+    impairment.clear();
+    pacer = GDT::Internal::Network::Pacer();
+    lastSendTime = std::chrono::steady_clock::time_point();
+    appliedPacingRate = ~0U;
+    elapsedTime = 0.0;
+    clientSentAddress = 0;
+    clientSentAddressSet = false;
+    initialized = false;
+    validState = false;
+    invalidNoticeTimer = INVALID_NOTICE_TIME;
+    clientRetryTimer = GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS;
+    lastWaitUpdate = std::chrono::steady_clock::time_point();
+    this->clientBroadcast = clientBroadcast;
+}
+
+void GDT::NetworkConnection::setClientBroadcast(bool clientWillBroadcast)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    clientBroadcast = clientWillBroadcast;
+}
+
+void GDT::NetworkConnection::setReusePort(bool reusePort)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    this->reusePort = reusePort;
+}
+
+void GDT::NetworkConnection::setDiscoverPathMtu(bool discoverPathMtu)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    this->discoverPathMtu = discoverPathMtu;
+}
+
+void GDT::NetworkConnection::setImpairment(const Impairment& impairment)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    this->impairment.configure(impairment);
+}
+
+void GDT::NetworkConnection::setTransport(std::unique_ptr<Transport> transport)
+{
+    std::unique_lock<std::mutex> lock = lockIfThreaded();
+    nextTransport = std::move(transport);
+}
+
+std::unique_lock<std::mutex> GDT::NetworkConnection::lockIfThreaded() const
+{
+    if(threaded)
+    {
+        return std::unique_lock<std::mutex>(stateMutex);
+    }
+    return std::unique_lock<std::mutex>();
+}
+
+void GDT::NetworkConnection::threadLoop(float interval)
+{
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(interval));
+    auto previous = std::chrono::steady_clock::now();
+    auto next = previous;
+    QueuedSend queued;
+    float deadline;
+    while(threadRunning)
+    {
+        auto now = std::chrono::steady_clock::now();
+        float deltaTime = std::chrono::duration<float>(now - previous).count();
+        previous = now;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            while(sendQueue.pop(queued))
+            {
+                queuePacket(queued);
+            }
+
+            updateConnection(deltaTime);
+            // paced sends are spread over the ticks between intervals
+            deadline = pacePackets ? nextDeadline() : -1.0f;
+
+            // retry events that did not fit in the queue
+            while(!eventOverflow.empty() && eventQueue.push(std::move(eventOverflow.front())))
+            {
+                eventOverflow.pop_front();
+            }
+        }
+
+        // wake at the next tick or when a datagram is received
+        now = std::chrono::steady_clock::now();
+        if(next <= now)
+        {
+            next += period;
+            if(next <= now)
+            {
+                // fell behind, don't try to catch up
+                next = now + period;
+            }
+        }
+        float wait = std::chrono::duration<float>(next - now).count();
+        if(deadline >= 0.0f && deadline < wait)
+        {
+            wait = deadline;
+        }
+        waitForActivity(wait);
+    }
+}
+
+float GDT::NetworkConnection::nextDeadline()
+{
+    float next = -1.0f;
+    auto consider = [&next] (float deadline) {
+        if(deadline < 0.0f)
+        {
+            deadline = 0.0f;
+        }
+        if(next < 0.0f || deadline < next)
+        {
+            next = deadline;
+        }
+    };
+
+    if(!triggeredConnections.empty())
+    {
+        consider(0.0f);
+    }
+    uint64_t expiry = timerWheel.nextExpiry();
+    if(expiry != UINT64_MAX)
+    {
+        consider((float)((double)expiry / GDT_INTERNAL_NETWORK_TIMER_TICKS_PER_SECOND - elapsedTime));
+    }
+    if(impairment.nextDue() >= 0.0)
+    {
+        consider((float)(impairment.nextDue() - elapsedTime));
+    }
+
+    if(mode == CLIENT
+        && acceptNewConnections
+        && (clientSentAddressSet || clientBroadcast)
+        && findConnection(clientSentAddress, serverPort) == nullptr)
+    {
+        consider(GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS - clientRetryTimer);
+    }
+
+    return next;
+}
+
+void GDT::NetworkConnection::waitForActivity(float maxWait)
+{
+    if(validState)
+    {
+        transport->wait(maxWait);
+    }
+    else
+    {
+        // nothing to wait on, avoid spinning
+        std::this_thread::sleep_for(std::chrono::duration<float>(
+            maxWait >= 0.0f ? maxWait : INVALID_NOTICE_TIME));
+    }
+}
+
+void GDT::NetworkConnection::closeSocket()
+{
+    if(!validState)
+    {
+        return;
+    }
+
+    transport->close();
+}
+
+void GDT::NetworkConnection::queuePacket(QueuedSend& queued)
+{
+    ConnectionData* connection = queued.connection.isValid()
+        ? findConnection(queued.connection)
+        : findConnection(queued.address);
+    if(connection == nullptr)
+    {
+        std::clog << "WARNING: Tried to queue packet to nonexistent recipient!" << std::endl;
+    }
+    else if(queued.isMessage && queued.channel != UNRELIABLE)
+    {
+        queueMessage(*connection, queued.channel, queued.data);
+    }
+    else if(20 + queued.data.size() > datagramSizeOf(*connection))
+    {
+        // too large for one datagram, so it is sent in reliable fragments
+        if(queueMessage(*connection, RELIABLE_UNORDERED, queued.data) && queued.isTracked)
+        {
+            // acked once every fragment up to its last one is
+            GDT::Internal::Network::MessageChannel& messageChannel = connection->channels[RELIABLE_UNORDERED - 1];
+            messageChannel.tracked.push_back(std::make_pair(messageChannel.queuedEnd(), queued.trackingId));
+        }
+    }
+    else
+    {
+        connection->sendPacketQueue.push_front(PacketInfo(
+            std::move(queued.data),
+            std::chrono::steady_clock::time_point(),
+            connection->address, 0, false, !queued.isReceivedChecked));
+        if(queued.isTracked)
+        {
+            connection->sendPacketQueue.front().trackingIds.push_back(queued.trackingId);
+        }
+    }
+}
+
+bool GDT::NetworkConnection::queueMessage(ConnectionData& connection, uint8_t channel, std::vector<char>& data)
+{
+    const std::size_t maxSize = datagramSizeOf(connection);
+    if(20 + GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE + data.size() <= maxSize
+        && data.size() <= 0xFFFF)
+    {
+        pushMessage(connection, channel, data, false);
+        return true;
+    }
+    else if(data.size() > GDT_INTERNAL_NETWORK_MAX_FRAGMENTED_SIZE)
+    {
+        std::clog << "WARNING: Tried to send message larger than 16 MiB!" << std::endl;
+        return false;
+    }
+
+    // split into fragments of equal size (but the last), each small enough
+    // to be sent in a datagram by itself
+    const std::size_t overhead = 20 + GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE
+        + GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE;
+    const std::size_t maxFragmentSize = std::min<std::size_t>(
+        maxSize > overhead + 1 ? maxSize - overhead : 1,
+        0xFFFF - GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE);
+    const std::size_t count = (data.size() + maxFragmentSize - 1) / maxFragmentSize;
+    if(count > 0xFFFF)
+    {
+        std::clog << "WARNING: Tried to send message of more than 65535 fragments!" << std::endl;
+        return false;
+    }
+    const std::size_t fragmentSize = (data.size() + count - 1) / count;
+
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t offset = i * fragmentSize;
+        std::size_t size = std::min(fragmentSize, data.size() - offset);
+        std::vector<char> fragment(GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE + size);
+        uint16_t temp = htons(i);
+        std::memcpy(fragment.data(), &temp, 2);
+        temp = htons(count);
+        std::memcpy(fragment.data() + 2, &temp, 2);
+        uint32_t total = htonl(data.size());
+        std::memcpy(fragment.data() + 4, &total, 4);
+        std::memcpy(fragment.data() + GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE, data.data() + offset, size);
+        pushMessage(connection, channel, fragment, true);
+    }
+    return true;
+}
+
+void GDT::NetworkConnection::pushMessage(ConnectionData& connection, uint8_t channel, std::vector<char>& data, bool isFragment)
+{
+    GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[channel - 1];
+    uint16_t sequence;
+    if(!messageChannel.waiting.empty() || !messageChannel.push(data, isFragment, sequence))
+    {
+        // sent once the oldest unacked messages are acked
+        messageChannel.waiting.push_back(std::make_pair(std::move(data), isFragment));
+        return;
+    }
+    messageChannel.isQueued[messageChannel.slotOf(sequence)] = true;
+    connection.messageQueue.push_back(messageChannel.keyOf(channel, sequence));
+}
+
+void GDT::NetworkConnection::fillMessageWindow(ConnectionData& connection, uint8_t channel)
+{
+    GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[channel - 1];
+    uint16_t sequence;
+    while(!messageChannel.waiting.empty()
+        && messageChannel.push(messageChannel.waiting.front().first, messageChannel.waiting.front().second, sequence))
+    {
+        messageChannel.waiting.pop_front();
+        messageChannel.isQueued[messageChannel.slotOf(sequence)] = true;
+        connection.messageQueue.push_back(messageChannel.keyOf(channel, sequence));
+    }
+}
+
+void GDT::NetworkConnection::ackMessages(PacketInfo& sentPacket, ConnectionData& connection)
+{
+    for(auto iter = sentPacket.messages.begin(); iter != sentPacket.messages.end(); ++iter)
+    {
+        connection.channels[(*iter >> 16) - 1].ack(*iter & 0xFFFF);
+    }
+    sentPacket.messages.clear();
+
+    uint32_t trackingId;
+    for(uint8_t channel = RELIABLE_UNORDERED; channel <= RELIABLE_ORDERED; ++channel)
+    {
+        while(connection.channels[channel - 1].popTracked(trackingId))
+        {
+            ackedPackets.push_back(std::make_pair(handleOf(connection), trackingId));
+        }
+        fillMessageWindow(connection, channel);
+    }
+}
+
+void GDT::NetworkConnection::lostMessages(PacketInfo& sentPacket, ConnectionData& connection)
+{
+    // resent messages go ahead of new ones, in the order they were sent
+    for(auto iter = sentPacket.messages.rbegin(); iter != sentPacket.messages.rend(); ++iter)
+    {
+        GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[(*iter >> 16) - 1];
+        uint16_t sequence = *iter & 0xFFFF;
+        uint32_t slot = messageChannel.slotOf(sequence);
+        if(messageChannel.isUnacked(sequence) && !messageChannel.isQueued[slot])
+        {
+#ifndef NDEBUG
+            std::cout << "Message " << sequence << " of channel " << (*iter >> 16) << " lost\n";
+#endif
+            messageChannel.isQueued[slot] = true;
+            connection.messageQueue.push_front(*iter);
+            ++connection.stats.resentMessages;
+        }
+    }
+    sentPacket.messages.clear();
+}
+
+bool GDT::NetworkConnection::nextIsMessage(ConnectionData& connection)
+{
+    // drop keys of messages that were acked while queued to be resent
+    while(!connection.messageQueue.empty()
+        && !connection.channels[(connection.messageQueue.front() >> 16) - 1]
+            .isUnacked(connection.messageQueue.front() & 0xFFFF))
+    {
+        connection.messageQueue.pop_front();
+    }
+
+    return !connection.messageQueue.empty()
+        && (connection.sendPacketQueue.empty() || connection.preferMessages);
+}
+
+void GDT::NetworkConnection::pushSend(QueuedSend&& queued)
+{
+    // packets that did not fit go first to keep them in order
+    while(!sendOverflow.empty() && sendQueue.push(std::move(sendOverflow.front())))
+    {
+        sendOverflow.pop_front();
+    }
+    if(!sendOverflow.empty() || !sendQueue.push(std::move(queued)))
+    {
+        sendOverflow.push_back(std::move(queued));
+    }
+}
+
+void GDT::NetworkConnection::pushEvent(ConnectionEvent&& event)
+{
+    while(!eventOverflow.empty() && eventQueue.push(std::move(eventOverflow.front())))
+    {
+        eventOverflow.pop_front();
+    }
+    if(!eventOverflow.empty() || !eventQueue.push(std::move(event)))
+    {
+        eventOverflow.push_back(std::move(event));
+    }
+}
+
+void GDT::NetworkConnection::deliverEvents()
+{
+    ConnectionEvent event;
+    while(true)
+    {
+        if(!eventQueue.pop(event))
+        {
+            // the overflow belongs to the network thread until it stops
+            if(threaded || eventOverflow.empty())
+            {
+                break;
+            }
+            event = std::move(eventOverflow.front());
+            eventOverflow.pop_front();
+        }
+
+        switch(event.type)
+        {
+        case ConnectionEvent::RECEIVED:
+            if(receivedCallback)
+            {
+                receivedCallback(event.data.data(), event.data.size(), event.address, event.outOfOrder, event.isResent, event.isReceivedChecked);
+            }
+            if(handleReceivedCallback)
+            {
+                handleReceivedCallback(event.data.data(), event.data.size(), event.connection, event.outOfOrder, event.isResent, event.isReceivedChecked);
+            }
+            break;
+        case ConnectionEvent::CONNECTED:
+            if(connectedCallback)
+            {
+                connectedCallback(event.address);
+            }
+            if(handleConnectedCallback)
+            {
+                handleConnectedCallback(event.connection);
+            }
+            break;
+        case ConnectionEvent::DISCONNECTED:
+            if(disconnectedCallback)
+            {
+                disconnectedCallback(event.address);
+            }
+            if(handleDisconnectedCallback)
+            {
+                handleDisconnectedCallback(event.connection);
+            }
+            break;
+        case ConnectionEvent::ACKED:
+            if(handleAckedCallback)
+            {
+                handleAckedCallback(event.connection, event.trackingId);
+            }
+            break;
+        }
+    }
+}
+
+GDT::NetworkConnection::ConnectionData* GDT::NetworkConnection::findConnection(uint32_t address, uint16_t port)
+{
+    uint32_t index = connectionMap.find(Endpoint(address, port));
+    if(index == GDT::Internal::Network::EndpointMap::NOT_FOUND)
+    {
+        return nullptr;
+    }
+    return &connections[index];
+}
+
+GDT::NetworkConnection::ConnectionData* GDT::NetworkConnection::findConnection(ConnectionHandle connection)
+{
+    if(connection.index >= connections.size()
+        || !connections[connection.index].isConnected
+        || connections[connection.index].generation != connection.generation)
+    {
+        return nullptr;
+    }
+    return &connections[connection.index];
+}
+
+GDT::NetworkConnection::ConnectionHandle GDT::NetworkConnection::handleOf(const ConnectionData& connection) const
+{
+    return ConnectionHandle(&connection - connections.data(), connection.generation);
+}
+
+void GDT::NetworkConnection::registerConnection(uint32_t address, uint32_t ID, unsigned short port)
+{
+    if(mode == SERVER)
+    {
+        ID = generateID();
+    }
+
+    uint32_t index;
+    if(freeConnections.empty())
+    {
+        index = connections.size();
+        connections.push_back(ConnectionData());
+    }
+    else
+    {
+        index = freeConnections.back();
+        freeConnections.pop_back();
+    }
+
+    ConnectionData& connection = connections[index];
+    uint32_t generation = connection.generation;
+    connection = ConnectionData(ID, mode == SERVER ? 0 : 1, address, port);
+    connection.generation = generation;
+    // start the send intervals of connections at different phases (by their
+    // random ID) so that they don't become due on the same tick
+    connection.timerStart = elapsedTime - (ID & 0x3FF) / 1024.0 * connection.rate.sendInterval();
+    pacer.rate += connection.rate.sendRate;
+    timerWheel.resize(connections.size());
+    scheduleConnection(connection, GDT_INTERNAL_NETWORK_CONNECTION_TIMEOUT_MILLISECONDS / 1000.0);
+    // the server answers a new connection right away
+    if(mode == SERVER)
+    {
+        requestSend(connection);
+    }
+
+    ++stats.connects;
+    connectionMap.insert(Endpoint(address, port), index);
+    if(connectionMap.find(Endpoint(address, 0)) == GDT::Internal::Network::EndpointMap::NOT_FOUND)
+    {
+        connectionMap.insert(Endpoint(address, 0), index);
+    }
+
+    connectionMade(connection);
+}
+
+void GDT::NetworkConnection::unregisterConnection(ConnectionData& connection)
+{
+    uint32_t address = connection.address;
+    ConnectionHandle handle = handleOf(connection);
+
+    connectionMap.erase(Endpoint(address, connection.port));
+    if(connectionMap.find(Endpoint(address, 0)) == handle.index)
+    {
+        // address only lookups move on to another peer with the same address
+        connectionMap.erase(Endpoint(address, 0));
+        for(uint32_t i = 0; i < connections.size(); ++i)
+        {
+            if(i != handle.index
+                && connections[i].isConnected
+                && connections[i].address == address)
+            {
+                connectionMap.insert(Endpoint(address, 0), i);
+                break;
+            }
+        }
+    }
+
+    // handles to this connection become invalid
+    stats.total.add(connection.stats);
+    ++stats.disconnects;
+    connection.isConnected = false;
+    ++connection.generation;
+    connection.sendPacketQueue.clear();
+    connection.messageQueue.clear();
+    connection.channels.fill(GDT::Internal::Network::MessageChannel());
+    timerWheel.cancel(handle.index);
+    pacer.rate = std::max(pacer.rate - connection.rate.sendRate, 0.0);
+    freeConnections.push_back(handle.index);
+
+    connectionLost(address, handle);
+}
+
+void GDT::NetworkConnection::resendPacket(std::vector<char>&& packetData, ConnectionData& connection, bool isCoalesced)
+{
+    connection.sendPacketQueue.push_front(PacketInfo(
+        std::move(packetData),
+        std::chrono::steady_clock::time_point(),
+        connection.address,
+        0,
+        true,
+        false,
+        isCoalesced));
+}
+
+void GDT::NetworkConnection::shiftBitfield(ConnectionData& connection, uint32_t diff)
+{
+    // the previous latest sequence becomes bit "diff", the sequences
+    // skipped in between stay unreceived
+    if(diff > 32)
+    {
+        connection.ackBitfield = 0x0;
+        return;
+    }
+    connection.ackBitfield = (uint32_t)(((uint64_t)connection.ackBitfield >> diff) | (0x100000000 >> diff));
+}
+
+void GDT::NetworkConnection::checkSentPackets(uint32_t ack, uint32_t bitfield, ConnectionData& connection)
+{
+    if(!resendTimedOutPackets)
+        return;
+
+    const std::chrono::milliseconds timeout = connection.rttEstimator.retransmitTimeout();
+    --ack;
+    for(uint32_t i = 1; bitfield != 0x0; bitfield = bitfield << 1, ++i)
+    {
+        // if received, don't bother checking
+        if((0x80000000 & bitfield) != 0x0)
+        {
+            --ack;
+            continue;
+        }
+
+        // not received by client yet, checking if packet timed out
+        PacketInfo* sentPacket = connection.sentPackets.find(ack);
+        if(sentPacket != nullptr
+            && !sentPacket->isNotReceivedChecked
+            && !sentPacket->hasBeenReSent)
+        {
+            // skip packets that intentionally are not checked or have
+            // already been re-sent, and resend packets skipped by the acks
+            // of later ones without waiting for the timeout
+            auto duration = std::chrono::steady_clock::now() - sentPacket->sentTime;
+            if(i >= GDT_INTERNAL_NETWORK_LOSS_REORDER_THRESHOLD
+                || std::chrono::duration_cast<std::chrono::milliseconds>(duration) >= timeout)
+            {
+                // lost, adding to send queue
+#ifndef NDEBUG
+                std::cout << "Packet " << ack << "(" << std::hex << std::showbase << ack << std::dec;
+                std::cout << ") timed out\n";
+#endif
+                // a packet is only resent once, so its data is handed over
+                resendPacket(std::move(sentPacket->data), connection, sentPacket->isCoalesced);
+                sentPacket->hasBeenReSent = true;
+                ++connection.stats.resentPackets;
+            }
+        }
+
+        --ack;
+    }
+}
+
+void GDT::NetworkConnection::lookupRtt(ConnectionData& connection, uint32_t ack)
+{
+    PacketInfo* sentPacket = connection.sentPackets.find(ack);
+    if(sentPacket == nullptr)
+    {
+        return;
+    }
+
+    auto duration = std::chrono::steady_clock::now() - sentPacket->sentTime;
+    connection.rttEstimator.sample(std::chrono::duration<double, std::milli>(duration).count());
+    connection.rtt = connection.rttEstimator.smoothed();
+#ifndef NDEBUG
+    std::cout << "(" << ack << ") RTT of " << GDT::Internal::Network::addressToString(connection.address) << " = " << connection.rtt.count() << '\n';
+#endif
+    if(connection.rtt.count() > GDT_INTERNAL_NETWORK_GOOD_RTT_LIMIT_MILLISECONDS)
+    {
+        // queues along the path are growing
+        connection.rate.congested(elapsedTime, connection.rtt);
+    }
+}
+
+void GDT::NetworkConnection::ackSentPackets(uint32_t ack, uint32_t bitfield, ConnectionData& connection)
+{
+    auto now = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i <= 32; ++i)
+    {
+        PacketInfo* sentPacket = connection.sentPackets.find(ack - i);
+        if(sentPacket == nullptr)
+        {
+            continue;
+        }
+
+        if(i == 0 || (bitfield & (0x80000000 >> (i - 1))) != 0x0)
+        {
+            if(!sentPacket->messages.empty())
+            {
+                ackMessages(*sentPacket, connection);
+            }
+            for(auto iter = sentPacket->trackingIds.begin(); iter != sentPacket->trackingIds.end(); ++iter)
+            {
+                ackedPackets.push_back(std::make_pair(handleOf(connection), *iter));
+            }
+            sentPacket->trackingIds.clear();
+            if(sentPacket->probeSize != 0)
+            {
+                concludeProbe(*sentPacket, connection, true);
+            }
+            if(sentPacket->isInFlight)
+            {
+                sentPacket->isInFlight = false;
+                connection.rate.acked(sentPacket->size, maxSendRate, connection.rtt);
+            }
+        }
+        else if(i >= GDT_INTERNAL_NETWORK_LOSS_REORDER_THRESHOLD)
+        {
+            // not received while packets sent well after it were, so it
+            // is not just reordered
+            if(!sentPacket->messages.empty())
+            {
+                lostMessages(*sentPacket, connection);
+            }
+            if(sentPacket->probeSize != 0)
+            {
+                concludeProbe(*sentPacket, connection, false);
+            }
+            if(sentPacket->isInFlight)
+            {
+                sentPacket->isInFlight = false;
+                connection.rate.lost(sentPacket->size, elapsedTime, connection.rtt);
+                ++connection.stats.lostDatagrams;
+            }
+        }
+        else if((!sentPacket->messages.empty() || sentPacket->probeSize != 0)
+            && std::chrono::duration_cast<std::chrono::milliseconds>(now - sentPacket->sentTime)
+                >= connection.rttEstimator.retransmitTimeout())
+        {
+            if(!sentPacket->messages.empty())
+            {
+                lostMessages(*sentPacket, connection);
+            }
+            if(sentPacket->probeSize != 0)
+            {
+                concludeProbe(*sentPacket, connection, false);
+            }
+        }
+    }
+}
+
+GDT::Internal::Network::PacketInfo& GDT::NetworkConnection::insertSentPacket(ConnectionData& connection, uint32_t sequenceID)
+{
+    // the packet replaced in the ring was never acked
+    PacketInfo* replaced = connection.sentPackets.find(sequenceID - GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE);
+    if(replaced != nullptr && !replaced->messages.empty())
+    {
+        lostMessages(*replaced, connection);
+    }
+    if(replaced != nullptr && replaced->probeSize != 0)
+    {
+        concludeProbe(*replaced, connection, false);
+    }
+    if(replaced != nullptr && replaced->isInFlight)
+    {
+        ++connection.stats.lostDatagrams;
+        float previousRate = connection.rate.sendRate;
+        connection.rate.lost(replaced->size, elapsedTime, connection.rtt);
+        pacer.rate += connection.rate.sendRate - previousRate;
+    }
+    return connection.sentPackets.insert(sequenceID);
+}
+
+uint32_t GDT::NetworkConnection::generateID()
+{
+    uint32_t id;
+    do
+    {
+        id = dist(rd)
+            & ~(GDT::Internal::Network::CONNECT
+                | GDT::Internal::Network::PING
+                | GDT::Internal::Network::NO_REC_CHK
+                | GDT::Internal::Network::RESENDING
+                | GDT::Internal::Network::COALESCED
+                | GDT::Internal::Network::CHANNELED);
+    } while (std::any_of(connections.begin(), connections.end(),
+        [id] (const ConnectionData& connection) {
+            return connection.isConnected && connection.id == id;
+        }));
+
+    return id;
+}
+
+void GDT::NetworkConnection::preparePacket(char* header, uint32_t& sequenceID, ConnectionData& connection, bool isPing, bool isResending, bool isNotCheckReceivedPkt, bool isCoalesced, bool isChanneled)
+{
+    uint32_t id = connection.id;
+
+    sequenceID = (connection.lSequence)++;
+
+    uint32_t ack = connection.rSequence;
+
+    uint32_t ackBitfield = connection.ackBitfield;
+
+    if(isNotCheckReceivedPkt)
+    {
+        id |= GDT::Internal::Network::NO_REC_CHK
+            | (isCoalesced ? GDT::Internal::Network::COALESCED :
+                GDT::Internal::Network::NONE);
+    }
+    else if(isPing)
+    {
+        id |= GDT::Internal::Network::PING;
+    }
+    else
+    {
+        id |= (isResending ? GDT::Internal::Network::RESENDING :
+                GDT::Internal::Network::NONE)
+            | (isCoalesced ? GDT::Internal::Network::COALESCED :
+                GDT::Internal::Network::NONE)
+            | (isChanneled ? GDT::Internal::Network::CHANNELED :
+                GDT::Internal::Network::NONE);
+    }
+
+    uint32_t tempValue = htonl(GDT_INTERNAL_NETWORK_PROTOCOL_ID);
+    std::memcpy(header, &tempValue, 4);
+    tempValue = htonl(id);
+    std::memcpy(header + 4, &tempValue, 4);
+    tempValue = htonl(sequenceID);
+    std::memcpy(header + 8, &tempValue, 4);
+    tempValue = htonl(ack);
+    std::memcpy(header + 12, &tempValue, 4);
+    tempValue = htonl(ackBitfield);
+    std::memcpy(header + 16, &tempValue, 4);
+}
+
+bool GDT::NetworkConnection::stagePacket(ConnectionData& connection)
+{
+    const uint32_t address = connection.address;
+    if(canSendQueued(connection))
+    {
+        if(nextIsMessage(connection))
+        {
+            connection.preferMessages = false;
+            stageMessages(connection);
+            return true;
+        }
+        connection.preferMessages = true;
+
+        // count the queued packets that fit in one datagram
+        const PacketInfo& first = connection.sendPacketQueue.back();
+        unsigned int count = 1;
+        std::size_t size = 20 + 2 + first.data.size();
+        const unsigned int maxSize = datagramSizeOf(connection);
+        if(coalescePackets && !first.isResending && first.data.size() <= 0xFFFF)
+        {
+            for(auto iter = std::next(connection.sendPacketQueue.rbegin());
+                iter != connection.sendPacketQueue.rend()
+                    && !iter->isResending
+                    && iter->isNotReceivedChecked == first.isNotReceivedChecked
+                    && iter->data.size() <= 0xFFFF
+                    && size + 2 + iter->data.size() <= maxSize;
+                ++iter)
+            {
+                size += 2 + iter->data.size();
+                ++count;
+            }
+        }
+
+        uint32_t sequenceID;
+        if(count > 1)
+        {
+            bool isNotReceivedChecked = first.isNotReceivedChecked;
+
+            // write the header directly into the batch, then each packet
+            // prefixed with its length
+            char* staged = sendBatch.stage(size,
+                address,
+                connection.port,
+                isNotReceivedChecked ? SendBatch::NOT_CHECKED : SendBatch::CHECKED,
+                true);
+            preparePacket(staged, sequenceID, connection, false, false, isNotReceivedChecked, true, false);
+
+            PacketInfo& sentPacket = insertSentPacket(connection, sequenceID);
+            sentPacket.address = address;
+            sentPacket.isNotReceivedChecked = isNotReceivedChecked;
+            sentPacket.isCoalesced = true;
+            staged += 20;
+
+            for(unsigned int i = 0; i < count; ++i)
+            {
+                const PacketInfo& pInfo = connection.sendPacketQueue.back();
+                uint16_t length = htons(pInfo.data.size());
+                std::memcpy(staged, &length, 2);
+                if(!pInfo.data.empty())
+                {
+                    std::memcpy(staged + 2, pInfo.data.data(), pInfo.data.size());
+                }
+                staged += 2 + pInfo.data.size();
+                sentPacket.trackingIds.insert(sentPacket.trackingIds.end(),
+                    pInfo.trackingIds.begin(), pInfo.trackingIds.end());
+                connection.sendPacketQueue.pop_back();
+            }
+
+            if(!isNotReceivedChecked)
+            {
+                // keep the coalesced data in case it needs to be resent
+                sentPacket.data.assign(staged - (size - 20), staged);
+            }
+        }
+        else
+        {
+            PacketInfo& pInfo = connection.sendPacketQueue.back();
+
+            // write the header directly into the batch, the packet's data is
+            // moved along and sent from where it ends up without copying
+            char* staged = sendBatch.stage(20,
+                address,
+                connection.port,
+                pInfo.isNotReceivedChecked ? SendBatch::NOT_CHECKED : SendBatch::CHECKED,
+                pInfo.isCoalesced);
+            preparePacket(staged, sequenceID, connection, false, pInfo.isResending, pInfo.isNotReceivedChecked, pInfo.isCoalesced, false);
+
+            PacketInfo& sentPacket = insertSentPacket(connection, sequenceID);
+            sentPacket.address = address;
+            sentPacket.isNotReceivedChecked = pInfo.isNotReceivedChecked;
+            sentPacket.isCoalesced = pInfo.isCoalesced;
+            sentPacket.trackingIds.swap(pInfo.trackingIds);
+            if(!pInfo.isNotReceivedChecked)
+            {
+                // keep the data in case it needs to be resent
+                sentPacket.data = std::move(pInfo.data);
+                sendBatch.attach(sentPacket.data.data(), sentPacket.data.size());
+            }
+            else
+            {
+                sendBatch.hold(std::move(pInfo.data));
+            }
+            connection.sendPacketQueue.pop_back();
+        }
+        sendBatch.entries.back().sequenceID = sequenceID;
+        return true;
+    }
+    else
+    {
+        auto duration = std::chrono::steady_clock::now() - connection.timeSinceLastSent;
+        if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() < GDT_INTERNAL_NETWORK_HEARTBEAT_SEND_INTERVAL_MILLISECONDS)
+        {
+            return false;
+        }
+        // send a heartbeat(empty) packet because the queue is empty or
+        // waiting for the congestion window
+
+        uint32_t sequenceID;
+        char* staged = sendBatch.stage(20, address, connection.port, SendBatch::HEARTBEAT);
+        preparePacket(staged, sequenceID, connection, false, false, true, false, false);
+        sendBatch.entries.back().sequenceID = sequenceID;
+
+        PacketInfo& sentPacket = insertSentPacket(connection, sequenceID);
+        sentPacket.address = address;
+        sentPacket.isNotReceivedChecked = true;
+    }
+    return false;
+}
+
+void GDT::NetworkConnection::stageMessages(ConnectionData& connection)
+{
+    // the datagram is stored first, as replacing an older one in the ring
+    // may queue its messages again
+    uint32_t sequenceID = connection.lSequence;
+    PacketInfo& sentPacket = insertSentPacket(connection, sequenceID);
+    sentPacket.address = connection.address;
+    // messages are resent by themselves when lost, not with this datagram
+    sentPacket.isNotReceivedChecked = true;
+
+    // count the queued messages that fit in one datagram, keys of acked
+    // messages are counted to be dropped too
+    std::size_t size = 20;
+    unsigned int count = 0;
+    bool isResending = false;
+    const unsigned int maxSize = datagramSizeOf(connection);
+    for(auto iter = connection.messageQueue.begin(); iter != connection.messageQueue.end(); ++iter, ++count)
+    {
+        const GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[(*iter >> 16) - 1];
+        uint16_t sequence = *iter & 0xFFFF;
+        if(!messageChannel.isUnacked(sequence))
+        {
+            continue;
+        }
+
+        uint32_t slot = messageChannel.slotOf(sequence);
+        std::size_t messageSize = GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE + messageChannel.sent[slot].size();
+        if(size > 20 && size + messageSize > maxSize)
+        {
+            break;
+        }
+        size += messageSize;
+        isResending = isResending || messageChannel.wasSent[slot];
+    }
+
+    char* staged = sendBatch.stage(size, connection.address, connection.port, SendBatch::CHECKED);
+    preparePacket(staged, sequenceID, connection, false, isResending, false, false, true);
+    sendBatch.entries.back().sequenceID = sequenceID;
+    staged += 20;
+
+    // each message is prefixed with its channel, sequence and length
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        uint32_t key = connection.messageQueue.front();
+        connection.messageQueue.pop_front();
+        GDT::Internal::Network::MessageChannel& messageChannel = connection.channels[(key >> 16) - 1];
+        uint16_t sequence = key & 0xFFFF;
+        if(!messageChannel.isUnacked(sequence))
+        {
+            continue;
+        }
+
+        uint32_t slot = messageChannel.slotOf(sequence);
+        const std::vector<char>& data = messageChannel.sent[slot];
+        staged[0] = (char)((key >> 16)
+            | (messageChannel.isSentFragment[slot] ? GDT_INTERNAL_NETWORK_MESSAGE_FRAGMENT_FLAG : 0));
+        uint16_t temp = htons(sequence);
+        std::memcpy(staged + 1, &temp, 2);
+        temp = htons(data.size());
+        std::memcpy(staged + 3, &temp, 2);
+        if(!data.empty())
+        {
+            std::memcpy(staged + GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE, data.data(), data.size());
+        }
+        staged += GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE + data.size();
+
+        messageChannel.isQueued[slot] = false;
+        messageChannel.wasSent[slot] = true;
+        sentPacket.messages.push_back(key);
+    }
+}
+
+void GDT::NetworkConnection::stageProbe(ConnectionData& connection)
+{
+    uint32_t size = connection.pathMtu.nextProbe();
+    if(size == 0)
+    {
+        return;
+    }
+
+    // a datagram of messages ending right away, padded with zeros
+    uint32_t sequenceID;
+    char* staged = sendBatch.stage(size, connection.address, connection.port, SendBatch::PROBE);
+    preparePacket(staged, sequenceID, connection, false, false, false, false, true);
+    std::memset(staged + 20, 0, size - 20);
+    sendBatch.entries.back().sequenceID = sequenceID;
+
+    PacketInfo& sentPacket = insertSentPacket(connection, sequenceID);
+    sentPacket.address = connection.address;
+    sentPacket.isNotReceivedChecked = true;
+    sentPacket.probeSize = size;
+    connection.pathMtu.sent(size);
+}
+
+uint32_t GDT::NetworkConnection::datagramSizeOf(const ConnectionData& connection) const
+{
+    return isProbingPathMtu ? connection.pathMtu.datagramSize(maxDatagramSize) : (uint32_t)maxDatagramSize;
+}
+
+void GDT::NetworkConnection::concludeProbe(PacketInfo& sentPacket, ConnectionData& connection, bool isAcked)
+{
+    if(isAcked)
+    {
+        connection.pathMtu.acked(sentPacket.probeSize);
+    }
+    else
+    {
+        connection.pathMtu.lost(sentPacket.probeSize);
+    }
+#ifndef NDEBUG
+    std::cout << "Path MTU probe of " << sentPacket.probeSize << " bytes "
+        << (isAcked ? "acked" : "lost") << '\n';
+#endif
+    sentPacket.probeSize = 0;
+}
+
+void GDT::NetworkConnection::flushSendBatch()
+{
+    if(sendBatch.entries.empty())
+    {
+        return;
+    }
+
+    sendBatch.prepare();
+
+    if(impairment.isActive())
+    {
+        impairSendBatch();
+    }
+    else
+    {
+        transport->send(sendBatch, socketCounters);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    // the datagrams of a batch are handed to the socket back to back, so
+    // only the first is apart from the previous batch
+    uint64_t shortGap = pacer.gap() * 500000.0;
+    uint64_t gap = lastSendTime == std::chrono::steady_clock::time_point() ? 0
+        : std::chrono::duration_cast<std::chrono::microseconds>(now - lastSendTime).count();
+    socketCounters.sendGaps += sendBatch.entries.size();
+    socketCounters.sendGapMicroseconds += gap;
+    socketCounters.shortSendGaps += (gap < shortGap ? 1 : 0) + sendBatch.entries.size() - 1;
+    lastSendTime = now;
+
+    for(unsigned int i = 0; i < sendBatch.entries.size(); ++i)
+    {
+        const SendBatch::Entry& entry = sendBatch.entries[i];
+        if(entry.sentBytes < 0 || (unsigned long int)entry.sentBytes != sendBatch.sizeOf(i))
+        {
+            if(entry.kind == SendBatch::CONNECT)
+            {
+                std::cerr << "ERROR: Failed to send initiate connection packet to server!" << std::endl;
+            }
+            else if(entry.kind == SendBatch::HEARTBEAT)
+            {
+                std::cerr << "Failed to send heartbeat packet to "
+                    << (mode == SERVER ? "client!" : "server!") << std::endl;
+            }
+            else if(entry.kind != SendBatch::PROBE)
+            {
+                std::cerr << "Failed to send packet to "
+                    << (mode == SERVER ? "client!" : "server!") << std::endl;
+            }
+            // probes larger than the MTU of the interface fail here, and keep
+            // no sent time so they are found lost on the next ack
+            continue;
+        }
+        else if(entry.kind == SendBatch::CONNECT)
+        {
+            continue;
+        }
+
+        ConnectionData* connection = findConnection(entry.address, entry.port);
+        if(connection == nullptr)
+        {
+            continue;
+        }
+        ++connection->stats.sentDatagrams;
+        connection->stats.sentBytes += entry.sentBytes;
 
-    for(auto iter = connectionData.begin(); iter != connectionData.end(); ++iter)
-    {
-        connectedList.push_back(iter->first);
+        // packets that failed to send keep no sent time, so checked ones are
+        // resent as soon as they are found to not be received
+        PacketInfo* sentPacket = connection->sentPackets.find(entry.sequenceID);
+        if(sentPacket != nullptr)
+        {
+            sentPacket->sentTime = now;
+            if(entry.kind != SendBatch::HEARTBEAT && entry.kind != SendBatch::PROBE)
+            {
+                sentPacket->size = entry.sentBytes;
+                sentPacket->isInFlight = true;
+                connection->rate.bytesInFlight += entry.sentBytes;
+            }
+        }
+        connection->timeSinceLastSent = now;
     }
 
-    return connectedList;
+    sendBatch.clear();
 }
 
-unsigned int GDT::NetworkConnection::getPacketQueueSize(uint32_t destinationAddress)
+void GDT::NetworkConnection::impairSendBatch()
 {
-    auto connectionDataIter = connectionData.find(destinationAddress);
-    if(connectionDataIter == connectionData.end())
+    // every datagram counts as sent, whatever the simulator does with it
+    for(unsigned int i = 0; i < sendBatch.entries.size(); ++i)
     {
-        return 0;
+        SendBatch::Entry& entry = sendBatch.entries[i];
+        impairment.send(sendBatch.at(i), entry.size, entry.payload, entry.payloadSize, entry.address, entry.port, elapsedTime);
+        entry.sentBytes = sendBatch.sizeOf(i);
     }
-
-    return connectionDataIter->second.sendPacketQueue.size();
+    releaseImpaired();
 }
 
-void GDT::NetworkConnection::clearPacketQueue(uint32_t destinationAddress)
+void GDT::NetworkConnection::releaseImpaired()
 {
-    auto connectionDataIter = connectionData.find(destinationAddress);
-    if(connectionDataIter == connectionData.end())
+    GDT::Internal::Network::ImpairmentSimulator::Datagram datagram;
+    while(impairment.pop(elapsedTime, datagram))
     {
-        return;
+        transport->send(datagram.data.data(), datagram.data.size(), datagram.address, datagram.port, socketCounters);
     }
-
-    connectionDataIter->second.sendPacketQueue.clear();
 }
 
-bool GDT::NetworkConnection::connectionIsGood()
+void GDT::NetworkConnection::receivePackets()
 {
-    auto connectionDataIter = connectionData.begin();
-    if(connectionDataIter == connectionData.end())
+    GDT::Internal::Network::DatagramBuffers& buffers = receiveBuffers;
+
+    // read until the transport has nothing pending or the budget is spent
+    unsigned int received = 0;
+    unsigned int errors = 0;
+    const unsigned int budget = maxReceivedPerUpdate;
+    while(budget == 0 || received < budget)
     {
-        return false;
-    }
+        unsigned int count = buffers.count;
+        if(budget != 0 && budget - received < count)
+        {
+            count = budget - received;
+        }
 
-    return connectionDataIter->second.isGood;
-}
+        int result = transport->receive(buffers, count, socketCounters);
+        if(result == 0)
+        {
+            break;
+        }
+        else if(result < 0)
+        {
+            // errors (i.e. ICMP port unreachable) only concern one datagram,
+            // keep reading unless they keep coming
+            if(++errors >= GDT_INTERNAL_NETWORK_MAX_RECEIVE_ERRORS)
+            {
+                break;
+            }
+            ++received;
+            continue;
+        }
+        errors = 0;
 
-bool GDT::NetworkConnection::connectionIsGood(uint32_t destinationAddress)
-{
-    auto connectionDataIter = connectionData.find(destinationAddress);
-    if(connectionDataIter == connectionData.end())
-    {
-        return false;
-    }
+        for(int i = 0; i < result; ++i)
+        {
+            receivedDatagram(buffers.at(i),
+                buffers.sizes[i],
+                ntohl(buffers.addresses[i].sin_addr.s_addr),
+                ntohs(buffers.addresses[i].sin_port));
 
-    return connectionDataIter->second.isGood;
-}
+            // the callbacks may have reset this connection
+            if(!validState)
+            {
+                return;
+            }
+        }
+        received += result;
 
-void GDT::NetworkConnection::reset(NetworkConnection::Mode mode, unsigned short serverPort, unsigned short clientPort, bool clientBroadcast)
-{
-    this->mode = mode;
-    this->serverPort = serverPort;
-    this->clientPort = clientPort;
-#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
-    if(validState) close(socketHandle);
-#else
-    if(validState) closesocket(socketHandle);
-#endif
-    connectionData.clear();
-    clientSentAddressSet = false;
-    initialized = false;
-    validState = false;
-    invalidNoticeTimer = INVALID_NOTICE_TIME;
-    clientRetryTimer = GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS;
-    this->clientBroadcast = clientBroadcast;
+        // a partial batch means the transport has been drained
+        if((unsigned int)result < count)
+        {
+            break;
+        }
+    }
 }
 
-void GDT::NetworkConnection::setClientBroadcast(bool clientWillBroadcast)
+void GDT::NetworkConnection::receivedDatagram(const char* data, int bytes, uint32_t address, uint16_t port)
 {
-    clientBroadcast = clientWillBroadcast;
-}
+    if(bytes < 20)
+        return;
 
-void GDT::NetworkConnection::registerConnection(uint32_t address, uint32_t ID, unsigned short port)
-{
+    uint32_t* tempPtr = (uint32_t*)data;
+    uint32_t protocolID = ntohl(*tempPtr);
+
+    // check protocol ID
+    if(protocolID != GDT_INTERNAL_NETWORK_PROTOCOL_ID)
+        return;
+
+    tempPtr = (uint32_t*)(data + 4);
+    uint32_t ID = ntohl(*tempPtr);
+    tempPtr = (uint32_t*)(data + 8);
+    uint32_t sequence = ntohl(*tempPtr);
+    tempPtr = (uint32_t*)(data + 12);
+    uint32_t ack = ntohl(*tempPtr);
+    tempPtr = (uint32_t*)(data + 16);
+    uint32_t ackBitfield = ntohl(*tempPtr);
+
+    bool isConnect = (ID & GDT::Internal::Network::CONNECT) != 0;
+    bool isPing = (ID & GDT::Internal::Network::PING) != 0;
+    bool isNotReceivedChecked = (ID & GDT::Internal::Network::NO_REC_CHK) != 0;
+    bool isResent = (ID & GDT::Internal::Network::RESENDING) != 0;
+    bool isCoalesced = (ID & GDT::Internal::Network::COALESCED) != 0;
+    bool isChanneled = (ID & GDT::Internal::Network::CHANNELED) != 0;
+
+    ID = ID & GDT_INTERNAL_NETWORK_ID_MASK;
+
+    ConnectionData* connection = nullptr;
+    bool isEstablishing = false;
     if(mode == SERVER)
     {
-        connectionData.insert(std::make_pair(address, ConnectionData(generateID(), 0, port)));
+        connection = findConnection(address, port);
+        if(isConnect && acceptNewConnections)
+        {
+            if(connection == nullptr)
+            {
+#ifndef NDEBUG
+                std::cout << "SERVER: Establishing new connection with " << GDT::Internal::Network::addressToString(address) << ':' << port << '\n';
+#endif
+                // Establish connection
+                registerConnection(address, 0, port);
+            }
+            return;
+        }
+        else if(connection == nullptr)
+        {
+            // Unknown client not attemping to connect, ignoring
+            return;
+        }
+        else if(isPing)
+        {
+            requestSend(*connection);
+        }
+        else if(ID != connection->id)
+        {
+            // ID and endpoint doesn't match, ignoring
+            return;
+        }
     }
     else if(mode == CLIENT)
     {
-        connectionData.insert(std::make_pair(address, ConnectionData(ID, 1, port)));
-    }
+        uint32_t& serverAddress = clientSentAddress;
+        if(port != serverPort)
+            return;
 
-    connectionMade(address);
-}
+        connection = findConnection(serverAddress, serverPort);
+        if(connection == nullptr)
+        {
+            // connection not yet established
+            if(!acceptNewConnections
+                || (!clientBroadcast && address != serverAddress))
+                return;
+#ifndef NDEBUG
+            std::cout << "." << std::flush;
+#endif
+            if(clientBroadcast)
+            {
+                clientSentAddress = address;
+                clientSentAddressSet = true;
+            }
+            registerConnection(address, ID, serverPort);
 
-void GDT::NetworkConnection::unregisterConnection(uint32_t address)
-{
-    if(connectionData.erase(address) != 0)
-    {
-        connectionLost(address);
+            // the first sequence counts as received from the start, so the
+            // data of the datagram establishing the connection is delivered
+            // here as it is already acked
+            connection = findConnection(serverAddress, serverPort);
+            if(connection == nullptr || sequence != connection->rSequence || bytes == 20)
+            {
+                return;
+            }
+            isEstablishing = true;
+        }
+        else if(address != serverAddress)
+        {
+            return;
+        }
+        else if(isPing)
+        {
+            requestSend(*connection);
+        }
+        else if(ID != connection->id
+                || isConnect)
+        {
+            return;
+        }
     }
     else
     {
-        std::cerr << "WARNING: unregisterConnection called with no matching connection!" << std::endl;
+        return;
     }
-}
 
-void GDT::NetworkConnection::shiftBitfield(uint32_t address, uint32_t diff)
-{
-    connectionData.at(address).ackBitfield = (connectionData.at(address).ackBitfield >> diff) | 0x80000000;
-}
+    // packet is valid
+#ifndef NDEBUG
+    std::cout << "Valid packet " << sequence << " received from " << GDT::Internal::Network::addressToString(address) << std::endl;
+#endif
 
-void GDT::NetworkConnection::checkSentPackets(uint32_t ack, uint32_t bitfield, uint32_t address)
-{
-    if(!resendTimedOutPackets)
-        return;
+    bool outOfOrder = false;
+    ++connection->stats.receivedDatagrams;
+    connection->stats.receivedBytes += bytes;
 
-    --ack;
-    for(; bitfield != 0x0; bitfield = bitfield << 1)
+    float previousRate = connection->rate.sendRate;
+    lookupRtt(*connection, ack);
+    ackSentPackets(ack, ackBitfield, *connection);
+    pacer.rate += connection->rate.sendRate - previousRate;
+
+    connection->timeSinceLastReceived = std::chrono::steady_clock::now();
+    checkSentPackets(ack, ackBitfield, *connection);
+
+    uint32_t diff = 0;
+    if(isEstablishing)
     {
-        // if received, don't bother checking
-        if((0x80000000 & bitfield) != 0x0)
+        // already counted as received
+    }
+    else if(sequence > connection->rSequence)
+    {
+        diff = sequence - connection->rSequence;
+        if(diff <= 0x7FFFFFFF)
         {
-            --ack;
-            continue;
+            // sequence is more recent
+            connection->rSequence = sequence;
+            shiftBitfield(*connection, diff);
         }
-
-        // not received by client yet, checking if packet timed out
-        for(auto iter = connectionData.at(address).sentPackets.begin(); iter != connectionData.at(address).sentPackets.end(); ++iter)
+        else
         {
-            if(iter->id == ack)
+            // sequence is older packet id, diff requires recalc
+            diff = 0xFFFFFFFF - sequence + connection->rSequence + 1;
+
+            if((connection->ackBitfield & (0x100000000 >> diff)) != 0x0)
             {
-                if(iter->isNotReceivedChecked || iter->hasBeenReSent)
-                {
-                    // skip packets that intentionally are not checked or have
-                    // already been re-sent
-                    break;
-                }
-                // timed out, adding to send queue
-                auto duration = std::chrono::steady_clock::now() - iter->sentTime;
-                if(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() >= GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS)
-                {
-#ifndef NDEBUG
-                    std::cout << "Packet " << ack << "(" << std::hex << std::showbase << ack << std::dec;
-                    std::cout << ") timed out\n";
-#endif
-                    std::vector<char> data = iter->data;
-                    data.erase(data.begin(), data.begin() + 20);
-                    resendPacket(data, address);
-                    iter->hasBeenReSent = true;
-                }
-                break;
+                // already received packet
+                ++connection->stats.duplicateDatagrams;
+                return;
             }
-        }
+            ++connection->stats.outOfOrderDatagrams;
+            if(ignoreOutOfSequence && !isChanneled)
+            {
+                // not acked, as the sender may take an ack to mean it was
+                // delivered (i.e. tracked packets)
+                return;
+            }
+            connection->ackBitfield |= (0x100000000 >> diff);
 
-        --ack;
+            outOfOrder = true;
+        }
     }
-}
-
-void GDT::NetworkConnection::lookupRtt(uint32_t address, uint32_t ack)
-{
-    for(auto iter = connectionData.at(address).sentPackets.begin(); iter != connectionData.at(address).sentPackets.end(); ++iter)
+    else if(connection->rSequence > sequence)
     {
-        if(iter->id == ack)
+        diff = connection->rSequence - sequence;
+        if(diff > 0x7FFFFFFF)
+        {
+            // sequence is more recent, diff requires recalc
+            diff = 0xFFFFFFFF - connection->rSequence + sequence + 1;
+
+            connection->rSequence = sequence;
+            shiftBitfield(*connection, diff);
+        }
+        else
         {
-            auto duration = std::chrono::steady_clock::now() - iter->sentTime;
-            if(duration > connectionData.at(address).rtt)
+            // sequence is older packet id
+            if((connection->ackBitfield & (0x100000000 >> diff)) != 0x0)
             {
-                connectionData.at(address).rtt += (std::chrono::duration_cast<std::chrono::milliseconds>(duration) - connectionData.at(address).rtt) / 10;
+                // already received packet
+                ++connection->stats.duplicateDatagrams;
+                return;
             }
-            else
+            ++connection->stats.outOfOrderDatagrams;
+            if(ignoreOutOfSequence && !isChanneled)
             {
-                connectionData.at(address).rtt -= (connectionData.at(address).rtt - std::chrono::duration_cast<std::chrono::milliseconds>(duration)) / 10;
+                // not acked, as the sender may take an ack to mean it was
+                // delivered (i.e. tracked packets)
+                return;
             }
+            connection->ackBitfield |= (0x100000000 >> diff);
+
+            outOfOrder = true;
+        }
+    }
+    else
+    {
+        // duplicate packet, ignoring
+        ++connection->stats.duplicateDatagrams;
+        return;
+    }
+
 #ifndef NDEBUG
-            std::cout << "(" << ack << ") RTT of " << GDT::Internal::Network::addressToString(address) << " = " << connectionData.at(address).rtt.count() << '\n';
+    if(outOfOrder)
+    {
+        std::cout << "Out of order packet\n";
+    }
 #endif
-            connectionData.at(address).isGoodRtt = connectionData.at(address).rtt.count() <= GDT_INTERNAL_NETWORK_GOOD_RTT_LIMIT_MILLISECONDS;
-            break;
+
+    // callbacks may reset this NetworkConnection, so connection is not used
+    // past this point
+    ConnectionHandle handle = handleOf(*connection);
+    if(isChanneled)
+    {
+        receivedMessages(data + 20, bytes - 20, address, handle, isResent);
+    }
+    else if(isCoalesced)
+    {
+        // split into the packets that were coalesced, each prefixed by its
+        // length
+        const char* packet = data + 20;
+        const char* end = data + bytes;
+        while(end - packet >= 2 && validState)
+        {
+            uint16_t length;
+            std::memcpy(&length, packet, 2);
+            length = ntohs(length);
+            packet += 2;
+            if(end - packet < length)
+            {
+                std::cerr << "WARNING: Received malformed coalesced packet!" << std::endl;
+                return;
+            }
+            receivedPacket(packet, length, address, handle, outOfOrder, isResent, isNotReceivedChecked);
+            packet += length;
         }
     }
-}
-
-void GDT::NetworkConnection::checkSentPacketsSize(uint32_t address)
-{
-    while(connectionData.at(address).sentPackets.size() > GDT_INTERNAL_NETWORK_SENT_PACKET_LIST_MAX_SIZE)
+    else
     {
-        connectionData.at(address).sentPackets.pop_back();
+        receivedPacket(data + 20, bytes - 20, address, handle, outOfOrder, isResent, isNotReceivedChecked);
     }
 }
 
-uint32_t GDT::NetworkConnection::generateID()
+void GDT::NetworkConnection::receivedPacket(const char* data, uint32_t count, uint32_t address, ConnectionHandle connection, bool outOfOrder, bool isResent, bool isNoIncSeq)
 {
-    uint32_t id;
-    do
+    if(threaded)
     {
-        id = dist(rd)
-            & ~(GDT::Internal::Network::CONNECT
-                | GDT::Internal::Network::PING
-                | GDT::Internal::Network::NO_REC_CHK
-                | GDT::Internal::Network::RESENDING);
-    } while (connectionData.find(id) != connectionData.end());
+        if(count > 0)
+        {
+            ConnectionEvent event;
+            event.type = ConnectionEvent::RECEIVED;
+            event.data.assign(data, data + count);
+            event.address = address;
+            event.connection = connection;
+            event.outOfOrder = outOfOrder;
+            event.isResent = isResent;
+            event.isReceivedChecked = !isNoIncSeq;
+            pushEvent(std::move(event));
+        }
+        return;
+    }
 
-    return id;
+    if(receivedCallback && count > 0)
+    {
+        receivedCallback(data, count, address, outOfOrder, isResent, !isNoIncSeq);
+    }
+    if(handleReceivedCallback && count > 0)
+    {
+        handleReceivedCallback(data, count, connection, outOfOrder, isResent, !isNoIncSeq);
+    }
 }
 
-void GDT::NetworkConnection::preparePacket(std::vector<char>& packetData, uint32_t& sequenceID, uint32_t address, bool isPing, bool isResending, bool isNotCheckReceivedPkt)
+void GDT::NetworkConnection::receivedMessages(const char* data, uint32_t count, uint32_t address, ConnectionHandle connection, bool isResent)
 {
-    assert(packetData.empty());
-
-    auto iter = connectionData.find(address);
-    assert(iter != connectionData.end());
-
-    uint32_t id = iter->second.id;
+    const char* message = data;
+    const char* end = data + count;
+    while(end - message >= GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE && validState)
+    {
+        if(message[0] == 0)
+        {
+            // the rest is padding of a path MTU probe
+            return;
+        }
+        bool isFragment = (message[0] & GDT_INTERNAL_NETWORK_MESSAGE_FRAGMENT_FLAG) != 0;
+        uint8_t channel = message[0] & ~GDT_INTERNAL_NETWORK_MESSAGE_FRAGMENT_FLAG;
+        uint16_t sequence;
+        std::memcpy(&sequence, message + 1, 2);
+        sequence = ntohs(sequence);
+        uint16_t length;
+        std::memcpy(&length, message + 3, 2);
+        length = ntohs(length);
+        message += GDT_INTERNAL_NETWORK_MESSAGE_HEADER_SIZE;
+        if(end - message < length || channel < RELIABLE_UNORDERED || channel > RELIABLE_ORDERED)
+        {
+            std::cerr << "WARNING: Received malformed message datagram!" << std::endl;
+            return;
+        }
 
-    sequenceID = (iter->second.lSequence)++;
+        // callbacks may reset this NetworkConnection, so the connection is
+        // looked up again for every message
+        ConnectionData* connectionData = findConnection(connection);
+        if(connectionData == nullptr)
+        {
+            return;
+        }
+        GDT::Internal::Network::MessageChannel& messageChannel = connectionData->channels[channel - 1];
+        bool isOrdered = channel == RELIABLE_ORDERED;
+        bool outOfOrder = !isOrdered && sequence != messageChannel.nextReceived;
+        if(messageChannel.receive(sequence, message, length, isOrdered, isFragment) == GDT::Internal::Network::MessageChannel::DELIVERED)
+        {
+            deliverMessage(message, length, channel, sequence, isFragment, address, connection, outOfOrder, isResent);
 
-    uint32_t ack = iter->second.rSequence;
+            // deliver the messages that were waiting for this one
+            while(isOrdered && validState
+                && (connectionData = findConnection(connection)) != nullptr
+                && connectionData->channels[channel - 1].popReceived(deliveredMessage, isFragment, sequence))
+            {
+                deliverMessage(deliveredMessage.data(), deliveredMessage.size(), channel, sequence, isFragment, address, connection, false, false);
+            }
+        }
+        message += length;
+    }
+}
 
-    uint32_t ackBitfield = iter->second.ackBitfield;
+void GDT::NetworkConnection::deliverMessage(const char* data, uint32_t count, uint8_t channel, uint16_t sequence, bool isFragment, uint32_t address, ConnectionHandle connection, bool outOfOrder, bool isResent)
+{
+    if(!isFragment)
+    {
+        receivedPacket(data, count, address, connection, outOfOrder, isResent, false);
+        return;
+    }
 
-    char data[20];
-    if(isNotCheckReceivedPkt)
+    ConnectionData* connectionData = findConnection(connection);
+    if(connectionData != nullptr
+        && connectionData->channels[channel - 1].reassemble(sequence, data, count, reassembledMessage))
     {
-        uint32_t tempValue = htonl(GDT_INTERNAL_NETWORK_PROTOCOL_ID);
-        std::memcpy(data, &tempValue, 4);
-        tempValue = htonl(id | GDT::Internal::Network::NO_REC_CHK);
-        std::memcpy(data + 4, &tempValue, 4);
-        tempValue = htonl(sequenceID);
-        std::memcpy(data + 8, &tempValue, 4);
-        tempValue = htonl(ack);
-        std::memcpy(data + 12, &tempValue, 4);
-        tempValue = htonl(ackBitfield);
-        std::memcpy(data + 16, &tempValue, 4);
+        receivedPacket(reassembledMessage.data(), reassembledMessage.size(), address, connection, outOfOrder, isResent, false);
     }
-    else
+}
+
+void GDT::NetworkConnection::packetsAcked()
+{
+    // callbacks may reset this NetworkConnection or update it again, so they
+    // are called with a list of their own
+    std::vector<std::pair<ConnectionHandle, uint32_t> > reported;
+    reported.swap(ackedPackets);
+    for(auto iter = reported.begin(); iter != reported.end(); ++iter)
     {
-        if(isPing)
+        if(threaded)
         {
-            uint32_t tempValue = htonl(GDT_INTERNAL_NETWORK_PROTOCOL_ID);
-            std::memcpy(data, &tempValue, 4);
-            tempValue = htonl(id | GDT::Internal::Network::PING);
-            std::memcpy(data + 4, &tempValue, 4);
-            tempValue = htonl(sequenceID);
-            std::memcpy(data + 8, &tempValue, 4);
-            tempValue = htonl(ack);
-            std::memcpy(data + 12, &tempValue, 4);
-            tempValue = htonl(ackBitfield);
-            std::memcpy(data + 16, &tempValue, 4);
+            ConnectionEvent event;
+            event.type = ConnectionEvent::ACKED;
+            event.connection = iter->first;
+            event.trackingId = iter->second;
+            pushEvent(std::move(event));
         }
-        else
+        else if(handleAckedCallback)
         {
-            uint32_t tempValue = htonl(GDT_INTERNAL_NETWORK_PROTOCOL_ID);
-            std::memcpy(data, &tempValue, 4);
-            tempValue = htonl(id
-                | (isResending ? GDT::Internal::Network::RESENDING :
-                    GDT::Internal::Network::NONE));
-            std::memcpy(data + 4, &tempValue, 4);
-            tempValue = htonl(sequenceID);
-            std::memcpy(data + 8, &tempValue, 4);
-            tempValue = htonl(ack);
-            std::memcpy(data + 12, &tempValue, 4);
-            tempValue = htonl(ackBitfield);
-            std::memcpy(data + 16, &tempValue, 4);
+            handleAckedCallback(iter->first, iter->second);
         }
     }
-    packetData.insert(packetData.end(), data, data + 20);
+    // keep the capacity
+    if(ackedPackets.empty())
+    {
+        reported.clear();
+        ackedPackets.swap(reported);
+    }
 }
 
-void GDT::NetworkConnection::receivedPacket(const char* data, uint32_t count, uint32_t address, bool outOfOrder, bool isResent, bool isNoIncSeq)
+void GDT::NetworkConnection::connectionMade(ConnectionData& connection)
 {
-    if(receivedCallback && count > 0)
+    // callbacks may reset this NetworkConnection, so connection is only read
+    // before calling them
+    uint32_t address = connection.address;
+    ConnectionHandle handle = handleOf(connection);
+    if(threaded)
     {
-        receivedCallback(data, count, address, outOfOrder, isResent, !isNoIncSeq);
+        ConnectionEvent event;
+        event.type = ConnectionEvent::CONNECTED;
+        event.address = address;
+        event.connection = handle;
+        pushEvent(std::move(event));
+        return;
     }
-}
 
-void GDT::NetworkConnection::connectionMade(uint32_t address)
-{
     if(connectedCallback)
     {
         connectedCallback(address);
     }
+    if(handleConnectedCallback)
+    {
+        handleConnectedCallback(handle);
+    }
 }
 
-void GDT::NetworkConnection::connectionLost(uint32_t address)
+void GDT::NetworkConnection::connectionLost(uint32_t address, ConnectionHandle connection)
 {
+    if(threaded)
+    {
+        ConnectionEvent event;
+        event.type = ConnectionEvent::DISCONNECTED;
+        event.address = address;
+        event.connection = connection;
+        pushEvent(std::move(event));
+        return;
+    }
+
     if(disconnectedCallback)
     {
         disconnectedCallback(address);
     }
+    if(handleDisconnectedCallback)
+    {
+        handleDisconnectedCallback(connection);
+    }
 }
 
 void GDT::NetworkConnection::initialize()
@@ -1159,73 +2578,39 @@ void GDT::NetworkConnection::initialize()
         return;
     }
 
-    // get socket handle (file descriptor)
-    socketHandle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if(socketHandle <= 0)
-    {
-        validState = false;
-#ifndef NDEBUG
-        std::cout << "ERROR: Failed to get socket!" << std::endl;
-#endif
-        return;
-    }
-
-    // set socket info
-    socketInfo.sin_family = AF_INET;
-    socketInfo.sin_addr.s_addr = INADDR_ANY;
-    if(mode == CLIENT)
+    if(nextTransport)
     {
-        socketInfo.sin_port = htons(clientPort);
+        transport = std::move(nextTransport);
     }
-    else
+    else if(!transport)
     {
-        socketInfo.sin_port = htons(serverPort);
+        transport.reset(new UdpTransport());
     }
 
-    // bind socketInfo to socket
-    if(bind(socketHandle, (const sockaddr*) &socketInfo, sizeof(sockaddr_in)) < 0)
+    isProbingPathMtu = false;
+    Transport::Options options;
+    options.broadcast = clientBroadcast;
+    options.reusePort = reusePort;
+    options.dontFragment = discoverPathMtu;
+    if(!transport->open(mode == CLIENT ? clientPort : serverPort, options))
     {
         validState = false;
-#ifndef NDEBUG
-        std::cout << "ERROR: Failed to bind socket!" << std::endl;
-#endif
         return;
     }
 
-    // set nonblocking
-#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
-    int nonblocking = 1;
-    if(fcntl(socketHandle, F_SETFL, O_NONBLOCK, nonblocking) == -1)
-    {
-        validState = false;
-#ifndef NDEBUG
-        std::cout << "ERROR: Failed to set socket non-blocking!" << std::endl;
-#endif
-        return;
-    }
-#else
-    DWORD nonblocking = 1;
-    if(ioctlsocket(socketHandle, FIONBIO, &nonblocking) != 0)
+    // probes only tell the path MTU if routers may not fragment them
+    isProbingPathMtu = discoverPathMtu && transport->isDontFragmentSet();
+    if(discoverPathMtu && !isProbingPathMtu)
     {
-        validState = false;
-#ifndef NDEBUG
-        std::cout << "ERROR: Failed to set socket non-blocking!" << std::endl;
-#endif
-        return;
+        std::clog << "Warning: Failed to set the don't fragment flag, not discovering path MTUs!" << std::endl;
     }
-#endif
 
-    if(clientBroadcast)
-    {
-        // set enable broadcast
-#if PLATFORM == PLATFORM_WINDOWS
-        char enabled = 1;
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    receiveBuffers.allocate(GDT_INTERNAL_NETWORK_RECEIVE_BATCH_SIZE,
+        GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE);
 #else
-        int enabled = 1;
+    receiveBuffers.allocate(1, GDT_INTERNAL_NETWORK_RECEIVED_MAX_SIZE);
 #endif
-        setsockopt(socketHandle, SOL_SOCKET, SO_BROADCAST, &enabled, sizeof(enabled));
-    }
 
     validState = true;
 }
-
@@ -4,15 +4,20 @@
 
 #define INVALID_NOTICE_TIME 5.0f
 
-#include <unordered_map>
 #include <cassert>
 #include <functional>
 #include <random>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
 
 #include <iostream>
 
 #include "Internal/NetworkIdentifiers.hpp"
+#include "Internal/SPSCQueue.hpp"
+#include "Transport.hpp"
 
 namespace GDT
 {
@@ -28,16 +33,38 @@ namespace GDT
     It is expected that NetworkConnection::update is called periodically from
     within a game loop with a deltaTime (time between calls to update).
 
+    Peers are identified by their IP address and port, so multiple clients
+    sharing an IP address (i.e. behind the same NAT) can connect to one
+    server. Functions taking only an IP address use the first connected peer
+    with that address; use the functions taking a ConnectionHandle to address
+    every peer.
+
     NetworkConnection maintains a queue of packets to send.
-    Packets are sent periodically with an interval between 1/30th of a second
-    and 1/10th of a second based on whether or not the connection is "good" or
-    has a low round-trip-time.
+    Messages sent with NetworkConnection::sendMessage go through reliable
+    channels instead, which resend them until they are acked and optionally
+    deliver them in order.
+    Packets are sent periodically at a rate adjusted for each connection by
+    how many sent packets are acked, lost or delayed (see
+    NetworkConnection::maxSendRate).
+
+    Datagrams are sent and received through a GDT::Transport, a UDP socket
+    unless another is set with NetworkConnection::setTransport.
+
+    Optionally, NetworkConnection::startThread moves all socket work to a
+    background thread so that acks, resends and received packets are handled
+    independently of the game loop's frame rate. Callbacks are still called
+    from NetworkConnection::update on the game thread.
 */
 class NetworkConnection
 {
 public:
     using PacketInfo = GDT::Internal::Network::PacketInfo;
     using ConnectionData = GDT::Internal::Network::ConnectionData;
+    using SocketCounters = GDT::Internal::Network::SocketCounters;
+    using ConnectionStats = GDT::Internal::Network::ConnectionStats;
+    using NetworkStats = GDT::Internal::Network::NetworkStats;
+    using Impairment = GDT::Internal::Network::Impairment;
+    using ConnectionHandle = GDT::Internal::Network::ConnectionHandle;
 
     /// An enum used for specifying whether or not a connection will run as
     /// "Client" or "Server".
@@ -47,6 +74,27 @@ public:
         CLIENT
     };
 
+    /// The channels a message can be sent on with NetworkConnection::sendMessage.
+    enum Channel
+    {
+        /// Sent once, like a packet that is not received checked.
+        UNRELIABLE,
+        /// Resent until acked, delivered once as soon as it is received.
+        RELIABLE_UNORDERED,
+        /// Resent until acked, delivered once and in the order it was sent.
+        RELIABLE_ORDERED
+    };
+
+    /// The formats of the lines passed to the stats sink (see
+    /// NetworkConnection::setStatsSink).
+    enum StatsFormat
+    {
+        /// Comma separated values, after a first line of column names.
+        STATS_CSV,
+        /// A JSON object per line.
+        STATS_JSON
+    };
+
     /// Initializes based on the given mode (Client or Server) and server port.
     /**
         \param mode The enum value specifying whether or not the connection will
@@ -75,15 +123,77 @@ public:
         Note that setting this to false will prevent a Client from trying to
         connect/reconnect to a server.
     */
-    bool acceptNewConnections;
+    std::atomic<bool> acceptNewConnections;
     /// If true, then any packets received out of order will be ignored.
     /**
         Ignored packets will not call the received packet callback specified by
-        NetworkConnection::setReceivedCallback.
+        NetworkConnection::setReceivedCallback, and are not acked.
     */
-    bool ignoreOutOfSequence;
+    std::atomic<bool> ignoreOutOfSequence;
     /// If true, then timed out packets will be resent when they have timed out.
-    bool resendTimedOutPackets;
+    /**
+        A checked packet times out once it is not acked within the smoothed
+        round-trip-time plus four times its variance (between 50 and 3000
+        milliseconds, 1000 before the round-trip-time is measured), or right
+        away when the peer acks 3 packets sent after it. Each packet is
+        resent at most once.
+    */
+    std::atomic<bool> resendTimedOutPackets;
+    /// The maximum number of datagrams read from the socket per call to
+    /// NetworkConnection::update.
+    /**
+        Every call to update reads received datagrams until the socket has no
+        more pending data or until this many datagrams have been read. Set to
+        0 to always read until the socket is drained. Reading also stops after
+        a few receive errors in a row, each of which counts as a datagram.
+    */
+    std::atomic<unsigned int> maxReceivedPerUpdate;
+    /// If true, then multiple queued packets are sent in one datagram.
+    /**
+        Every send interval, as many queued packets as fit in
+        NetworkConnection::maxDatagramSize are packed into one datagram, each
+        prefixed with its length. The receiving side calls the received packet
+        callback once for each packet. Packets are only coalesced with other
+        packets that have the same "isReceivedChecked" setting.
+
+        Both peers must use a version of NetworkConnection that understands
+        coalesced datagrams, but only the sending side needs this enabled.
+    */
+    std::atomic<bool> coalescePackets;
+    /// The maximum size in bytes of a datagram built by coalescing packets.
+    /**
+        This includes the 20 byte header but not the IP and UDP headers, so it
+        should be kept below the path MTU minus 28 bytes to avoid IP
+        fragmentation. Packets larger than this are split into fragments.
+        While the path MTU to a peer is discovered (see
+        NetworkConnection::setDiscoverPathMtu), the discovered size is used
+        instead once known.
+    */
+    std::atomic<unsigned int> maxDatagramSize;
+    /// The highest send rate of a connection in datagrams per second.
+    /**
+        Each connection starts at 30 datagrams per second. While its sent
+        packets are acked, the rate increases towards this limit, doubling
+        every round trip until it is first decreased and by about one
+        datagram per round trip after that. It is halved when packets are
+        lost or the round-trip-time exceeds 250 milliseconds. Bytes in flight are limited to what twice the rate sends
+        in one round trip; queued packets wait while the limit is reached.
+    */
+    std::atomic<float> maxSendRate;
+    /// If true, then datagrams are paced instead of sent in bursts.
+    /**
+        When many connections are due to send at the same time, only as many
+        datagrams as the summed send rates of all connections allow for the
+        time since the previous update are sent; the rest are sent on the
+        following ticks of NetworkConnection::waitAndUpdate or the network
+        thread (or the following updates). On Linux, the socket's
+        SO_MAX_PACING_RATE is also set to that rate, so that the fq queueing
+        discipline spaces out the datagrams sent together.
+
+        The achieved gaps between datagrams are counted in the socket counters
+        (see NetworkConnection::getSocketCounters).
+    */
+    std::atomic<bool> pacePackets;
 
     /// Checks for received packets and maintains the connection.
     /**
@@ -91,9 +201,62 @@ public:
         main loop where parameter "deltaTime" is the deltaTime between frames.
         \param deltaTime The deltaTime, or time between the previous call to
             update and now.
+
+        If the network thread is running (see NetworkConnection::startThread),
+        this only calls the callbacks for everything the thread received
+        since the last call and deltaTime is ignored.
     */
     void update(float deltaTime);
 
+    /// Waits until there is something to do, then updates.
+    /**
+        Blocks until a datagram is received or until the next packet send,
+        connection timeout or connection attempt is due, then calls
+        NetworkConnection::update with the time passed since the previous
+        call. This lets a dedicated server wake exactly when needed instead
+        of calling update in a busy loop. On Linux, epoll and a timerfd are
+        used to wait.
+
+        If the network thread is running, only calls update without waiting.
+
+        \param maxWait The longest time to wait in seconds. If negative,
+            waits until something needs to be done.
+        \return The deltaTime passed to update.
+    */
+    float waitAndUpdate(float maxWait = -1.0f);
+
+    /// Starts a thread that sends and receives packets every interval seconds.
+    /**
+        While the thread runs, it does everything NetworkConnection::update
+        would, while update only calls the callbacks (see update). The thread
+        also wakes as soon as a datagram is received. Packets
+        passed to sendPacket are handed to the thread through a lock-free
+        queue, as are received packets in the other direction. All other
+        functions may still be called from the game thread.
+
+        \return false if the thread is already running.
+    */
+    bool startThread(float interval = 1.0f / 120.0f);
+
+    /// Stops the network thread, and calls callbacks for what it received.
+    /**
+        Afterwards, NetworkConnection::update must be called periodically
+        again. Does nothing if the thread is not running.
+    */
+    void stopThread();
+
+    /// Returns true if the network thread is running.
+    bool isThreaded() const;
+
+    /// Returns true if the socket is open.
+    /**
+        The socket is opened by the first call to NetworkConnection::update
+        (or waitAndUpdate, or startThread) after construction or a reset. If
+        opening it fails, i.e. because the port is taken, this stays false
+        until the next reset.
+    */
+    bool isOpen() const;
+
     /// Tells the Client the IP address of the server to connect to.
     /**
         Once the Client knows the IP address of the server, it will
@@ -130,15 +293,29 @@ public:
     /// Adds to the queue of to-send-packets the given packetData to the given
     /// destination IP address.
     /**
+        Packets too large for one datagram (see
+        NetworkConnection::maxDatagramSize) are split into fragments sent
+        like RELIABLE_UNORDERED messages (see NetworkConnection::sendMessage),
+        so they are resent until received, whatever "isReceivedChecked" is,
+        and only the lost fragments are resent. The receiver puts the
+        fragments back together and passes the whole packet to its callbacks.
+
         \param isReceivedChecked If set to true, this packet will be checked
             and will be resent if it has been dropped.
     */
     void sendPacket(const std::vector<char>& packetData, uint32_t address, bool isReceivedChecked);
 
-private:
-    void resendPacket(const std::vector<char>& packetData, uint32_t address);
+    /// Adds to the queue of to-send-packets the given packetData to the given
+    /// destination IP address, taking ownership of packetData.
+    /**
+        The data is moved through the queue and sent from the moved buffer,
+        so it is never copied. Prefer this for large packets.
+
+        \param isReceivedChecked If set to true, this packet will be checked
+            and will be resent if it has been dropped.
+    */
+    void sendPacket(std::vector<char>&& packetData, uint32_t address, bool isReceivedChecked);
 
-public:
     /// Adds to the queue of to-send-packets the given packetData to the given
     /// destination IP address.
     /**
@@ -147,6 +324,89 @@ public:
     */
     void sendPacket(const char* packetData, uint32_t packetSize, uint32_t address, bool isReceivedChecked);
 
+    /// Adds to the queue of to-send-packets the given packetData to the given
+    /// connected peer.
+    /**
+        \param isReceivedChecked If set to true, this packet will be checked
+            and will be resent if it has been dropped.
+    */
+    void sendPacket(const std::vector<char>& packetData, ConnectionHandle connection, bool isReceivedChecked);
+
+    /// Adds to the queue of to-send-packets the given packetData to the given
+    /// connected peer, taking ownership of packetData.
+    /**
+        \param isReceivedChecked If set to true, this packet will be checked
+            and will be resent if it has been dropped.
+    */
+    void sendPacket(std::vector<char>&& packetData, ConnectionHandle connection, bool isReceivedChecked);
+
+    /// Adds to the queue of to-send-packets the given packetData to the given
+    /// connected peer.
+    /**
+        \param isReceivedChecked If set to true, this packet will be checked
+            and will be resent if it has been dropped.
+    */
+    void sendPacket(const char* packetData, uint32_t packetSize, ConnectionHandle connection, bool isReceivedChecked);
+
+    /// Adds a message on the given channel to the given connected peer.
+    /**
+        Messages of the reliable channels have their own sequence numbers per
+        channel and are packed into datagrams separate from packets, as many
+        as fit in NetworkConnection::maxDatagramSize. Whenever the ack
+        bitfield of the peer shows a datagram carrying messages was lost, or
+        it was not acked within the retransmission timeout (see
+        NetworkConnection::resendTimedOutPackets), its unacked messages are queued
+        again, ahead of new ones, until they are acked. Up to 256 messages
+        per channel may be unacked at once; further messages wait for acks.
+
+        Received messages are passed to the received packet callbacks with
+        "isReceivedChecked" true (except on the UNRELIABLE channel), and
+        "outOfOrder" true if a RELIABLE_UNORDERED message arrived ahead of an
+        earlier one. RELIABLE_ORDERED messages received ahead of a missing
+        one are held back until it arrives. The ignoreOutOfSequence setting
+        does not apply to messages.
+
+        Messages too large for one datagram are split into fragments with
+        sequence numbers of their own, resent individually when lost, and
+        delivered once all of them are received. Messages may be at most 16
+        MiB.
+    */
+    void sendMessage(const std::vector<char>& messageData, ConnectionHandle connection, Channel channel);
+
+    /// Adds a message on the given channel to the given connected peer,
+    /// taking ownership of messageData.
+    /**
+        See NetworkConnection::sendMessage.
+    */
+    void sendMessage(std::vector<char>&& messageData, ConnectionHandle connection, Channel channel);
+
+    /// Adds a message on the given channel to the given connected peer.
+    /**
+        See NetworkConnection::sendMessage.
+    */
+    void sendMessage(const char* messageData, uint32_t messageSize, ConnectionHandle connection, Channel channel);
+
+    /// Adds a packet to the given connected peer that is reported to the
+    /// acked callback once the peer acks it.
+    /**
+        The packet is not received checked, so it is never resent and the
+        acked callback is never called for it if it is lost. Packets too
+        large for one datagram are sent in fragments as by
+        NetworkConnection::sendPacket, and reported once all of them are
+        acked. See NetworkConnection::setHandleAckedCallback.
+
+        \param trackingId Passed to the acked callback to tell which packet
+            was acked.
+    */
+    void sendTrackedPacket(const std::vector<char>& packetData, ConnectionHandle connection, uint32_t trackingId);
+
+    /// Adds a tracked packet to the given connected peer, taking ownership of
+    /// packetData.
+    /**
+        See NetworkConnection::sendTrackedPacket.
+    */
+    void sendTrackedPacket(std::vector<char>&& packetData, ConnectionHandle connection, uint32_t trackingId);
+
     /// Gets the calculated round-trip-time to an arbritrary connected peer.
     /**
         Note that if most of the packets sent are not "isReceivedChecked" or no
@@ -167,6 +427,28 @@ public:
         \return 0 if the specified peer is not connected (not found).
     */
     float getRtt(uint32_t address);
+    /// Gets the calculated round-trip-time to the given connected peer.
+    /**
+        \return 0 if the peer is not connected.
+    */
+    float getRtt(ConnectionHandle connection);
+
+    /// Gets the largest packet that reaches the given peer in one datagram.
+    /**
+        This is the datagram size to the peer minus the 20 byte header:
+        the discovered path MTU minus 48 bytes when discovering path MTUs (see
+        NetworkConnection::setDiscoverPathMtu), otherwise
+        NetworkConnection::maxDatagramSize minus 20. Larger packets are sent
+        in fragments.
+
+        \return 0 if the peer is not connected.
+    */
+    uint32_t getMaxPayload(uint32_t address);
+    /// Gets the largest packet that reaches the given peer in one datagram.
+    /**
+        See NetworkConnection::getMaxPayload.
+    */
+    uint32_t getMaxPayload(ConnectionHandle connection);
 
     /// Sets the callback called when a valid packet is received.
     /**
@@ -197,33 +479,100 @@ public:
     */
     void setDisconnectedCallback(std::function<void(uint32_t)> callback);
 
+    /// Sets the callback called when a valid packet is received, with the
+    /// handle of the sender.
+    /**
+        Same as NetworkConnection::setReceivedCallback, except the sender is
+        given as a ConnectionHandle. Both callbacks are called if both are set.
+    */
+    void setHandleReceivedCallback(std::function<void(const char*, uint32_t, ConnectionHandle, bool, bool, bool)> callback);
+
+    /// Sets the callback called with the handle of a newly connected peer.
+    void setHandleConnectedCallback(std::function<void(ConnectionHandle)> callback);
+
+    /// Sets the callback called with the handle of a disconnected peer.
+    /**
+        The handle no longer refers to a connection when this is called, so it
+        can only be compared to stored handles.
+    */
+    void setHandleDisconnectedCallback(std::function<void(ConnectionHandle)> callback);
+
+    /// Sets the callback called when a peer acks a packet sent with
+    /// NetworkConnection::sendTrackedPacket.
+    /**
+        The callback will be called with the handle of the peer and the
+        tracking id the packet was sent with, from NetworkConnection::update
+        after received datagrams were processed.
+    */
+    void setHandleAckedCallback(std::function<void(ConnectionHandle, uint32_t)> callback);
+
     /// Gets a vector of IP addresses of all connected peers.
-    /** Note that the IP addresses is in an uint32 format. */
+    /**
+        Note that the IP addresses is in an uint32 format. Peers sharing an
+        IP address appear once each.
+    */
     std::vector<uint32_t> getConnected();
 
+    /// Gets a vector of handles of all connected peers.
+    std::vector<ConnectionHandle> getConnectedHandles();
+
+    /// Gets the handle of the peer with the given IP address and port.
+    /**
+        If port is 0, the first connected peer with the given IP address is
+        used.
+        \return An invalid handle if there is no such peer.
+    */
+    ConnectionHandle getHandle(uint32_t address, unsigned short port = 0);
+
+    /// Gets the IP address of a connected peer, or 0 if it is not connected.
+    uint32_t getAddress(ConnectionHandle connection);
+
+    /// Gets the port of a connected peer, or 0 if it is not connected.
+    unsigned short getPort(ConnectionHandle connection);
+
     /// Gets the size of the packet queue for the specified destination address.
     unsigned int getPacketQueueSize(uint32_t destinationAddress);
     /// Clears the packet queue for the specified destination address.
     void clearPacketQueue(uint32_t destinationAddress);
+    /// Gets the size of the packet queue for the given connected peer.
+    unsigned int getPacketQueueSize(ConnectionHandle connection);
+    /// Clears the packet queue for the given connected peer.
+    void clearPacketQueue(ConnectionHandle connection);
 
     /// Gets whether or not the connection is good for an arbritrary connection.
     /**
         It is expected to call this function as a Client.
         If there are no valid connections, then "false" will be returned.
-        Note that if the connection is "good" then packets will be sent at an
-        interval of 1/30th of a second. Otherwise packets will be sent at an
-        interval of 1/10th of a second.
+        Note that a connection is "good" while its send rate is at least 30
+        datagrams per second (see NetworkConnection::getSendRate).
     */
     bool connectionIsGood();
     /// Gets whether or not the connection is good for the specified connection.
     /**
         If there is no connection to the specified IP address, then "false"
         will be returned.
-        Note that if the connection is "good" then packets will be sent at an
-        interval of 1/30th of a second. Otherwise packets will be sent at an
-        interval of 1/10th of a second.
+        Note that a connection is "good" while its send rate is at least 30
+        datagrams per second (see NetworkConnection::getSendRate).
     */
     bool connectionIsGood(uint32_t destinationAddress);
+    /// Gets whether or not the connection is good for the given peer.
+    /**
+        If the peer is not connected, then "false" will be returned.
+    */
+    bool connectionIsGood(ConnectionHandle connection);
+
+    /// Gets the current send rate to the given peer in datagrams per second.
+    /**
+        \return 0 if the peer is not connected.
+    */
+    float getSendRate(ConnectionHandle connection);
+
+    /// Returns true if the given handle refers to a connected peer.
+    /**
+        A handle stops referring to its peer once the peer disconnects, even
+        if a new peer connects from the same IP address and port.
+    */
+    bool isConnected(ConnectionHandle connection);
 
     /// Resets the connection as if it was just constructed.
     /**
@@ -259,13 +608,168 @@ public:
     */
     void setClientBroadcast(bool clientWillBroadcast);
 
+    /// Sets whether or not the socket may share its port with other sockets.
+    /**
+        If true, the socket is bound with SO_REUSEPORT so that several
+        NetworkConnections (i.e. one per thread) can bind the same server
+        port. The kernel then passes each datagram to one of them based on
+        the sender's address and port, so a peer always reaches the same
+        NetworkConnection. Only supported on Linux, where it takes effect
+        when the socket is opened (on the first update or
+        NetworkConnection::startThread after construction or reset).
+        See GDT::ShardedNetworkServer.
+    */
+    void setReusePort(bool reusePort);
+
+    /// Sets whether or not the path MTU to each peer is discovered.
+    /**
+        If true, the socket sets the don't fragment flag on every datagram and
+        each connection sends padded probe datagrams, one at a time, to
+        binary search for the largest datagram that reaches the peer (between
+        an IP MTU of 576 and 1500 bytes). Acked probes raise the size of
+        datagrams to the peer, which coalescing, reliable messages and
+        fragmentation then fill (see NetworkConnection::getMaxPayload). Lost
+        probes are not taken as congestion.
+
+        Supported on Linux (IP_PMTUDISC_PROBE), Windows and platforms with
+        IP_DONTFRAG. Takes effect when the socket is opened (on the first
+        update or NetworkConnection::startThread after construction or
+        reset). Both peers must use a version of NetworkConnection that
+        understands probe datagrams.
+    */
+    void setDiscoverPathMtu(bool discoverPathMtu);
+
+    /// Simulates a bad network on the datagrams this NetworkConnection sends.
+    /**
+        Sent datagrams are dropped, delayed, reordered, duplicated and
+        limited in bandwidth as set in "impairment" before they are handed to
+        the socket, so that a lossy link can be tested over loopback. The
+        random choices are seeded by Impairment::seed, and delays are measured
+        in the deltaTime passed to update, so updates with the same deltaTimes
+        impair the same datagrams the same way. A default constructed
+        Impairment turns the simulation off (after the held datagrams are
+        sent). Only sent datagrams are impaired; impair both peers to impair
+        both directions.
+    */
+    void setImpairment(const Impairment& impairment);
+
+    /// Sets the transport datagrams are sent and received through.
+    /**
+        By default, a GDT::UdpTransport is used. The transport is opened
+        instead of the default one when the socket is opened (on the first
+        update or NetworkConnection::startThread after construction or
+        reset), bound to the port the socket would be bound to, and kept
+        through later resets until another is set. Use a
+        GDT::LoopbackTransport to connect NetworkConnections of one process
+        in memory.
+    */
+    void setTransport(std::unique_ptr<Transport> transport);
+
+    /// Gets the counts of datagrams sent/received and the system calls used.
+    /**
+        Outgoing datagrams of an update are sent together (with sendmmsg on
+        Linux), so sentDatagrams / sendCalls is the average number of
+        datagrams sent per system call. Likewise for received datagrams.
+
+        sendGapMicroseconds / sendGaps is the average time between datagrams
+        handed to the socket, and shortSendGaps counts those sent less than
+        half the paced gap after the previous one.
+    */
+    SocketCounters getSocketCounters() const;
+
+    /// Resets all counters returned by NetworkConnection::getSocketCounters.
+    void resetSocketCounters();
+
+    /// Gets the counts of datagrams exchanged with the given peer and the
+    /// depths of its queues.
+    /**
+        The counts start when the peer connects. Only datagrams carrying
+        packets or messages are counted as lost, as heartbeats are not
+        tracked.
+
+        \return Zeros if the peer is not connected.
+    */
+    ConnectionStats getStats(ConnectionHandle connection);
+
+    /// Gets the stats of all peers, including disconnected ones, and of the
+    /// updates.
+    /**
+        Counts are kept from construction or the last call to
+        NetworkConnection::resetStats, and continue through resets. The
+        counts of each peer are only added up here, so sending and receiving
+        pay for a few increments of the peer's counters; the sums take time
+        proportional to the number of peers.
+    */
+    NetworkStats getStats();
+
+    /// Resets the counts returned by NetworkConnection::getStats, including
+    /// those of connected peers.
+    void resetStats();
+
+    /// Sets a sink that gets a line of the stats every "interval" seconds.
+    /**
+        The sink is called from NetworkConnection::update (or waitAndUpdate)
+        on the game thread with the result of NetworkConnection::getStats
+        and the seconds since the sink was set, as a line without a line
+        break, i.e. to append to a log file or send to a monitoring system.
+        With STATS_CSV, the first line holds the column names. Pass nullptr
+        to stop.
+    */
+    void setStatsSink(std::function<void(const std::string&)> sink, float interval = 1.0f, StatsFormat format = STATS_CSV);
+
 private:
-    Mode mode;
+    using SendBatch = GDT::Internal::Network::SendBatch;
+    using Endpoint = GDT::Internal::Network::Endpoint;
+    using QueuedSend = GDT::Internal::Network::QueuedSend;
+    using ConnectionEvent = GDT::Internal::Network::ConnectionEvent;
 
-    int socketHandle;
-    sockaddr_in socketInfo;
+    Mode mode;
 
-    std::unordered_map<uint32_t, ConnectionData> connectionData;
+    std::unique_ptr<Transport> transport;
+    // set by setTransport, replaces transport when it is opened
+    std::unique_ptr<Transport> nextTransport;
+    // the pacing rate given to the transport, ~0 if unlimited
+    uint32_t appliedPacingRate;
+
+    // connections are kept in slots indexed by handle, free slots are reused
+    std::vector<ConnectionData> connections;
+    std::vector<uint32_t> freeConnections;
+    // maps address:port to a slot, and address:0 to the first slot with
+    // that address
+    GDT::Internal::Network::EndpointMap connectionMap;
+    // send and timeout deadlines of connected slots, so that
+    // update only visits connections with something due
+    GDT::Internal::Network::TimerWheel timerWheel;
+    std::vector<uint32_t> dueConnections;
+    // slots with a send requested before their next deadline
+    std::vector<uint32_t> triggeredConnections;
+
+    GDT::Internal::Network::DatagramBuffers receiveBuffers;
+    SendBatch sendBatch;
+    SocketCounters socketCounters;
+    // the stats of disconnected peers and the update times, the stats of
+    // connected peers are added when they are taken
+    NetworkStats stats;
+    // byte totals at the start of the second the byte rates are measured
+    // over
+    std::chrono::steady_clock::time_point rateWindowStart;
+    uint64_t rateWindowSentBytes;
+    uint64_t rateWindowReceivedBytes;
+    // only used on the game thread
+    std::function<void(const std::string&)> statsSink;
+    StatsFormat statsFormat;
+    std::chrono::steady_clock::duration statsInterval;
+    std::chrono::steady_clock::time_point statsSinkStart;
+    std::chrono::steady_clock::time_point nextStatsLine;
+    GDT::Internal::Network::Pacer pacer;
+    GDT::Internal::Network::ImpairmentSimulator impairment;
+    std::chrono::steady_clock::time_point lastSendTime;
+    // ordered messages are moved here to be delivered
+    std::vector<char> deliveredMessage;
+    // fragmented messages are swapped here once complete
+    std::vector<char> reassembledMessage;
+    // tracked packets acked while receiving, reported after receiving
+    std::vector<std::pair<ConnectionHandle, uint32_t> > ackedPackets;
 
     std::random_device rd;
     std::uniform_int_distribution<uint32_t> dist;
@@ -276,6 +780,10 @@ private:
     std::function<void(const char*, uint32_t, uint32_t, bool, bool, bool)> receivedCallback;
     std::function<void(uint32_t)> connectedCallback;
     std::function<void(uint32_t)> disconnectedCallback;
+    std::function<void(const char*, uint32_t, ConnectionHandle, bool, bool, bool)> handleReceivedCallback;
+    std::function<void(ConnectionHandle)> handleConnectedCallback;
+    std::function<void(ConnectionHandle)> handleDisconnectedCallback;
+    std::function<void(ConnectionHandle, uint32_t)> handleAckedCallback;
 
     bool initialized;
     bool validState;
@@ -286,28 +794,178 @@ private:
 
     float clientRetryTimer;
 
+    // sum of the deltaTime of every update, the clock of the timer wheel
+    double elapsedTime;
+
+    std::chrono::steady_clock::time_point lastWaitUpdate;
+
     bool clientBroadcast;
+    bool reusePort;
+    bool discoverPathMtu;
+    // discoverPathMtu, if the socket could set the don't fragment flag
+    bool isProbingPathMtu;
+
+    // only changed while the network thread is not running
+    bool threaded;
+    std::atomic<bool> threadRunning;
+    std::thread networkThread;
+    // held by the network thread while it updates, and by the game thread
+    // while it accesses connections if threaded
+    mutable std::mutex stateMutex;
+    GDT::Internal::SPSCQueue<QueuedSend> sendQueue;
+    GDT::Internal::SPSCQueue<ConnectionEvent> eventQueue;
+    // used by the producer when its queue is full
+    std::deque<QueuedSend> sendOverflow;
+    std::deque<ConnectionEvent> eventOverflow;
+
+    /// Returns a lock of stateMutex if threaded, otherwise an empty lock.
+    std::unique_lock<std::mutex> lockIfThreaded() const;
+
+    /// Does the work of update, on the network thread if threaded.
+    void updateConnection(float deltaTime);
+
+    /// Counts the time of an update started at "start", and measures the
+    /// byte rates once a second.
+    void updateStats(std::chrono::steady_clock::time_point start);
+
+    /// Returns the stats of all peers without locking.
+    NetworkStats collectStats();
+
+    /// Passes a line of the stats to the stats sink if one is due.
+    void writeStatsLine();
+
+    /// Schedules the next send of "connection", or its timeout in "timeout"
+    /// seconds if that is earlier.
+    void scheduleConnection(ConnectionData& connection, double timeout);
+
+    /// Sends to "connection" on the next update.
+    void requestSend(ConnectionData& connection);
+
+    /// Returns true if a queued packet fits in the congestion window.
+    bool canSendQueued(ConnectionData& connection);
+
+    /// Sets the pacing rate of the transport if the paced rate changed
+    /// enough.
+    void updatePacingRate();
+
+    void threadLoop(float interval);
+
+    /// Returns the seconds until a send, timeout or connection attempt is
+    /// due, or a negative value if nothing is scheduled.
+    float nextDeadline();
+
+    /// Blocks until a datagram can be read or maxWait seconds have passed,
+    /// or sleeps if the transport is not open.
+    void waitForActivity(float maxWait);
+
+    void closeSocket();
+
+    /// Moves a packet or message into the send queue of its connection.
+    void queuePacket(QueuedSend& queued);
+
+    /// Stores a message of a reliable channel and queues it to be sent,
+    /// split into fragments if it does not fit in one datagram.
+    /**
+        \return false if the message is too large to be sent.
+    */
+    bool queueMessage(ConnectionData& connection, uint8_t channel, std::vector<char>& data);
+
+    /// Stores one message or fragment and queues it to be sent.
+    void pushMessage(ConnectionData& connection, uint8_t channel, std::vector<char>& data, bool isFragment);
+
+    /// Moves waiting messages of "channel" into its window while there is room.
+    void fillMessageWindow(ConnectionData& connection, uint8_t channel);
+
+    /// Releases the messages sent in an acked datagram.
+    void ackMessages(PacketInfo& sentPacket, ConnectionData& connection);
+
+    /// Queues the unacked messages of a lost datagram to be sent again.
+    void lostMessages(PacketInfo& sentPacket, ConnectionData& connection);
+
+    /// Returns true if the next datagram to "connection" carries messages.
+    bool nextIsMessage(ConnectionData& connection);
+
+    void pushSend(QueuedSend&& queued);
+    void pushEvent(ConnectionEvent&& event);
+
+    /// Calls the callbacks of all events passed from the network thread.
+    void deliverEvents();
+
+    /// Returns the peer at address:port, or the first peer with address if
+    /// port is 0, or nullptr if there is no such peer.
+    ConnectionData* findConnection(uint32_t address, uint16_t port = 0);
+    ConnectionData* findConnection(ConnectionHandle connection);
+    ConnectionHandle handleOf(const ConnectionData& connection) const;
 
     void registerConnection(uint32_t address, uint32_t ID, unsigned short port);
-    void unregisterConnection(uint32_t address);
+    void unregisterConnection(ConnectionData& connection);
 
-    void shiftBitfield(uint32_t address, uint32_t diff);
+    void resendPacket(std::vector<char>&& packetData, ConnectionData& connection, bool isCoalesced);
 
-    void checkSentPackets(uint32_t ack, uint32_t bitfield, uint32_t address);
+    void shiftBitfield(ConnectionData& connection, uint32_t diff);
 
-    void lookupRtt(uint32_t address, uint32_t ack);
+    void checkSentPackets(uint32_t ack, uint32_t bitfield, ConnectionData& connection);
 
-    void checkSentPacketsSize(uint32_t address);
+    void lookupRtt(ConnectionData& connection, uint32_t ack);
+
+    /// Passes the sent packets acked or found lost by "ack" and "bitfield"
+    /// to the rate controller of "connection".
+    void ackSentPackets(uint32_t ack, uint32_t bitfield, ConnectionData& connection);
+
+    /// Reports the tracked packets acked since the last call.
+    void packetsAcked();
+
+    PacketInfo& insertSentPacket(ConnectionData& connection, uint32_t sequenceID);
 
     uint32_t generateID();
 
-    void preparePacket(std::vector<char>& packetData, uint32_t& sequenceID, uint32_t address, bool isPing, bool isResending, bool noIncrementSequence);
+    /// Writes the 20 byte header of the next packet to "connection" into
+    /// "header".
+    void preparePacket(char* header, uint32_t& sequenceID, ConnectionData& connection, bool isPing, bool isResending, bool isNotCheckReceivedPkt, bool isCoalesced, bool isChanneled);
+
+    /// Stages the next datagram to "connection", or a heartbeat if nothing
+    /// can be sent and one is due.
+    /**
+        \return true if queued packets were staged.
+    */
+    bool stagePacket(ConnectionData& connection);
+
+    /// Stages a datagram of as many queued messages to "connection" as fit.
+    void stageMessages(ConnectionData& connection);
+
+    /// Stages a padded path MTU probe to "connection" if one is due.
+    void stageProbe(ConnectionData& connection);
+
+    /// Returns the largest datagram to send to "connection".
+    uint32_t datagramSizeOf(const ConnectionData& connection) const;
+
+    /// Concludes a probe that was acked or lost.
+    void concludeProbe(PacketInfo& sentPacket, ConnectionData& connection, bool isAcked);
+
+    void flushSendBatch();
+
+    /// Passes all datagrams of the send batch to the impairment simulator.
+    void impairSendBatch();
+
+    /// Sends the datagrams held back by the impairment simulator that are due.
+    void releaseImpaired();
+
+    void receivePackets();
+
+    void receivedDatagram(const char* data, int bytes, uint32_t address, uint16_t port);
+
+    void receivedPacket(const char* data, uint32_t count, uint32_t address, ConnectionHandle connection, bool outOfOrder, bool isResent, bool isNoIncSeq);
+
+    /// Delivers the messages of a datagram in the order of their channels.
+    void receivedMessages(const char* data, uint32_t count, uint32_t address, ConnectionHandle connection, bool isResent);
 
-    void receivedPacket(const char* data, uint32_t count, uint32_t address, bool outOfOrder, bool isResent, bool isNoIncSeq);
+    /// Delivers a received message, or adds a fragment to its message and
+    /// delivers that once complete.
+    void deliverMessage(const char* data, uint32_t count, uint8_t channel, uint16_t sequence, bool isFragment, uint32_t address, ConnectionHandle connection, bool outOfOrder, bool isResent);
 
-    void connectionMade(uint32_t address);
+    void connectionMade(ConnectionData& connection);
 
-    void connectionLost(uint32_t address);
+    void connectionLost(uint32_t address, ConnectionHandle connection);
 
     void initialize();
 
@@ -0,0 +1,305 @@
+
+#include "ShardedNetworkServer.hpp"
+
+#include <thread>
+
+GDT::ShardedNetworkServer::PeerHandle::PeerHandle() :
+shard(0xFFFFFFFF),
+connection()
+{}
+
+GDT::ShardedNetworkServer::PeerHandle::PeerHandle(uint32_t shard, ConnectionHandle connection) :
+shard(shard),
+connection(connection)
+{}
+
+bool GDT::ShardedNetworkServer::PeerHandle::isValid() const
+{
+    return shard != 0xFFFFFFFF && connection.isValid();
+}
+
+bool GDT::ShardedNetworkServer::PeerHandle::operator== (const PeerHandle& other) const
+{
+    return shard == other.shard && connection == other.connection;
+}
+
+bool GDT::ShardedNetworkServer::PeerHandle::operator!= (const PeerHandle& other) const
+{
+    return !(*this == other);
+}
+
+GDT::ShardedNetworkServer::ShardedNetworkServer(unsigned short serverPort, unsigned int shardCount) :
+serverPort(serverPort),
+started(false)
+{
+#ifdef GDT_INTERNAL_NETWORK_HAS_REUSEPORT
+    if(shardCount == 0)
+    {
+        shardCount = std::thread::hardware_concurrency();
+        if(shardCount == 0)
+        {
+            shardCount = 1;
+        }
+    }
+#else
+    if(shardCount > 1)
+    {
+        std::clog << "Warning: SO_REUSEPORT is not supported on this platform, using one shard!" << std::endl;
+    }
+    shardCount = 1;
+#endif
+
+    for(uint32_t i = 0; i < shardCount; ++i)
+    {
+        shards.push_back(std::unique_ptr<NetworkConnection>(new NetworkConnection(NetworkConnection::SERVER, serverPort)));
+        NetworkConnection& shard = *shards.back();
+        if(shardCount > 1)
+        {
+            shard.setReusePort(true);
+        }
+
+        // the callbacks of every shard are called on the thread calling
+        // update, so they can forward to the server's callbacks directly
+        shard.setHandleReceivedCallback([this, i] (const char* data, uint32_t count, ConnectionHandle connection, bool outOfOrder, bool isResent, bool isReceivedChecked) {
+            if(receivedCallback)
+            {
+                receivedCallback(data, count, PeerHandle(i, connection), outOfOrder, isResent, isReceivedChecked);
+            }
+        });
+        shard.setHandleConnectedCallback([this, i] (ConnectionHandle connection) {
+            if(connectedCallback)
+            {
+                connectedCallback(PeerHandle(i, connection));
+            }
+        });
+        shard.setHandleDisconnectedCallback([this, i] (ConnectionHandle connection) {
+            if(disconnectedCallback)
+            {
+                disconnectedCallback(PeerHandle(i, connection));
+            }
+        });
+    }
+}
+
+GDT::ShardedNetworkServer::~ShardedNetworkServer()
+{
+    stop();
+}
+
+bool GDT::ShardedNetworkServer::start(float interval)
+{
+    if(started)
+    {
+        return false;
+    }
+
+    // bind every socket before starting the threads, since the kernel
+    // spreads peers over the sockets bound to the port at the time
+    bool isOpen = true;
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        (*iter)->update(0.0f);
+        isOpen = isOpen && (*iter)->isOpen();
+    }
+    if(!isOpen)
+    {
+        std::clog << "Warning: Failed to open the sockets of all shards on port "
+            << serverPort << ", not starting!" << std::endl;
+        // closed so that the next start opens every socket again
+        for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+        {
+            (*iter)->reset(NetworkConnection::SERVER, serverPort);
+        }
+        return false;
+    }
+
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        (*iter)->startThread(interval);
+    }
+    started = true;
+    return true;
+}
+
+void GDT::ShardedNetworkServer::stop()
+{
+    if(!started)
+    {
+        return;
+    }
+
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        (*iter)->stopThread();
+    }
+    started = false;
+}
+
+bool GDT::ShardedNetworkServer::isStarted() const
+{
+    return started;
+}
+
+void GDT::ShardedNetworkServer::update(float deltaTime)
+{
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        (*iter)->update(deltaTime);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendPacket(const std::vector<char>& packetData, PeerHandle peer, bool isReceivedChecked)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendPacket(packetData, peer.connection, isReceivedChecked);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendPacket(std::vector<char>&& packetData, PeerHandle peer, bool isReceivedChecked)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendPacket(std::move(packetData), peer.connection, isReceivedChecked);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendPacket(const char* packetData, uint32_t packetSize, PeerHandle peer, bool isReceivedChecked)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendPacket(packetData, packetSize, peer.connection, isReceivedChecked);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendMessage(const std::vector<char>& messageData, PeerHandle peer, Channel channel)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendMessage(messageData, peer.connection, channel);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendMessage(std::vector<char>&& messageData, PeerHandle peer, Channel channel)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendMessage(std::move(messageData), peer.connection, channel);
+    }
+}
+
+void GDT::ShardedNetworkServer::sendMessage(const char* messageData, uint32_t messageSize, PeerHandle peer, Channel channel)
+{
+    if(peer.shard < shards.size())
+    {
+        shards[peer.shard]->sendMessage(messageData, messageSize, peer.connection, channel);
+    }
+}
+
+void GDT::ShardedNetworkServer::setReceivedCallback(std::function<void(const char*, uint32_t, PeerHandle, bool, bool, bool)> callback)
+{
+    receivedCallback = callback;
+}
+
+void GDT::ShardedNetworkServer::setConnectedCallback(std::function<void(PeerHandle)> callback)
+{
+    connectedCallback = callback;
+}
+
+void GDT::ShardedNetworkServer::setDisconnectedCallback(std::function<void(PeerHandle)> callback)
+{
+    disconnectedCallback = callback;
+}
+
+std::vector<GDT::ShardedNetworkServer::PeerHandle> GDT::ShardedNetworkServer::getConnectedPeers()
+{
+    std::vector<PeerHandle> peers;
+    for(uint32_t i = 0; i < shards.size(); ++i)
+    {
+        std::vector<ConnectionHandle> connections = shards[i]->getConnectedHandles();
+        for(auto iter = connections.begin(); iter != connections.end(); ++iter)
+        {
+            peers.push_back(PeerHandle(i, *iter));
+        }
+    }
+    return peers;
+}
+
+bool GDT::ShardedNetworkServer::isConnected(PeerHandle peer)
+{
+    return peer.shard < shards.size() && shards[peer.shard]->isConnected(peer.connection);
+}
+
+uint32_t GDT::ShardedNetworkServer::getAddress(PeerHandle peer)
+{
+    if(peer.shard >= shards.size())
+    {
+        return 0;
+    }
+    return shards[peer.shard]->getAddress(peer.connection);
+}
+
+unsigned short GDT::ShardedNetworkServer::getPort(PeerHandle peer)
+{
+    if(peer.shard >= shards.size())
+    {
+        return 0;
+    }
+    return shards[peer.shard]->getPort(peer.connection);
+}
+
+float GDT::ShardedNetworkServer::getRtt(PeerHandle peer)
+{
+    if(peer.shard >= shards.size())
+    {
+        return 0;
+    }
+    return shards[peer.shard]->getRtt(peer.connection);
+}
+
+uint32_t GDT::ShardedNetworkServer::getMaxPayload(PeerHandle peer)
+{
+    if(peer.shard >= shards.size())
+    {
+        return 0;
+    }
+    return shards[peer.shard]->getMaxPayload(peer.connection);
+}
+
+unsigned int GDT::ShardedNetworkServer::getShardCount() const
+{
+    return shards.size();
+}
+
+GDT::NetworkConnection& GDT::ShardedNetworkServer::getShard(unsigned int shard)
+{
+    return *shards.at(shard);
+}
+
+GDT::ShardedNetworkServer::SocketCounters GDT::ShardedNetworkServer::getSocketCounters() const
+{
+    SocketCounters sum;
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        SocketCounters counters = (*iter)->getSocketCounters();
+        sum.sendCalls += counters.sendCalls;
+        sum.sentDatagrams += counters.sentDatagrams;
+        sum.receiveCalls += counters.receiveCalls;
+        sum.receivedDatagrams += counters.receivedDatagrams;
+        sum.pacedSends += counters.pacedSends;
+        sum.sendGaps += counters.sendGaps;
+        sum.sendGapMicroseconds += counters.sendGapMicroseconds;
+        sum.shortSendGaps += counters.shortSendGaps;
+    }
+    return sum;
+}
+
+GDT::ShardedNetworkServer::NetworkStats GDT::ShardedNetworkServer::getStats() const
+{
+    NetworkStats sum;
+    for(auto iter = shards.begin(); iter != shards.end(); ++iter)
+    {
+        sum.add((*iter)->getStats());
+    }
+    return sum;
+}
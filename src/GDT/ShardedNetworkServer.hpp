@@ -0,0 +1,157 @@
+#ifndef GDT_SHARDED_NETWORK_SERVER_HPP
+#define GDT_SHARDED_NETWORK_SERVER_HPP
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "NetworkConnection.hpp"
+
+namespace GDT
+{
+
+/// A server made of several NetworkConnections sharing one port.
+/**
+    Every shard is a SERVER NetworkConnection with its own socket, connection
+    table and network thread. The sockets are bound to the same port with
+    SO_REUSEPORT, and the kernel passes the datagrams of each peer to one of
+    them, so receiving, acking and sending is spread over as many cores as
+    there are shards while a peer always stays on the same shard.
+
+    Peers are identified by a PeerHandle, which holds the shard of the peer
+    and its ConnectionHandle in that shard. Packets can be sent to any peer
+    through the server, and callbacks of all shards are called from
+    ShardedNetworkServer::update on the game thread.
+
+    SO_REUSEPORT is only supported on Linux; elsewhere the server always has
+    a single shard.
+*/
+class ShardedNetworkServer
+{
+public:
+    using ConnectionHandle = NetworkConnection::ConnectionHandle;
+    using Channel = NetworkConnection::Channel;
+    using SocketCounters = NetworkConnection::SocketCounters;
+    using NetworkStats = NetworkConnection::NetworkStats;
+
+    /// Identifies a peer of a ShardedNetworkServer.
+    struct PeerHandle
+    {
+        PeerHandle();
+        PeerHandle(uint32_t shard, ConnectionHandle connection);
+
+        /// Returns false if this handle was default constructed.
+        bool isValid() const;
+
+        bool operator== (const PeerHandle& other) const;
+        bool operator!= (const PeerHandle& other) const;
+
+        /// The index of the shard the peer is connected to.
+        uint32_t shard;
+        /// The handle of the peer in its shard.
+        ConnectionHandle connection;
+    };
+
+    /// Creates the shards, which open their sockets on start.
+    /**
+        \param serverPort The port every shard binds to.
+        \param shardCount The number of shards. If 0, one per hardware
+            thread is used.
+    */
+    ShardedNetworkServer(unsigned short serverPort = GDT_INTERNAL_NETWORK_SERVER_PORT, unsigned int shardCount = 0);
+
+    ~ShardedNetworkServer();
+
+    /// Opens the socket of every shard and starts their network threads.
+    /**
+        See NetworkConnection::startThread. If a shard fails to open its
+        socket, i.e. because the port is taken without SO_REUSEPORT, the
+        sockets of all shards are closed again and none is started.
+        \return false if the shards were already started or a socket failed
+            to open.
+    */
+    bool start(float interval = 1.0f / 120.0f);
+
+    /// Stops the network threads of every shard.
+    void stop();
+
+    /// Returns true if the shards were started.
+    bool isStarted() const;
+
+    /// Calls the callbacks for everything the shards received.
+    /**
+        If the shards were not started, this updates each shard in turn on
+        the calling thread instead (see NetworkConnection::update).
+    */
+    void update(float deltaTime);
+
+    /// Queues a packet to the given peer, regardless of its shard.
+    void sendPacket(const std::vector<char>& packetData, PeerHandle peer, bool isReceivedChecked);
+    /// Queues a packet to the given peer without copying it.
+    void sendPacket(std::vector<char>&& packetData, PeerHandle peer, bool isReceivedChecked);
+    /// Queues a packet to the given peer.
+    void sendPacket(const char* packetData, uint32_t packetSize, PeerHandle peer, bool isReceivedChecked);
+
+    /// Queues a message on the given channel to the given peer.
+    /**
+        See NetworkConnection::sendMessage.
+    */
+    void sendMessage(const std::vector<char>& messageData, PeerHandle peer, Channel channel);
+    /// Queues a message on the given channel to the given peer without copying it.
+    void sendMessage(std::vector<char>&& messageData, PeerHandle peer, Channel channel);
+    /// Queues a message on the given channel to the given peer.
+    void sendMessage(const char* messageData, uint32_t messageSize, PeerHandle peer, Channel channel);
+
+    void setReceivedCallback(std::function<void(const char*, uint32_t, PeerHandle, bool, bool, bool)> callback);
+    void setConnectedCallback(std::function<void(PeerHandle)> callback);
+    void setDisconnectedCallback(std::function<void(PeerHandle)> callback);
+
+    /// Gets handles of the connected peers of every shard.
+    std::vector<PeerHandle> getConnectedPeers();
+
+    bool isConnected(PeerHandle peer);
+    /// Gets the IP address of a connected peer, or 0 if it is not connected.
+    uint32_t getAddress(PeerHandle peer);
+    /// Gets the port of a connected peer, or 0 if it is not connected.
+    unsigned short getPort(PeerHandle peer);
+    /// Gets the calculated round-trip-time to the given connected peer.
+    /**
+        \return 0 if the peer is not connected.
+    */
+    float getRtt(PeerHandle peer);
+    /// Gets the largest packet that reaches the given peer in one datagram.
+    /**
+        See NetworkConnection::getMaxPayload.
+        \return 0 if the peer is not connected.
+    */
+    uint32_t getMaxPayload(PeerHandle peer);
+
+    unsigned int getShardCount() const;
+
+    /// Gets the NetworkConnection of a shard, i.e. to change its settings.
+    NetworkConnection& getShard(unsigned int shard);
+
+    /// Gets the sums of the socket counters of every shard.
+    SocketCounters getSocketCounters() const;
+
+    /// Gets the network statistics of every shard added together.
+    /**
+        The largest queue and the slowest update are those of the shard
+        they happened in.
+    */
+    NetworkStats getStats() const;
+
+private:
+    std::vector<std::unique_ptr<NetworkConnection> > shards;
+    unsigned short serverPort;
+    bool started;
+
+    std::function<void(const char*, uint32_t, PeerHandle, bool, bool, bool)> receivedCallback;
+    std::function<void(PeerHandle)> connectedCallback;
+    std::function<void(PeerHandle)> disconnectedCallback;
+
+};
+
+} // namespace GDT
+
+#endif
@@ -0,0 +1,341 @@
+#include "SnapshotReplicator.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    void writeVarint(uint32_t value, std::vector<char>& data)
+    {
+        while(value >= 0x80)
+        {
+            data.push_back((char)(0x80 | (value & 0x7F)));
+            value >>= 7;
+        }
+        data.push_back((char)value);
+    }
+
+    bool readVarint(const char* data, uint32_t size, uint32_t& offset, uint32_t& value)
+    {
+        value = 0;
+        for(uint32_t shift = 0; shift < 32; shift += 7)
+        {
+            if(offset >= size)
+            {
+                return false;
+            }
+            uint8_t byte = data[offset++];
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void writeUint32(uint32_t value, char* data)
+    {
+        value = htonl(value);
+        std::memcpy(data, &value, 4);
+    }
+
+    uint32_t readUint32(const char* data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, 4);
+        return ntohl(value);
+    }
+}
+
+GDT::SnapshotReplicator::Counters::Counters() :
+snapshotBytes(0),
+sentBytes(0),
+deltaSnapshots(0),
+fullSnapshots(0)
+{}
+
+GDT::SnapshotReplicator::Entry::Entry() :
+sequence(0),
+fullSequence(0),
+isAcked(false)
+{}
+
+GDT::SnapshotReplicator::Peer::Peer() :
+isActive(false),
+generation(0),
+nextSequence(1),
+fullSequence(0),
+ackedFullSequence(0),
+receivedSequence(0)
+{}
+
+GDT::SnapshotReplicator::SnapshotReplicator(NetworkConnection& connection, char tag) :
+connection(connection),
+tag(tag)
+{
+    connection.setHandleAckedCallback([this] (ConnectionHandle peer, uint32_t sequence) {
+        acked(peer, sequence);
+    });
+}
+
+GDT::SnapshotReplicator::~SnapshotReplicator()
+{
+    connection.setHandleAckedCallback(nullptr);
+}
+
+void GDT::SnapshotReplicator::sendSnapshot(const std::vector<char>& snapshot, ConnectionHandle peer)
+{
+    if(!peer.isValid())
+    {
+        return;
+    }
+
+    Peer& state = peerOf(peer);
+    uint32_t sequence = state.nextSequence++;
+    if(state.nextSequence == 0)
+    {
+        // 0 means no snapshot
+        state.nextSequence = 1;
+    }
+
+    // acked snapshots the peer failed to decode would be baselines it never
+    // has, so one is sent whole every history
+    const Entry* baseline = nullptr;
+    if(state.fullSequence == 0
+        || sequence - state.fullSequence >= GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE)
+    {
+        state.fullSequence = sequence;
+    }
+    else
+    {
+        // the newest acked snapshot of the history, made from the latest
+        // acked whole snapshot or a later one, so deltas go on against older
+        // baselines until a whole one due is acked
+        for(uint32_t age = 1; age < GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE; ++age)
+        {
+            const Entry& entry = state.sent[(sequence - age) % GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE];
+            if(entry.sequence == sequence - age
+                && entry.isAcked
+                && entry.fullSequence - state.ackedFullSequence < 0x7FFFFFFF)
+            {
+                baseline = &entry;
+                break;
+            }
+        }
+    }
+
+    std::vector<char> packet(GDT_INTERNAL_NETWORK_SNAPSHOT_HEADER_SIZE);
+    packet[0] = tag;
+    writeUint32(sequence, packet.data() + 1);
+    writeUint32(baseline != nullptr ? baseline->sequence : 0, packet.data() + 5);
+    writeUint32(snapshot.size(), packet.data() + 9);
+    if(baseline != nullptr)
+    {
+        encodeDelta(baseline->data.data(), baseline->data.size(), snapshot.data(), snapshot.size(), packet);
+        ++counters.deltaSnapshots;
+    }
+    else
+    {
+        encodeDelta(nullptr, 0, snapshot.data(), snapshot.size(), packet);
+        ++counters.fullSnapshots;
+    }
+    counters.snapshotBytes += snapshot.size();
+    counters.sentBytes += packet.size();
+
+    Entry& entry = state.sent[sequence % GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE];
+    entry.fullSequence = baseline != nullptr ? baseline->fullSequence : sequence;
+    entry.sequence = sequence;
+    entry.isAcked = false;
+    entry.data.assign(snapshot.begin(), snapshot.end());
+
+    // packets larger than a datagram are sent in reliable fragments, resent
+    // until acked even if a newer snapshot was sent meanwhile
+    connection.sendTrackedPacket(std::move(packet), peer, sequence);
+}
+
+bool GDT::SnapshotReplicator::isSnapshot(const char* data, uint32_t count) const
+{
+    return count >= GDT_INTERNAL_NETWORK_SNAPSHOT_HEADER_SIZE && data[0] == tag;
+}
+
+bool GDT::SnapshotReplicator::receivedSnapshot(const char* data, uint32_t count, ConnectionHandle peer, std::vector<char>& snapshot)
+{
+    if(!peer.isValid() || !isSnapshot(data, count))
+    {
+        return false;
+    }
+
+    uint32_t sequence = readUint32(data + 1);
+    uint32_t baselineSequence = readUint32(data + 5);
+    uint32_t size = readUint32(data + 9);
+    if(sequence == 0 || size > GDT_INTERNAL_NETWORK_MAX_FRAGMENTED_SIZE)
+    {
+        return false;
+    }
+
+    Peer& state = peerOf(peer);
+    Entry& entry = state.received[sequence % GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE];
+    const char* delta = data + GDT_INTERNAL_NETWORK_SNAPSHOT_HEADER_SIZE;
+    uint32_t deltaSize = count - GDT_INTERNAL_NETWORK_SNAPSHOT_HEADER_SIZE;
+    bool isDecoded;
+    if(baselineSequence == 0)
+    {
+        isDecoded = decodeDelta(nullptr, 0, delta, deltaSize, size, entry.data);
+    }
+    else
+    {
+        const Entry& baseline = state.received[baselineSequence % GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE];
+        isDecoded = baseline.sequence == baselineSequence
+            && &baseline != &entry
+            && decodeDelta(baseline.data.data(), baseline.data.size(), delta, deltaSize, size, entry.data);
+    }
+    if(!isDecoded)
+    {
+        entry.sequence = 0;
+        return false;
+    }
+    entry.sequence = sequence;
+
+    if(sequence - state.receivedSequence - 1 >= 0x7FFFFFFF)
+    {
+        // older than the last returned snapshot
+        return false;
+    }
+    state.receivedSequence = sequence;
+    snapshot.assign(entry.data.begin(), entry.data.end());
+    return true;
+}
+
+void GDT::SnapshotReplicator::removePeer(ConnectionHandle peer)
+{
+    if(peer.index < peers.size() && peers[peer.index].generation == peer.generation)
+    {
+        peers[peer.index] = Peer();
+    }
+}
+
+GDT::SnapshotReplicator::Counters GDT::SnapshotReplicator::getCounters() const
+{
+    return counters;
+}
+
+void GDT::SnapshotReplicator::resetCounters()
+{
+    counters = Counters();
+}
+
+void GDT::SnapshotReplicator::encodeDelta(const char* baseline, uint32_t baselineSize, const char* snapshot, uint32_t snapshotSize, std::vector<char>& delta)
+{
+    auto changed = [baseline, baselineSize, snapshot] (uint32_t i) {
+        return snapshot[i] != (i < baselineSize ? baseline[i] : 0);
+    };
+
+    uint32_t i = 0;
+    while(i < snapshotSize)
+    {
+        uint32_t unchangedStart = i;
+        while(i < snapshotSize && !changed(i))
+        {
+            ++i;
+        }
+        if(i == snapshotSize)
+        {
+            // the rest is unchanged
+            break;
+        }
+
+        // a run ends at 3 unchanged bytes, as fewer cost no more to keep in
+        // the run than starting a new run does
+        uint32_t changedStart = i;
+        uint32_t unchanged = 0;
+        while(i < snapshotSize && unchanged < 3)
+        {
+            unchanged = changed(i) ? 0 : unchanged + 1;
+            ++i;
+        }
+        i -= unchanged;
+
+        writeVarint(changedStart - unchangedStart, delta);
+        writeVarint(i - changedStart, delta);
+        for(uint32_t j = changedStart; j < i; ++j)
+        {
+            delta.push_back(snapshot[j] ^ (j < baselineSize ? baseline[j] : 0));
+        }
+    }
+}
+
+bool GDT::SnapshotReplicator::decodeDelta(const char* baseline, uint32_t baselineSize, const char* delta, uint32_t deltaSize, uint32_t snapshotSize, std::vector<char>& snapshot)
+{
+    snapshot.assign(baseline, baseline + std::min(baselineSize, snapshotSize));
+    snapshot.resize(snapshotSize, 0);
+
+    uint32_t position = 0;
+    uint32_t offset = 0;
+    while(offset < deltaSize)
+    {
+        uint32_t unchanged;
+        uint32_t changed;
+        if(!readVarint(delta, deltaSize, offset, unchanged)
+            || !readVarint(delta, deltaSize, offset, changed)
+            || unchanged > snapshotSize - position
+            || changed > snapshotSize - position - unchanged
+            || changed > deltaSize - offset)
+        {
+            return false;
+        }
+
+        position += unchanged;
+        for(uint32_t i = 0; i < changed; ++i)
+        {
+            snapshot[position + i] ^= delta[offset + i];
+        }
+        position += changed;
+        offset += changed;
+    }
+    return true;
+}
+
+GDT::SnapshotReplicator::Peer& GDT::SnapshotReplicator::peerOf(ConnectionHandle peer)
+{
+    if(peer.index >= peers.size())
+    {
+        peers.resize(peer.index + 1);
+    }
+
+    Peer& state = peers[peer.index];
+    if(!state.isActive || state.generation != peer.generation)
+    {
+        state = Peer();
+        state.isActive = true;
+        state.generation = peer.generation;
+    }
+    return state;
+}
+
+void GDT::SnapshotReplicator::acked(ConnectionHandle peer, uint32_t sequence)
+{
+    if(peer.index >= peers.size())
+    {
+        return;
+    }
+
+    Peer& state = peers[peer.index];
+    if(!state.isActive || state.generation != peer.generation)
+    {
+        return;
+    }
+
+    Entry& entry = state.sent[sequence % GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE];
+    if(entry.sequence != sequence)
+    {
+        // no longer in the history
+        return;
+    }
+    entry.isAcked = true;
+    if(entry.fullSequence == sequence
+        && sequence - state.ackedFullSequence - 1 < 0x7FFFFFFF)
+    {
+        state.ackedFullSequence = sequence;
+    }
+}
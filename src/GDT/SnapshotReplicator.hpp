@@ -0,0 +1,162 @@
+#ifndef GDT_SNAPSHOT_REPLICATOR_HPP
+#define GDT_SNAPSHOT_REPLICATOR_HPP
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "NetworkConnection.hpp"
+
+namespace GDT
+{
+
+/// Sends snapshots of game state to peers as deltas against snapshots they
+/// acked.
+/**
+    Every snapshot sent to a peer is kept in a history of the last 32
+    snapshots sent to it, and sent with NetworkConnection::sendTrackedPacket.
+    Once the peer acks one of them, later snapshots are sent as the bytes
+    that differ from it (XORed against it, with runs of unchanged bytes left
+    out), and the peer rebuilds them from its own copy of that snapshot. Until
+    a snapshot is acked, or if the acked ones are too old, the whole snapshot
+    is sent. Snapshots that fit in one datagram are never resent; the next one
+    replaces a lost one. Larger ones, usually whole snapshots, are sent in
+    fragments that are resent until acked like RELIABLE_UNORDERED messages,
+    even once newer snapshots were sent (see NetworkConnection::sendPacket).
+
+    An ack only tells that the packet arrived, not that the peer decoded it,
+    i.e. if it was not passed to SnapshotReplicator::receivedSnapshot. So the
+    whole snapshot is also sent once every 32 snapshots. Until the peer acks
+    it, deltas go on against the latest acked snapshot; after that, only
+    against it or snapshots made from it, to recover from a baseline the peer
+    does not have.
+
+    The replicator sets the acked callback of the NetworkConnection (see
+    NetworkConnection::setHandleAckedCallback). Packets received from a peer
+    that start with the tag of the replicator are passed to
+    SnapshotReplicator::receivedSnapshot to get the snapshots back, so other
+    packets sent on the same connection must not start with that byte.
+
+    Snapshots that keep their fields at fixed offsets compress best, since
+    unchanged fields then line up with the baseline.
+*/
+class SnapshotReplicator
+{
+public:
+    using ConnectionHandle = NetworkConnection::ConnectionHandle;
+
+    /// Bytes and snapshots sent since construction or the last reset.
+    struct Counters
+    {
+        Counters();
+
+        /// The bytes of all sent snapshots before encoding.
+        uint64_t snapshotBytes;
+        /// The bytes of all sent snapshot packets.
+        uint64_t sentBytes;
+        /// The snapshots sent as deltas against an acked snapshot.
+        uint64_t deltaSnapshots;
+        /// The snapshots sent whole because no baseline was acked or a whole
+        /// one was due.
+        uint64_t fullSnapshots;
+    };
+
+    /// Sets the acked callback of "connection".
+    /**
+        \param tag The first byte of every snapshot packet.
+    */
+    SnapshotReplicator(NetworkConnection& connection, char tag = 'S');
+    /// Clears the acked callback of the connection.
+    ~SnapshotReplicator();
+
+    SnapshotReplicator(const SnapshotReplicator& other) = delete;
+    SnapshotReplicator& operator=(const SnapshotReplicator& other) = delete;
+
+    /// Sends a snapshot to a connected peer, as a delta against the latest
+    /// usable snapshot it acked if there is one.
+    void sendSnapshot(const std::vector<char>& snapshot, ConnectionHandle peer);
+
+    /// Returns true if a received packet starts with the tag of this
+    /// replicator.
+    bool isSnapshot(const char* data, uint32_t count) const;
+
+    /// Decodes a received snapshot packet.
+    /**
+        The snapshot is kept as a baseline for later deltas even if it is
+        older than one received before.
+
+        \return false if the packet is malformed, its baseline is not known,
+            or it is not newer than the last snapshot returned for the peer,
+            in which case "snapshot" is left unchanged.
+    */
+    bool receivedSnapshot(const char* data, uint32_t count, ConnectionHandle peer, std::vector<char>& snapshot);
+
+    /// Forgets the history of a peer, i.e. once it disconnected.
+    void removePeer(ConnectionHandle peer);
+
+    Counters getCounters() const;
+    void resetCounters();
+
+    /// Appends the delta from "baseline" to "snapshot" to "delta".
+    /**
+        The delta is a sequence of runs, each a variable length count of
+        bytes equal to the baseline followed by a variable length count of
+        bytes XORed with the baseline, and those bytes. Bytes past the end of
+        the baseline are XORed with 0.
+    */
+    static void encodeDelta(const char* baseline, uint32_t baselineSize, const char* snapshot, uint32_t snapshotSize, std::vector<char>& delta);
+
+    /// Applies a delta made by SnapshotReplicator::encodeDelta to "baseline".
+    /**
+        \return false if the delta is malformed.
+    */
+    static bool decodeDelta(const char* baseline, uint32_t baselineSize, const char* delta, uint32_t deltaSize, uint32_t snapshotSize, std::vector<char>& snapshot);
+
+private:
+    struct Entry
+    {
+        Entry();
+
+        /// The sequence of the snapshot in data, or 0 if there is none.
+        uint32_t sequence;
+        /// Of sent snapshots, the whole snapshot it was made from through its
+        /// baselines, itself if it was sent whole.
+        uint32_t fullSequence;
+        /// Of sent snapshots, true once the peer acked it.
+        bool isAcked;
+        std::vector<char> data;
+    };
+
+    struct Peer
+    {
+        Peer();
+
+        bool isActive;
+        uint32_t generation;
+        uint32_t nextSequence;
+        /// The latest snapshot sent whole because one was due, or 0.
+        uint32_t fullSequence;
+        /// The latest snapshot sent whole that the peer acked, or 0.
+        uint32_t ackedFullSequence;
+        /// The latest snapshot returned by receivedSnapshot, or 0.
+        uint32_t receivedSequence;
+        std::array<Entry, GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE> sent;
+        std::array<Entry, GDT_INTERNAL_NETWORK_SNAPSHOT_HISTORY_SIZE> received;
+    };
+
+    NetworkConnection& connection;
+    char tag;
+    // indexed by the index of the handle of each peer
+    std::vector<Peer> peers;
+    Counters counters;
+
+    /// Returns the state of "peer", starting over if it is a new peer.
+    Peer& peerOf(ConnectionHandle peer);
+
+    void acked(ConnectionHandle peer, uint32_t sequence);
+
+};
+
+} // namespace GDT
+
+#endif
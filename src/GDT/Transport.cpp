@@ -0,0 +1,18 @@
+#include "Transport.hpp"
+
+GDT::Transport::Options::Options() :
+broadcast(false),
+reusePort(false),
+dontFragment(false)
+{}
+
+GDT::Transport::~Transport()
+{}
+
+bool GDT::Transport::isDontFragmentSet() const
+{
+    return false;
+}
+
+void GDT::Transport::setPacingRate(uint32_t)
+{}
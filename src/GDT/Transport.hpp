@@ -0,0 +1,105 @@
+#ifndef GDT_TRANSPORT_HPP
+#define GDT_TRANSPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Internal/NetworkIdentifiers.hpp"
+
+namespace GDT
+{
+
+/// Moves the datagrams of a NetworkConnection to and from its peers.
+/**
+    A NetworkConnection opens its transport when it opens its socket (on the
+    first update or NetworkConnection::startThread after construction or
+    reset), and only calls it from the thread that updates it, so a
+    transport needs no locking of its own. Peers are identified by an IPv4
+    address and a port in host byte order, whatever the transport uses.
+
+    GDT::UdpTransport sends over a UDP socket and is used unless
+    NetworkConnection::setTransport is given another. GDT::LoopbackTransport
+    passes datagrams between NetworkConnections of the same process in
+    memory.
+*/
+class Transport
+{
+public:
+    using SendBatch = GDT::Internal::Network::SendBatch;
+    using DatagramBuffers = GDT::Internal::Network::DatagramBuffers;
+    using SocketCounters = GDT::Internal::Network::SocketCounters;
+
+    /// How the NetworkConnection wants the transport opened.
+    struct Options
+    {
+        Options();
+
+        /// Datagrams may be sent to the broadcast address.
+        bool broadcast;
+        /// The port may be shared with other transports bound to it.
+        bool reusePort;
+        /// Datagrams must not be fragmented on the way, so that the path
+        /// MTU can be discovered.
+        bool dontFragment;
+    };
+
+    virtual ~Transport();
+
+    /// Binds to "port", or to any free port if it is 0.
+    /**
+        \return false if the transport could not be opened, in which case it
+            is left closed.
+    */
+    virtual bool open(unsigned short port, const Options& options) = 0;
+
+    /// Closes the transport if it is open.
+    virtual void close() = 0;
+
+    /// Sends the datagrams of a prepared batch.
+    /**
+        Sets the sentBytes of every entry, negative if it failed to send,
+        and counts the datagrams sent and calls made in "counters".
+    */
+    virtual void send(SendBatch& batch, SocketCounters& counters) = 0;
+
+    /// Sends one datagram.
+    /**
+        \return The bytes sent, or a negative value if it failed to send.
+    */
+    virtual long int send(const char* data, std::size_t size, uint32_t address, uint16_t port, SocketCounters& counters) = 0;
+
+    /// Reads up to "count" received datagrams without blocking.
+    /**
+        Datagram i is stored at buffers.at(i), its size in buffers.sizes[i]
+        and its sender in buffers.addresses[i]. "count" is at most
+        buffers.count.
+
+        \return The number of datagrams read, 0 if none are pending, or a
+            negative value if reading failed for one datagram (i.e. ICMP port
+            unreachable) but more may be pending.
+    */
+    virtual int receive(DatagramBuffers& buffers, unsigned int count, SocketCounters& counters) = 0;
+
+    /// Blocks until a datagram can be received or maxWait seconds have
+    /// passed.
+    /**
+        Waits until a datagram is received if maxWait is negative, and only
+        checks if it is 0.
+    */
+    virtual void wait(float maxWait) = 0;
+
+    /// Returns true if the transport was opened with Options::dontFragment
+    /// and can keep datagrams from being fragmented.
+    virtual bool isDontFragmentSet() const;
+
+    /// Limits the bytes per second sent, ~0 for no limit.
+    /**
+        Only a hint for the network below; does nothing by default.
+    */
+    virtual void setPacingRate(uint32_t bytesPerSecond);
+
+};
+
+} // namespace GDT
+
+#endif
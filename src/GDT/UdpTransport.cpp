@@ -0,0 +1,379 @@
+#include "UdpTransport.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <unistd.h>
+
+GDT::UdpTransport::UdpTransport() :
+socketHandle(-1),
+#ifdef GDT_INTERNAL_NETWORK_HAS_EPOLL
+epollHandle(-1),
+timerHandle(-1),
+#endif
+isOpen(false),
+dontFragment(false)
+{}
+
+GDT::UdpTransport::~UdpTransport()
+{
+    close();
+}
+
+bool GDT::UdpTransport::open(unsigned short port, const Options& options)
+{
+    close();
+
+    // get socket handle (file descriptor)
+    socketHandle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(socketHandle <= 0)
+    {
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to get socket!" << std::endl;
+#endif
+        return false;
+    }
+    // closes what was opened so far on failure
+    isOpen = true;
+
+    // set socket info
+    sockaddr_in socketInfo = sockaddr_in();
+    socketInfo.sin_family = AF_INET;
+    socketInfo.sin_addr.s_addr = INADDR_ANY;
+    socketInfo.sin_port = htons(port);
+
+#ifdef GDT_INTERNAL_NETWORK_HAS_REUSEPORT
+    if(options.reusePort)
+    {
+        // share the port with the other SO_REUSEPORT sockets bound to it
+        int enabled = 1;
+        if(setsockopt(socketHandle, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) != 0)
+        {
+            close();
+#ifndef NDEBUG
+            std::cout << "ERROR: Failed to set SO_REUSEPORT!" << std::endl;
+#endif
+            return false;
+        }
+    }
+#else
+    if(options.reusePort)
+    {
+        std::clog << "Warning: SO_REUSEPORT is not supported on this platform!" << std::endl;
+    }
+#endif
+
+    // bind socketInfo to socket
+    if(bind(socketHandle, (const sockaddr*) &socketInfo, sizeof(sockaddr_in)) < 0)
+    {
+        close();
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to bind socket!" << std::endl;
+#endif
+        return false;
+    }
+
+    // set nonblocking
+#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+    int nonblocking = 1;
+    if(fcntl(socketHandle, F_SETFL, O_NONBLOCK, nonblocking) == -1)
+    {
+        close();
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to set socket non-blocking!" << std::endl;
+#endif
+        return false;
+    }
+#else
+    DWORD nonblocking = 1;
+    if(ioctlsocket(socketHandle, FIONBIO, &nonblocking) != 0)
+    {
+        close();
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to set socket non-blocking!" << std::endl;
+#endif
+        return false;
+    }
+#endif
+
+    if(options.broadcast)
+    {
+        // set enable broadcast
+#if PLATFORM == PLATFORM_WINDOWS
+        char enabled = 1;
+#else
+        int enabled = 1;
+#endif
+        setsockopt(socketHandle, SOL_SOCKET, SO_BROADCAST, &enabled, sizeof(enabled));
+    }
+
+    dontFragment = false;
+    if(options.dontFragment)
+    {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+        // set DF without limiting datagrams to the path MTU the kernel knows
+        int value = IP_PMTUDISC_PROBE;
+        dontFragment = setsockopt(socketHandle, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) == 0;
+#elif defined(IP_DONTFRAG)
+        int value = 1;
+        dontFragment = setsockopt(socketHandle, IPPROTO_IP, IP_DONTFRAG, &value, sizeof(value)) == 0;
+#elif defined(IP_DONTFRAGMENT)
+        DWORD value = 1;
+        dontFragment = setsockopt(socketHandle, IPPROTO_IP, IP_DONTFRAGMENT, (const char*)&value, sizeof(value)) == 0;
+#endif
+    }
+
+#ifdef GDT_INTERNAL_NETWORK_HAS_EPOLL
+    // wait for datagrams and timeouts with one epoll_wait
+    epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    timerHandle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = socketHandle;
+    bool added = epollHandle >= 0 && timerHandle >= 0
+        && epoll_ctl(epollHandle, EPOLL_CTL_ADD, socketHandle, &event) == 0;
+    event.data.fd = timerHandle;
+    added = added && epoll_ctl(epollHandle, EPOLL_CTL_ADD, timerHandle, &event) == 0;
+    if(!added)
+    {
+        close();
+#ifndef NDEBUG
+        std::cout << "ERROR: Failed to set up epoll!" << std::endl;
+#endif
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void GDT::UdpTransport::close()
+{
+    if(!isOpen)
+    {
+        return;
+    }
+
+#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+    ::close(socketHandle);
+#else
+    closesocket(socketHandle);
+#endif
+    socketHandle = -1;
+#ifdef GDT_INTERNAL_NETWORK_HAS_EPOLL
+    if(epollHandle >= 0)
+    {
+        ::close(epollHandle);
+    }
+    if(timerHandle >= 0)
+    {
+        ::close(timerHandle);
+    }
+    epollHandle = -1;
+    timerHandle = -1;
+#endif
+    isOpen = false;
+    dontFragment = false;
+}
+
+void GDT::UdpTransport::send(SendBatch& batch, SocketCounters& counters)
+{
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    unsigned int sent = 0;
+    while(sent < batch.entries.size())
+    {
+        unsigned int count = batch.entries.size() - sent;
+        if(count > GDT_INTERNAL_NETWORK_SEND_BATCH_MAX_SIZE)
+        {
+            count = GDT_INTERNAL_NETWORK_SEND_BATCH_MAX_SIZE;
+        }
+
+        int result = sendmmsg(socketHandle,
+            batch.headers.data() + sent,
+            count,
+            0);
+        ++counters.sendCalls;
+
+        if(result < 0)
+        {
+            // the first datagram failed, skip it and send the rest
+            batch.entries[sent].sentBytes = -1;
+            ++sent;
+            continue;
+        }
+
+        for(int i = 0; i < result; ++i)
+        {
+            batch.entries[sent + i].sentBytes = batch.headers[sent + i].msg_len;
+        }
+        counters.sentDatagrams += result;
+        sent += result;
+    }
+#elif PLATFORM != PLATFORM_WINDOWS
+    for(unsigned int i = 0; i < batch.entries.size(); ++i)
+    {
+        msghdr header = msghdr();
+        header.msg_name = &batch.addresses[i];
+        header.msg_namelen = sizeof(sockaddr_in);
+        header.msg_iov = &batch.iovecs[i * 2];
+        header.msg_iovlen = batch.entries[i].payloadSize == 0 ? 1 : 2;
+
+        SendBatch::Entry& entry = batch.entries[i];
+        entry.sentBytes = sendmsg(socketHandle, &header, 0);
+        ++counters.sendCalls;
+        if(entry.sentBytes >= 0)
+        {
+            ++counters.sentDatagrams;
+        }
+    }
+#else
+    for(unsigned int i = 0; i < batch.entries.size(); ++i)
+    {
+        SendBatch::Entry& entry = batch.entries[i];
+        const char* data = batch.at(i);
+        if(entry.payloadSize != 0)
+        {
+            batch.contiguous.assign(data, data + entry.size);
+            batch.contiguous.insert(batch.contiguous.end(), entry.payload, entry.payload + entry.payloadSize);
+            data = batch.contiguous.data();
+        }
+        entry.sentBytes = sendto(socketHandle,
+            data,
+            batch.sizeOf(i),
+            0,
+            (sockaddr*) &batch.addresses[i],
+            sizeof(sockaddr_in));
+        ++counters.sendCalls;
+        if(entry.sentBytes >= 0)
+        {
+            ++counters.sentDatagrams;
+        }
+    }
+#endif
+}
+
+long int GDT::UdpTransport::send(const char* data, std::size_t size, uint32_t address, uint16_t port, SocketCounters& counters)
+{
+    sockaddr_in destination = sockaddr_in();
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(address);
+    destination.sin_port = htons(port);
+    long int sentBytes = sendto(socketHandle,
+        data,
+        size,
+        0,
+        (sockaddr*) &destination,
+        sizeof(sockaddr_in));
+    ++counters.sendCalls;
+    if(sentBytes >= 0)
+    {
+        ++counters.sentDatagrams;
+    }
+    return sentBytes;
+}
+
+int GDT::UdpTransport::receive(DatagramBuffers& buffers, unsigned int count, SocketCounters& counters)
+{
+#if PLATFORM == PLATFORM_WINDOWS
+    typedef int socklen_t;
+#endif
+#ifdef GDT_INTERNAL_NETWORK_HAS_MMSG
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        // the kernel overwrites these on every call
+        buffers.headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        buffers.headers[i].msg_hdr.msg_flags = 0;
+    }
+
+    int result = recvmmsg(socketHandle,
+        buffers.headers.data(),
+        count,
+        MSG_DONTWAIT,
+        nullptr);
+    ++counters.receiveCalls;
+
+    if(result < 0)
+    {
+        return GDT::Internal::Network::lastErrorIsWouldBlock() ? 0 : -1;
+    }
+
+    for(int i = 0; i < result; ++i)
+    {
+        buffers.sizes[i] = buffers.headers[i].msg_len;
+    }
+    counters.receivedDatagrams += result;
+    return result;
+#else
+    (void)count;
+    sockaddr_in& receivedData = buffers.addresses[0];
+    socklen_t receivedDataSize = sizeof(receivedData);
+
+    int bytes = recvfrom(socketHandle,
+        buffers.at(0),
+        buffers.size,
+        0,
+        (sockaddr*) &receivedData,
+        &receivedDataSize);
+    ++counters.receiveCalls;
+
+    if(bytes < 0)
+    {
+        return GDT::Internal::Network::lastErrorIsWouldBlock() ? 0 : -1;
+    }
+
+    buffers.sizes[0] = bytes;
+    ++counters.receivedDatagrams;
+    return 1;
+#endif
+}
+
+void GDT::UdpTransport::wait(float maxWait)
+{
+#ifdef GDT_INTERNAL_NETWORK_HAS_EPOLL
+    // a zero timerfd is disarmed, so negative waits wait forever and zero
+    // waits just check the socket
+    itimerspec timeout = itimerspec();
+    if(maxWait > 0.0f)
+    {
+        long int nanoseconds = (long int)(maxWait * 1.0e9f);
+        timeout.it_value.tv_sec = nanoseconds / 1000000000;
+        timeout.it_value.tv_nsec = nanoseconds % 1000000000;
+        if(timeout.it_value.tv_sec == 0 && timeout.it_value.tv_nsec == 0)
+        {
+            timeout.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(timerHandle, 0, &timeout, nullptr);
+
+    // setting the timer also clears its previous expiration, so it does not
+    // need to be read
+    epoll_event events[2];
+    epoll_wait(epollHandle, events, 2, maxWait == 0.0f ? 0 : -1);
+#elif PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+    pollfd socketPoll = pollfd();
+    socketPoll.fd = socketHandle;
+    socketPoll.events = POLLIN;
+    poll(&socketPoll, 1, maxWait < 0.0f ? -1 : (int)std::ceil(maxWait * 1000.0f));
+#else
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(socketHandle, &readSet);
+    timeval timeout;
+    timeout.tv_sec = maxWait < 0.0f ? 0 : (long)maxWait;
+    timeout.tv_usec = maxWait < 0.0f ? 0 : (long)((maxWait - (long)maxWait) * 1.0e6f);
+    select(socketHandle + 1, &readSet, nullptr, nullptr, maxWait < 0.0f ? nullptr : &timeout);
+#endif
+}
+
+bool GDT::UdpTransport::isDontFragmentSet() const
+{
+    return dontFragment;
+}
+
+void GDT::UdpTransport::setPacingRate(uint32_t bytesPerSecond)
+{
+#ifdef GDT_INTERNAL_NETWORK_HAS_PACING_RATE
+    setsockopt(socketHandle, SOL_SOCKET, SO_MAX_PACING_RATE, &bytesPerSecond, sizeof(bytesPerSecond));
+#else
+    (void)bytesPerSecond;
+#endif
+}
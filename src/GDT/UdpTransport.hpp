@@ -0,0 +1,54 @@
+#ifndef GDT_UDP_TRANSPORT_HPP
+#define GDT_UDP_TRANSPORT_HPP
+
+#include "Transport.hpp"
+
+namespace GDT
+{
+
+/// Sends and receives datagrams over a non-blocking UDP socket.
+/**
+    Batches are sent with sendmmsg and received with recvmmsg on Linux, and
+    waits use epoll and a timerfd there (poll or select elsewhere). This is
+    the transport of every NetworkConnection unless
+    NetworkConnection::setTransport was given another.
+*/
+class UdpTransport : public Transport
+{
+public:
+    UdpTransport();
+    ~UdpTransport();
+
+    UdpTransport(const UdpTransport& other) = delete;
+    UdpTransport& operator=(const UdpTransport& other) = delete;
+
+    bool open(unsigned short port, const Options& options) override;
+    void close() override;
+
+    void send(SendBatch& batch, SocketCounters& counters) override;
+    long int send(const char* data, std::size_t size, uint32_t address, uint16_t port, SocketCounters& counters) override;
+
+    int receive(DatagramBuffers& buffers, unsigned int count, SocketCounters& counters) override;
+
+    void wait(float maxWait) override;
+
+    bool isDontFragmentSet() const override;
+
+    /// Sets SO_MAX_PACING_RATE on Linux, so that the fq queueing discipline
+    /// spaces out datagrams sent together.
+    void setPacingRate(uint32_t bytesPerSecond) override;
+
+private:
+    int socketHandle;
+#ifdef GDT_INTERNAL_NETWORK_HAS_EPOLL
+    int epollHandle;
+    int timerHandle;
+#endif
+    bool isOpen;
+    bool dontFragment;
+
+};
+
+} // namespace GDT
+
+#endif
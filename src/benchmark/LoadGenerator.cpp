@@ -0,0 +1,194 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <GDT/NetworkConnection.hpp>
+#include <GDT/LoopbackTransport.hpp>
+
+// Drives one SERVER and many CLIENT NetworkConnections over loopback, each
+// client sending packets to the server at a fixed rate. Every packet carries
+// the time it was queued, so the server measures the delay from sendPacket
+// to its received callback. Optionally, the connections are joined by a
+// LoopbackTransport instead of sockets, to measure NetworkConnection without
+// the system calls.
+
+void printUsage()
+{
+    std::cout << "USAGE:"
+        "\n  ./LoadGeneratorBenchmark [server_port] [client_count] [packets_per_second]"
+        " [packet_size] [seconds] [is_received_checked] [is_loopback_transport]"
+        "\n\npackets_per_second is per client, packet_size is at least 8."
+        << std::endl;
+}
+
+namespace
+{
+    int64_t nowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        if(sorted.empty())
+        {
+            return 0.0;
+        }
+        return sorted[std::min<std::size_t>(sorted.size() * fraction, sorted.size() - 1)];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 8)
+    {
+        printUsage();
+        return 1;
+    }
+
+    unsigned short serverPort = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 12102;
+    unsigned int clientCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    float packetRate = argc > 3 ? std::strtof(argv[3], nullptr) : 60.0f;
+    unsigned int packetSize = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64;
+    float seconds = argc > 5 ? std::strtof(argv[5], nullptr) : 5.0f;
+    bool isReceivedChecked = argc > 6 ? std::strtoul(argv[6], nullptr, 10) != 0 : true;
+    bool isLoopbackTransport = argc > 7 ? std::strtoul(argv[7], nullptr, 10) != 0 : false;
+    if(serverPort == 0 || clientCount == 0 || packetRate <= 0.0f || packetSize < 8 || seconds <= 0.0f)
+    {
+        printUsage();
+        return 2;
+    }
+
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    auto setTransport = [isLoopbackTransport, &network] (Connection& connection) {
+        if(isLoopbackTransport)
+        {
+            connection.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+        }
+    };
+
+    Connection server(Connection::SERVER, serverPort);
+    server.coalescePackets = true;
+    setTransport(server);
+    std::vector<std::unique_ptr<Connection> > clients;
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        clients.emplace_back(new Connection(Connection::CLIENT, serverPort));
+        clients.back()->coalescePackets = true;
+        setTransport(*clients.back());
+        clients.back()->connectToServer(127, 0, 0, 1);
+    }
+
+    bool isMeasuring = false;
+    uint64_t receivedPackets = 0;
+    uint64_t receivedBytes = 0;
+    uint64_t resentPackets = 0;
+    std::vector<double> latencies;
+    latencies.reserve(clientCount * packetRate * seconds);
+    server.setReceivedCallback([&] (const char* data, uint32_t count, uint32_t, bool, bool isResent, bool) {
+        if(!isMeasuring || count < 8)
+        {
+            return;
+        }
+        int64_t sentTime;
+        std::memcpy(&sentTime, data, 8);
+        latencies.push_back((nowNanoseconds() - sentTime) / 1000.0);
+        ++receivedPackets;
+        receivedBytes += count;
+        if(isResent)
+        {
+            ++resentPackets;
+        }
+    });
+
+    const float deltaTime = 1.0f / 120.0f;
+    auto tick = [&] () {
+        server.update(deltaTime);
+        for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+        {
+            (*iter)->update(deltaTime);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    while(server.getConnected().size() < clientCount
+        || std::any_of(clients.begin(), clients.end(), [] (const std::unique_ptr<Connection>& client) {
+            return client->getConnected().empty();
+        }))
+    {
+        if(std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+        {
+            std::cerr << "Failed to connect over loopback!" << std::endl;
+            return 3;
+        }
+        tick();
+        std::this_thread::sleep_for(std::chrono::duration<float>(deltaTime));
+    }
+
+    const uint32_t serverAddress = 0x7F000001;
+    std::vector<char> packet(packetSize, 'x');
+    uint64_t sentPackets = 0;
+    uint64_t serverDatagramsBefore = server.getSocketCounters().receivedDatagrams;
+    std::clock_t cpuStart = std::clock();
+    start = std::chrono::steady_clock::now();
+    auto nextTick = start;
+    isMeasuring = true;
+
+    // send for the given time, then let the last packets arrive
+    double owed = 0.0;
+    while(true)
+    {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        if(elapsed >= seconds + 1.0)
+        {
+            break;
+        }
+        if(elapsed < seconds)
+        {
+            owed += packetRate * deltaTime;
+            for(; owed >= 1.0; owed -= 1.0)
+            {
+                for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+                {
+                    int64_t sentTime = nowNanoseconds();
+                    std::memcpy(packet.data(), &sentTime, 8);
+                    (*iter)->sendPacket(std::vector<char>(packet), serverAddress, isReceivedChecked);
+                    ++sentPackets;
+                }
+            }
+        }
+        tick();
+
+        nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(deltaTime));
+        std::this_thread::sleep_until(nextTick);
+    }
+
+    double cpuSeconds = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    uint64_t serverDatagrams = server.getSocketCounters().receivedDatagrams - serverDatagramsBefore;
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << "Clients:                 " << clientCount
+        << "\nPackets sent:            " << sentPackets
+        << "\nPackets received:        " << receivedPackets
+        << "\nResent packets received: " << resentPackets
+        << "\nDatagrams received:      " << serverDatagrams
+        << "\nPackets/s:               " << receivedPackets / seconds
+        << "\nBytes/s:                 " << receivedBytes / seconds
+        << "\nLatency p50 (us):        " << percentile(latencies, 0.5)
+        << "\nLatency p99 (us):        " << percentile(latencies, 0.99)
+        << "\nLatency p999 (us):       " << percentile(latencies, 0.999)
+        << "\nCPU per packet (us):     "
+        << (receivedPackets == 0 ? 0.0 : cpuSeconds * 1000000.0 / receivedPackets) << std::endl;
+
+    return 0;
+}
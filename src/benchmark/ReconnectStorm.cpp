@@ -0,0 +1,87 @@
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <GDT/NetworkConnection.hpp>
+
+// Measures the worst case time of NetworkConnection::update while many
+// broadcasting clients retry to connect to a server that never answers, with
+// every update due for a connection attempt. Each attempt needs the
+// broadcast address, which used to be resolved in update, and is compared to
+// the time getBroadcastAddress takes by itself.
+
+void printUsage()
+{
+    std::cout << "USAGE:"
+        "\n  ./ReconnectStormBenchmark [server_port] [client_count] [update_count]"
+        << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 4)
+    {
+        printUsage();
+        return 1;
+    }
+
+    unsigned short serverPort = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 12101;
+    unsigned long clientCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 32;
+    unsigned long updateCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100;
+    if(serverPort == 0 || clientCount == 0 || updateCount == 0)
+    {
+        printUsage();
+        return 2;
+    }
+
+    using Connection = GDT::NetworkConnection;
+    std::vector<std::unique_ptr<Connection> > clients;
+    for(unsigned long i = 0; i < clientCount; ++i)
+    {
+        clients.emplace_back(new Connection(Connection::CLIENT, serverPort, 0, true));
+    }
+
+    // a delta time of the retry interval makes every update attempt to
+    // connect
+    const float deltaTime = GDT_INTERNAL_NETWORK_CLIENT_RETRY_TIME_SECONDS;
+    std::vector<double> updateTimes;
+    updateTimes.reserve(clientCount * updateCount);
+    for(unsigned long i = 0; i < updateCount; ++i)
+    {
+        for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+        {
+            auto start = std::chrono::steady_clock::now();
+            (*iter)->update(deltaTime);
+            updateTimes.push_back(std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    const unsigned int lookupCount = 10;
+    double maxLookup = 0.0;
+    for(unsigned int i = 0; i < lookupCount; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        GDT::Internal::Network::getBroadcastAddress();
+        maxLookup = std::max(maxLookup, std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(updateTimes.begin(), updateTimes.end());
+    double total = 0.0;
+    for(auto iter = updateTimes.begin(); iter != updateTimes.end(); ++iter)
+    {
+        total += *iter;
+    }
+
+    std::cout << "Updates:                     " << updateTimes.size()
+        << "\nMean update (us):            " << total / updateTimes.size()
+        << "\n99th percentile update (us): " << updateTimes[updateTimes.size() * 99 / 100]
+        << "\nWorst update (us):           " << updateTimes.back()
+        << "\nWorst uncached lookup (us):  " << maxLookup << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <GDT/NetworkConnection.hpp>
+
+// Counts every heap allocation made by the process.
+namespace
+{
+    std::atomic_uint_fast64_t allocationCount{};
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocationCount;
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void printUsage()
+{
+    std::cout << "USAGE:"
+        "\n  ./SendAllocationsBenchmark [server_port] [send_count] [packet_size]"
+        << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 4)
+    {
+        printUsage();
+        return 1;
+    }
+
+    unsigned short serverPort = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 12100;
+    unsigned long sendCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+    unsigned int packetSize = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 256;
+    if(serverPort == 0 || sendCount == 0)
+    {
+        printUsage();
+        return 2;
+    }
+
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, serverPort);
+    Connection client(Connection::CLIENT, serverPort);
+    client.connectToServer(127, 0, 0, 1);
+
+    uint64_t receivedCount = 0;
+    server.setReceivedCallback([&receivedCount] (const char*, uint32_t, uint32_t, bool, bool, bool) {
+        ++receivedCount;
+    });
+
+    // send intervals are based on deltaTime, so updates are run faster than
+    // real time with a short sleep to let datagrams arrive
+    const float deltaTime = 1.0f / 120.0f;
+    auto tick = [&server, &client, &deltaTime] () {
+        server.update(deltaTime);
+        client.update(deltaTime);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    while(client.getConnected().empty() || server.getConnected().empty())
+    {
+        if(std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+        {
+            std::cerr << "Failed to connect over loopback!" << std::endl;
+            return 3;
+        }
+        tick();
+    }
+
+    std::vector<char> packet(packetSize, 'x');
+    const uint32_t serverAddress = 0x7F000001;
+    std::vector<uint32_t> clients = server.getConnected();
+
+    auto sentDatagrams = [&server, &client] () {
+        return client.getSocketCounters().sentDatagrams
+            + server.getSocketCounters().sentDatagrams;
+    };
+    auto queuePackets = [&] () {
+        if(client.getPacketQueueSize(serverAddress) == 0)
+        {
+            client.sendPacket(std::vector<char>(packet), serverAddress, true);
+        }
+        if(server.getPacketQueueSize(clients[0]) == 0)
+        {
+            server.sendPacket(std::vector<char>(packet), clients[0], true);
+        }
+    };
+    // let every sent packet slot of both sides hold a packet before measuring
+    while(sentDatagrams() < 4 * GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE)
+    {
+        queuePackets();
+        tick();
+    }
+
+    uint64_t sentBefore = sentDatagrams();
+    uint64_t receivedBefore = receivedCount;
+    uint64_t updateAllocations = 0;
+
+    while(sentDatagrams() - sentBefore < sendCount)
+    {
+        // the packet's buffer is allocated when it is queued, only update()
+        // is measured
+        queuePackets();
+
+        uint64_t before = allocationCount;
+        server.update(deltaTime);
+        client.update(deltaTime);
+        updateAllocations += allocationCount - before;
+
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    uint64_t sent = sentDatagrams() - sentBefore;
+
+    std::cout << "Datagrams sent:          " << sent
+        << "\nPackets received:        " << receivedCount - receivedBefore
+        << "\nAllocations in update(): " << updateAllocations
+        << "\nAllocations per send:    "
+        << (sent == 0 ? 0.0 : (double)updateAllocations / sent) << std::endl;
+
+    return updateAllocations == 0 ? 0 : 4;
+}
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <GDT/ShardedNetworkServer.hpp>
+
+// Measures how many datagrams per second a ShardedNetworkServer reads and
+// processes with an increasing number of shards. Sender threads flood the
+// server over loopback from many source ports, with datagrams that pass the
+// protocol check but belong to no connection, so every datagram costs the
+// server a receive, a header parse and a connection lookup.
+
+void printUsage()
+{
+    std::cout << "USAGE:"
+        "\n  ./ShardedServerBenchmark [server_port] [max_shards] [seconds] [sender_threads]"
+        << std::endl;
+}
+
+void sendLoop(unsigned short serverPort, const std::atomic<bool>* running, std::atomic<bool>* failed)
+{
+    // the kernel picks a shard by source address and port, so use many
+    const unsigned int socketCount = 64;
+    std::vector<int> sockets;
+    for(unsigned int i = 0; i < socketCount; ++i)
+    {
+        int handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(handle >= 0)
+        {
+            sockets.push_back(handle);
+        }
+    }
+    if(sockets.empty())
+    {
+        // i.e. out of file descriptors
+        *failed = true;
+        return;
+    }
+
+    sockaddr_in destination = sockaddr_in();
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(serverPort);
+    destination.sin_addr.s_addr = htonl(0x7F000001);
+
+    char data[20] = {};
+    uint32_t temp = htonl(GDT_INTERNAL_NETWORK_PROTOCOL_ID);
+    std::memcpy(data, &temp, 4);
+    temp = htonl(1);
+    std::memcpy(data + 4, &temp, 4);
+
+    for(unsigned int i = 0; *running; ++i)
+    {
+        sendto(sockets[i % sockets.size()], data, sizeof(data), 0, (const sockaddr*)&destination, sizeof(destination));
+    }
+
+    for(auto iter = sockets.begin(); iter != sockets.end(); ++iter)
+    {
+        close(*iter);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 5)
+    {
+        printUsage();
+        return 1;
+    }
+
+    unsigned short serverPort = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 12110;
+    unsigned int maxShards = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    float seconds = argc > 3 ? std::strtof(argv[3], nullptr) : 2.0f;
+    unsigned int senderCount = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 2;
+    if(serverPort == 0 || maxShards == 0 || seconds <= 0.0f || senderCount == 0)
+    {
+        printUsage();
+        return 2;
+    }
+
+    double baseRate = 0.0;
+    for(unsigned int shardCount = 1; shardCount <= maxShards; shardCount *= 2)
+    {
+        GDT::ShardedNetworkServer server(serverPort, shardCount);
+        if(!server.start())
+        {
+            std::cerr << "Failed to start the server on port " << serverPort << "!" << std::endl;
+            return 3;
+        }
+
+        std::atomic<bool> running(true);
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> senders;
+        for(unsigned int i = 0; i < senderCount; ++i)
+        {
+            senders.push_back(std::thread(sendLoop, serverPort, &running, &failed));
+        }
+
+        // let the senders and shards get going before measuring
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        uint64_t before = server.getSocketCounters().receivedDatagrams;
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<float>(seconds));
+        uint64_t received = server.getSocketCounters().receivedDatagrams - before;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        running = false;
+        for(auto iter = senders.begin(); iter != senders.end(); ++iter)
+        {
+            iter->join();
+        }
+        server.stop();
+        if(failed)
+        {
+            std::cerr << "Failed to open the sockets of a sender!" << std::endl;
+            return 3;
+        }
+
+        double rate = received / elapsed;
+        if(shardCount == 1)
+        {
+            baseRate = rate;
+        }
+        std::cout << "Shards: " << server.getShardCount()
+            << "\tDatagrams/s: " << (uint64_t)rate
+            << "\tScaling: " << (baseRate > 0.0 ? rate / baseRate : 0.0) << std::endl;
+    }
+
+    return 0;
+}
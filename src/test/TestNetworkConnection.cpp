@@ -0,0 +1,1586 @@
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include <GDT/NetworkConnection.hpp>
+#include <GDT/ShardedNetworkServer.hpp>
+#include <GDT/LoopbackTransport.hpp>
+
+namespace
+{
+    // Updates both connections over loopback until "done" returns true or
+    // the time limit has passed.
+    bool runUntil(GDT::NetworkConnection& server,
+                  GDT::NetworkConnection& client,
+                  const std::function<bool()>& done,
+                  float timeLimit = 5.0f)
+    {
+        const float deltaTime = 1.0f / 120.0f;
+        for(float timer = 0.0f; timer < timeLimit; timer += deltaTime)
+        {
+            server.update(deltaTime);
+            client.update(deltaTime);
+            if(done())
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(8333));
+        }
+        return false;
+    }
+
+    // A transport whose every read fails, as a closed socket would.
+    class FailingTransport : public GDT::Transport
+    {
+    public:
+        FailingTransport(unsigned int& receiveCalls) :
+        receiveCalls(receiveCalls)
+        {}
+
+        bool open(unsigned short, const Options&) override { return true; }
+        void close() override {}
+        void send(SendBatch&, SocketCounters&) override {}
+        long int send(const char*, std::size_t size, uint32_t, uint16_t, SocketCounters&) override { return size; }
+        int receive(DatagramBuffers&, unsigned int, SocketCounters&) override
+        {
+            ++receiveCalls;
+            return -1;
+        }
+        void wait(float) override {}
+
+    private:
+        unsigned int& receiveCalls;
+    };
+}
+
+TEST(NetworkConnection, SentPacketRing)
+{
+    GDT::Internal::Network::SentPacketRing ring;
+    const uint32_t size = GDT_INTERNAL_NETWORK_SENT_PACKET_RING_SIZE;
+
+    EXPECT_EQ(ring.find(0), nullptr);
+
+    for(uint32_t id = 0xFFFFFFF0; id != 0x10; ++id)
+    {
+        ring.insert(id).data.assign(4, (char)id);
+    }
+
+    for(uint32_t id = 0xFFFFFFF0; id != 0x10; ++id)
+    {
+        auto* packet = ring.find(id);
+        ASSERT_NE(packet, nullptr);
+        EXPECT_EQ(packet->id, id);
+        EXPECT_EQ(packet->data, std::vector<char>(4, (char)id));
+    }
+
+    // storing a packet replaces the one "size" ids before it
+    ring.insert(0x0F + size);
+    EXPECT_EQ(ring.find(0x0F), nullptr);
+    ring.insert(0xFFFFFFF0 + size);
+    EXPECT_EQ(ring.find(0xFFFFFFF0), nullptr);
+    EXPECT_NE(ring.find(0xFFFFFFF0 + size), nullptr);
+    EXPECT_TRUE(ring.find(0xFFFFFFF0 + size)->data.empty());
+}
+
+TEST(NetworkConnection, TimerWheel)
+{
+    GDT::Internal::Network::TimerWheel wheel;
+    std::vector<uint32_t> expired;
+    EXPECT_EQ(wheel.nextExpiry(), UINT64_MAX);
+
+    // expiries on every level, and beyond the last one
+    const std::vector<uint64_t> ticks = {1, 2, 63, 64, 65, 200, 4095, 4096, 5000, 300000, 20000000};
+    wheel.resize(ticks.size() + 1);
+    for(uint32_t i = 0; i < ticks.size(); ++i)
+    {
+        wheel.schedule(i, ticks[i]);
+    }
+    wheel.schedule(ticks.size(), 10);
+    wheel.cancel(ticks.size());
+
+    uint32_t fired = 0;
+    while(fired < ticks.size())
+    {
+        uint64_t next = wheel.nextExpiry();
+        ASSERT_NE(next, UINT64_MAX);
+        ASSERT_LE(next, ticks[fired]);
+        wheel.advance(next, expired);
+        for(auto iter = expired.begin(); iter != expired.end(); ++iter)
+        {
+            EXPECT_EQ(*iter, fired);
+            EXPECT_EQ(wheel.currentTick, ticks[*iter]);
+            ++fired;
+        }
+        expired.clear();
+    }
+    EXPECT_EQ(wheel.count, 0u);
+    EXPECT_EQ(wheel.nextExpiry(), UINT64_MAX);
+
+    // rescheduling replaces the previous expiry, past expiries are due next
+    wheel.schedule(0, wheel.currentTick + 100);
+    wheel.schedule(0, wheel.currentTick + 3);
+    wheel.schedule(1, 0);
+    wheel.advance(wheel.currentTick + 1, expired);
+    EXPECT_EQ(expired, std::vector<uint32_t>(1, 1));
+    expired.clear();
+    wheel.advance(wheel.currentTick + 200, expired);
+    EXPECT_EQ(expired, std::vector<uint32_t>(1, 0));
+}
+
+TEST(NetworkConnection, RateController)
+{
+    GDT::Internal::Network::RateController rate;
+    const std::chrono::milliseconds rtt(100);
+    EXPECT_FLOAT_EQ(rate.sendRate, GDT_INTERNAL_NETWORK_GOOD_SEND_RATE);
+
+    // slow start adds a datagram per round trip for every ack, so the 3
+    // datagrams acked in a round trip at 30 per second double the rate
+    rate.bytesInFlight = 1000;
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+        rate.acked(100, 120.0f, rtt);
+    }
+    EXPECT_EQ(rate.bytesInFlight, 700u);
+    EXPECT_FLOAT_EQ(rate.sendRate, 2.0f * GDT_INTERNAL_NETWORK_GOOD_SEND_RATE);
+
+    // on a low round-trip-time the rate reaches the limit within a round trip
+    GDT::Internal::Network::RateController fastRate;
+    double elapsed = 0.0;
+    while(fastRate.sendRate < 120.0f && elapsed < 1.0)
+    {
+        elapsed += fastRate.sendInterval();
+        fastRate.acked(0, 120.0f, std::chrono::milliseconds(1));
+    }
+    EXPECT_FLOAT_EQ(fastRate.sendRate, 120.0f);
+    EXPECT_LT(elapsed, 0.05);
+
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        rate.acked(0, 120.0f, rtt);
+    }
+    EXPECT_FLOAT_EQ(rate.sendRate, 120.0f);
+    EXPECT_NEAR(rate.sendInterval(), 1.0 / 120.0, 1e-6);
+
+    // losses within one round trip decrease the rate once
+    rate.lost(0, 10.0, rtt);
+    rate.lost(0, 10.05, rtt);
+    EXPECT_FLOAT_EQ(rate.sendRate, 120.0f * GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE);
+    rate.congested(10.1, rtt);
+    EXPECT_FLOAT_EQ(rate.sendRate, 120.0f * GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE * GDT_INTERNAL_NETWORK_SEND_RATE_DECREASE);
+
+    // after a decrease, the 3 datagrams acked in a round trip at 30 per
+    // second add about one datagram per round trip
+    float decreasedRate = rate.sendRate;
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+        rate.acked(0, 120.0f, rtt);
+    }
+    EXPECT_NEAR(rate.sendRate, decreasedRate + 10.0f, 1.0f);
+
+    for(double now = 11.0; now < 20.0; now += 1.0)
+    {
+        rate.congested(now, rtt);
+    }
+    EXPECT_FLOAT_EQ(rate.sendRate, GDT_INTERNAL_NETWORK_MIN_SEND_RATE);
+
+    // the window covers two round trips at the current rate
+    EXPECT_EQ(rate.congestionWindow(std::chrono::milliseconds(1000), 1000), 20000u);
+    EXPECT_EQ(rate.congestionWindow(std::chrono::milliseconds(1), 1000), GDT_INTERNAL_NETWORK_MIN_CONGESTION_WINDOW_DATAGRAMS * 1000u);
+}
+
+TEST(NetworkConnection, RttEstimator)
+{
+    GDT::Internal::Network::RttEstimator estimator;
+    EXPECT_EQ(estimator.retransmitTimeout().count(), GDT_INTERNAL_NETWORK_PACKET_LOST_TIMEOUT_MILLISECONDS);
+
+    // the first sample sets the estimate, half of it the variance
+    estimator.sample(40.0);
+    EXPECT_EQ(estimator.smoothed().count(), 40);
+    EXPECT_EQ(estimator.retransmitTimeout().count(), 40 + 4 * 20);
+
+    // a steady round-trip-time converges to it with no variance, down to
+    // the lowest timeout
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        estimator.sample(30.0);
+    }
+    EXPECT_EQ(estimator.smoothed().count(), 30);
+    EXPECT_NEAR(estimator.rttVariance, 0.0, 0.01);
+    EXPECT_EQ(estimator.retransmitTimeout().count(), GDT_INTERNAL_NETWORK_MIN_RETRANSMIT_TIMEOUT_MILLISECONDS);
+
+    // jitter raises the timeout well above the round-trip-time
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        estimator.sample(i % 2 == 0 ? 10.0 : 90.0);
+    }
+    EXPECT_GT(estimator.retransmitTimeout().count(), 150);
+
+    // a huge round-trip-time is capped
+    estimator.sample(100000.0);
+    EXPECT_EQ(estimator.retransmitTimeout().count(), GDT_INTERNAL_NETWORK_MAX_RETRANSMIT_TIMEOUT_MILLISECONDS);
+}
+
+TEST(NetworkConnection, PathMtu)
+{
+    GDT::Internal::Network::PathMtu pathMtu;
+    const uint32_t headers = GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE;
+    const uint32_t configured = GDT_INTERNAL_NETWORK_DEFAULT_MAX_DATAGRAM_SIZE;
+
+    // the largest size is tried first, and the configured size is used
+    // until something is known
+    EXPECT_EQ(pathMtu.nextProbe(), GDT_INTERNAL_NETWORK_MAX_PATH_MTU - headers);
+    EXPECT_EQ(pathMtu.datagramSize(configured), configured);
+
+    // a size is only given up on after every try of it was lost
+    for(unsigned int i = 0; i < GDT_INTERNAL_NETWORK_PATH_MTU_PROBE_TRIES; ++i)
+    {
+        uint32_t size = pathMtu.nextProbe();
+        EXPECT_EQ(size, GDT_INTERNAL_NETWORK_MAX_PATH_MTU - headers);
+        pathMtu.sent(size);
+        EXPECT_EQ(pathMtu.nextProbe(), 0u);
+        pathMtu.lost(size);
+    }
+
+    // binary search on a path with an MTU of 1400 (i.e. a tunnel)
+    const uint32_t limit = 1400 - headers;
+    unsigned int probes = 0;
+    while(!pathMtu.isDone())
+    {
+        uint32_t size = pathMtu.nextProbe();
+        ASSERT_NE(size, 0u);
+        pathMtu.sent(size);
+        if(size <= limit)
+        {
+            pathMtu.acked(size);
+        }
+        else
+        {
+            pathMtu.lost(size);
+        }
+        ++probes;
+        ASSERT_LT(probes, 100u);
+    }
+    EXPECT_EQ(pathMtu.nextProbe(), 0u);
+    EXPECT_LE(pathMtu.datagramSize(configured), limit);
+    EXPECT_GT(pathMtu.datagramSize(configured), limit - GDT_INTERNAL_NETWORK_PATH_MTU_PRECISION);
+}
+
+TEST(NetworkConnection, Pacer)
+{
+    GDT::Internal::Network::Pacer pacer;
+    pacer.rate = 800.0;
+    const double pacedRate = 800.0 * GDT_INTERNAL_NETWORK_PACING_HEADROOM;
+    EXPECT_DOUBLE_EQ(pacer.gap(), 1.0 / pacedRate);
+
+    // starts with a small burst
+    unsigned int taken = 0;
+    while(pacer.take())
+    {
+        ++taken;
+    }
+    EXPECT_EQ(taken, (unsigned int)GDT_INTERNAL_NETWORK_PACING_MIN_BURST);
+
+    // an update's worth of tokens is added, but not more
+    pacer.refill(0.01);
+    for(taken = 0; pacer.take(); ++taken) {}
+    EXPECT_EQ(taken, (unsigned int)(pacedRate * 0.01));
+
+    // one token per millisecond, but short updates keep the minimum burst
+    pacer.refill(0.001);
+    for(taken = 0; pacer.take(); ++taken) {}
+    EXPECT_EQ(taken, 1u);
+    for(unsigned int i = 0; i < 5; ++i)
+    {
+        pacer.refill(0.001);
+    }
+    for(taken = 0; pacer.take(); ++taken) {}
+    EXPECT_EQ(taken, (unsigned int)GDT_INTERNAL_NETWORK_PACING_MIN_BURST);
+
+    // tokens of a long update are not kept for the following short ones
+    pacer.refill(1.0);
+    pacer.refill(0.001);
+    for(taken = 0; pacer.take(); ++taken) {}
+    EXPECT_EQ(taken, (unsigned int)GDT_INTERNAL_NETWORK_PACING_MIN_BURST);
+}
+
+TEST(NetworkConnection, ImpairmentSimulator)
+{
+    using Simulator = GDT::Internal::Network::ImpairmentSimulator;
+    GDT::Internal::Network::Impairment impairment;
+    impairment.loss = 0.25f;
+    impairment.latency = 50.0f;
+    impairment.jitter = 20.0f;
+    impairment.duplicate = 0.1f;
+    impairment.seed = 7;
+
+    auto run = [&impairment] (std::vector<uint32_t>& released) {
+        Simulator simulator;
+        simulator.configure(impairment);
+        EXPECT_TRUE(simulator.isActive());
+        Simulator::Datagram datagram;
+        for(uint32_t i = 0; i < 1000; ++i)
+        {
+            simulator.send((const char*)&i, 4, nullptr, 0, 0x7F000001, 1, i / 100.0);
+            while(simulator.pop(i / 100.0, datagram))
+            {
+                EXPECT_LE(datagram.due, i / 100.0);
+                uint32_t value;
+                std::memcpy(&value, datagram.data.data(), 4);
+                released.push_back(value);
+            }
+        }
+        while(simulator.pop(100.0, datagram))
+        {
+            uint32_t value;
+            std::memcpy(&value, datagram.data.data(), 4);
+            released.push_back(value);
+        }
+        EXPECT_LT(simulator.nextDue(), 0.0);
+    };
+
+    // the same seed impairs the same way
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> second;
+    run(first);
+    run(second);
+    EXPECT_EQ(first, second);
+
+    // about a quarter is lost, a tenth of the rest is duplicated, and jitter
+    // larger than the send interval reorders some
+    EXPECT_GT(first.size(), 750u * 1.1 - 60);
+    EXPECT_LT(first.size(), 750u * 1.1 + 60);
+    EXPECT_FALSE(std::is_sorted(first.begin(), first.end()));
+
+    // datagrams queue behind each other on a limited link, and are dropped
+    // once too many are queued
+    impairment = GDT::Internal::Network::Impairment();
+    impairment.bandwidth = 1000;
+    impairment.queueLimit = 300;
+    Simulator simulator;
+    simulator.configure(impairment);
+    std::vector<char> data(100);
+    for(unsigned int i = 0; i < 5; ++i)
+    {
+        simulator.send(data.data(), data.size(), nullptr, 0, 0x7F000001, 1, 0.0);
+    }
+    EXPECT_EQ(simulator.held.size(), 3u);
+    EXPECT_DOUBLE_EQ(simulator.nextDue(), 0.1);
+    Simulator::Datagram datagram;
+    EXPECT_FALSE(simulator.pop(0.05, datagram));
+    EXPECT_TRUE(simulator.pop(0.1, datagram));
+
+    simulator.configure(GDT::Internal::Network::Impairment());
+    EXPECT_FALSE(simulator.isActive());
+}
+
+TEST(NetworkConnection, MessageChannel)
+{
+    using MessageChannel = GDT::Internal::Network::MessageChannel;
+    const uint32_t window = GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE;
+
+    // sending stops once a window of messages is unacked
+    MessageChannel sender;
+    uint16_t sequence = 0;
+    for(uint32_t i = 0; i < window; ++i)
+    {
+        std::vector<char> data(1, (char)i);
+        ASSERT_TRUE(sender.push(data, false, sequence));
+        EXPECT_EQ(sequence, i);
+        EXPECT_TRUE(data.empty());
+    }
+    std::vector<char> data(1, 'x');
+    EXPECT_FALSE(sender.push(data, false, sequence));
+    EXPECT_EQ(data.size(), 1u);
+
+    // acking a later message does not move the window, acking the oldest does
+    EXPECT_TRUE(sender.ack(1));
+    EXPECT_FALSE(sender.ack(1));
+    EXPECT_FALSE(sender.push(data, false, sequence));
+    EXPECT_TRUE(sender.ack(0));
+    EXPECT_EQ(sender.oldestUnacked, 2);
+    ASSERT_TRUE(sender.push(data, false, sequence));
+    EXPECT_EQ(sequence, window);
+    // the slot of message 0 now holds message "window"
+    EXPECT_FALSE(sender.isUnacked(0));
+    EXPECT_TRUE(sender.isUnacked(window));
+
+    // unordered messages are delivered once, as soon as they arrive
+    MessageChannel unordered;
+    EXPECT_EQ(unordered.receive(1, "b", 1, false, false), MessageChannel::DELIVERED);
+    EXPECT_EQ(unordered.receive(1, "b", 1, false, false), MessageChannel::DROPPED);
+    EXPECT_EQ(unordered.receive(0, "a", 1, false, false), MessageChannel::DELIVERED);
+    EXPECT_EQ(unordered.nextReceived, 2);
+    EXPECT_EQ(unordered.receive(0, "a", 1, false, false), MessageChannel::DROPPED);
+    EXPECT_EQ(unordered.receive(2 + window, "c", 1, false, false), MessageChannel::DROPPED);
+
+    // ordered messages ahead of a missing one wait for it
+    MessageChannel ordered;
+    std::vector<char> delivered;
+    bool isFragment = true;
+    uint16_t received = 0;
+    EXPECT_EQ(ordered.receive(0xFFFF, "z", 1, true, false), MessageChannel::DROPPED);
+    EXPECT_EQ(ordered.receive(2, "c", 1, true, false), MessageChannel::BUFFERED);
+    EXPECT_EQ(ordered.receive(1, "b", 1, true, false), MessageChannel::BUFFERED);
+    EXPECT_EQ(ordered.receive(1, "b", 1, true, false), MessageChannel::DROPPED);
+    EXPECT_FALSE(ordered.popReceived(delivered, isFragment, received));
+    EXPECT_EQ(ordered.receive(0, "a", 1, true, false), MessageChannel::DELIVERED);
+    ASSERT_TRUE(ordered.popReceived(delivered, isFragment, received));
+    EXPECT_EQ(delivered, std::vector<char>(1, 'b'));
+    ASSERT_TRUE(ordered.popReceived(delivered, isFragment, received));
+    EXPECT_EQ(delivered, std::vector<char>(1, 'c'));
+    EXPECT_FALSE(ordered.popReceived(delivered, isFragment, received));
+    EXPECT_EQ(ordered.nextReceived, 3);
+}
+
+TEST(NetworkConnection, Reassembly)
+{
+    // fragments of a 10 byte message: 4 + 4 + 2 bytes
+    auto fragment = [] (uint16_t index, const std::string& data) {
+        std::vector<char> fragment(GDT_INTERNAL_NETWORK_FRAGMENT_HEADER_SIZE);
+        uint16_t temp = htons(index);
+        std::memcpy(fragment.data(), &temp, 2);
+        temp = htons(3);
+        std::memcpy(fragment.data() + 2, &temp, 2);
+        uint32_t total = htonl(10);
+        std::memcpy(fragment.data() + 4, &total, 4);
+        fragment.insert(fragment.end(), data.begin(), data.end());
+        return fragment;
+    };
+
+    GDT::Internal::Network::MessageChannel channel;
+    std::vector<char> message;
+    std::vector<char> last = fragment(2, "89");
+    std::vector<char> first = fragment(0, "0123");
+    std::vector<char> middle = fragment(1, "4567");
+    std::vector<char> malformed = fragment(1, "456");
+
+    // in any order, starting at sequence 0xFFFF to wrap around
+    EXPECT_FALSE(channel.reassemble(1, last.data(), last.size(), message));
+    EXPECT_FALSE(channel.reassemble(0xFFFF, first.data(), first.size(), message));
+    EXPECT_FALSE(channel.reassemble(0, malformed.data(), malformed.size(), message));
+    ASSERT_TRUE(channel.reassemble(0, middle.data(), middle.size(), message));
+    EXPECT_EQ(std::string(message.begin(), message.end()), "0123456789");
+
+    // the finished reassembly is reused for the next message
+    ASSERT_EQ(channel.reassemblies.size(), 1u);
+    EXPECT_FALSE(channel.reassemblies[0].isActive);
+    EXPECT_FALSE(channel.reassemble(100, first.data(), first.size(), message));
+    EXPECT_EQ(channel.reassemblies.size(), 1u);
+    EXPECT_FALSE(channel.reassemble(200, first.data(), first.size(), message));
+    EXPECT_EQ(channel.reassemblies.size(), 2u);
+}
+
+TEST(NetworkConnection, ReliableChannels)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12097);
+    Connection client(Connection::CLIENT, 12097);
+    client.connectToServer(127, 0, 0, 1);
+    // many small datagrams of a few messages each
+    client.maxDatagramSize = 100;
+
+    std::vector<std::string> ordered;
+    std::vector<std::string> unordered;
+    bool allChecked = true;
+    server.setReceivedCallback([&] (const char* data, uint32_t count, uint32_t, bool, bool, bool isReceivedChecked) {
+        std::string message(data, count);
+        (message[0] == 'o' ? ordered : unordered).push_back(message);
+        allChecked = allChecked && isReceivedChecked;
+    });
+    std::string clientReceived;
+    client.setReceivedCallback([&clientReceived] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        clientReceived.assign(data, count);
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    // more ordered messages than fit in the window at once
+    const unsigned int orderedCount = GDT_INTERNAL_NETWORK_MESSAGE_WINDOW_SIZE + 100;
+    const unsigned int unorderedCount = 50;
+    Connection::ConnectionHandle serverHandle = client.getConnectedHandles().at(0);
+    for(unsigned int i = 0; i < orderedCount; ++i)
+    {
+        std::string message = "o" + std::to_string(i);
+        client.sendMessage(message.c_str(), message.size(), serverHandle, Connection::RELIABLE_ORDERED);
+        if(i < unorderedCount)
+        {
+            message = "u" + std::to_string(i);
+            client.sendMessage(message.c_str(), message.size(), serverHandle, Connection::RELIABLE_UNORDERED);
+        }
+    }
+    std::string reply = "reply";
+    server.sendMessage(reply.c_str(), reply.size(), server.getConnectedHandles().at(0), Connection::RELIABLE_ORDERED);
+
+    ASSERT_TRUE(runUntil(server, client, [&] () {
+        return ordered.size() >= orderedCount && unordered.size() >= unorderedCount && !clientReceived.empty();
+    }, 20.0f));
+
+    EXPECT_TRUE(allChecked);
+    EXPECT_EQ(clientReceived, reply);
+    ASSERT_EQ(ordered.size(), orderedCount);
+    for(unsigned int i = 0; i < orderedCount; ++i)
+    {
+        EXPECT_EQ(ordered[i], "o" + std::to_string(i));
+    }
+    std::sort(unordered.begin(), unordered.end());
+    EXPECT_EQ(std::unique(unordered.begin(), unordered.end()), unordered.end());
+    EXPECT_EQ(unordered.size(), unorderedCount);
+}
+
+TEST(NetworkConnection, LossyLink)
+{
+    // the client reaches the server through a relay that drops every fourth
+    // datagram of the client once dropping is on
+    int relay = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(relay, 0);
+    sockaddr_in relayAddress;
+    std::memset(&relayAddress, 0, sizeof(relayAddress));
+    relayAddress.sin_family = AF_INET;
+    relayAddress.sin_addr.s_addr = htonl(0x7F000001);
+    relayAddress.sin_port = htons(12087);
+    ASSERT_EQ(bind(relay, (const sockaddr*)&relayAddress, sizeof(relayAddress)), 0);
+    fcntl(relay, F_SETFL, O_NONBLOCK);
+
+    sockaddr_in serverAddress = relayAddress;
+    serverAddress.sin_port = htons(12086);
+    sockaddr_in clientAddress;
+    std::memset(&clientAddress, 0, sizeof(clientAddress));
+    bool isDropping = false;
+    unsigned int fromClient = 0;
+    unsigned int dropped = 0;
+    auto relayDatagrams = [&] () {
+        char buffer[2048];
+        sockaddr_in from;
+        socklen_t fromSize = sizeof(from);
+        int bytes;
+        while((bytes = recvfrom(relay, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromSize)) >= 0)
+        {
+            if(from.sin_port == serverAddress.sin_port)
+            {
+                sendto(relay, buffer, bytes, 0, (const sockaddr*)&clientAddress, sizeof(clientAddress));
+            }
+            else
+            {
+                clientAddress = from;
+                if(isDropping && ++fromClient % 4 == 0)
+                {
+                    ++dropped;
+                }
+                else
+                {
+                    sendto(relay, buffer, bytes, 0, (const sockaddr*)&serverAddress, sizeof(serverAddress));
+                }
+            }
+            fromSize = sizeof(from);
+        }
+    };
+
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12086);
+    Connection client(Connection::CLIENT, 12087);
+    client.connectToServer(127, 0, 0, 1);
+    // a few messages per datagram
+    client.maxDatagramSize = 60;
+
+    std::vector<std::string> ordered;
+    server.setReceivedCallback([&ordered] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        ordered.push_back(std::string(data, count));
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&] () {
+        relayDatagrams();
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    // a lost datagram followed by a received one must not be acked, or its
+    // messages are never resent and the ordered channel stalls
+    isDropping = true;
+    const unsigned int count = 100;
+    Connection::ConnectionHandle serverHandle = client.getConnectedHandles().at(0);
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        std::string message = std::to_string(i);
+        client.sendMessage(message.c_str(), message.size(), serverHandle, Connection::RELIABLE_ORDERED);
+    }
+    bool isDelivered = runUntil(server, client, [&] () {
+        relayDatagrams();
+        return ordered.size() >= count;
+    }, 10.0f);
+    close(relay);
+
+    EXPECT_GT(dropped, 0u);
+    ASSERT_TRUE(isDelivered);
+    ASSERT_EQ(ordered.size(), count);
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(ordered[i], std::to_string(i));
+    }
+}
+
+TEST(NetworkConnection, Impairment)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12088);
+    Connection client(Connection::CLIENT, 12088);
+    client.connectToServer(127, 0, 0, 1);
+    // a few messages per datagram, so the stream spans many datagrams
+    client.maxDatagramSize = 60;
+
+    std::vector<std::string> ordered;
+    server.setReceivedCallback([&ordered] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        ordered.push_back(std::string(data, count));
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    // a lossy link that reorders and duplicates in both directions
+    Connection::Impairment impairment;
+    impairment.loss = 0.2f;
+    impairment.latency = 20.0f;
+    impairment.jitter = 20.0f;
+    impairment.duplicate = 0.1f;
+    impairment.seed = 1;
+    client.setImpairment(impairment);
+    impairment.seed = 2;
+    server.setImpairment(impairment);
+
+    // messages streamed over a second, so that lost datagrams are followed
+    // by received ones; a lost datagram taken as acked stalls the stream
+    const unsigned int count = 120;
+    Connection::ConnectionHandle serverHandle = client.getConnectedHandles().at(0);
+    unsigned int sent = 0;
+    ASSERT_TRUE(runUntil(server, client, [&] () {
+        if(sent < count)
+        {
+            std::string message = std::to_string(sent++);
+            client.sendMessage(message.c_str(), message.size(), serverHandle, Connection::RELIABLE_ORDERED);
+        }
+        return ordered.size() >= count;
+    }, 10.0f));
+
+    Connection::ConnectionStats stats = client.getStats(serverHandle);
+    EXPECT_GT(stats.lostDatagrams, 0u);
+    EXPECT_GT(stats.resentMessages, 0u);
+    ASSERT_EQ(ordered.size(), count);
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(ordered[i], std::to_string(i));
+    }
+}
+
+TEST(NetworkConnection, IgnoredOutOfSequence)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12080);
+    Connection client(Connection::CLIENT, 12080);
+    client.connectToServer(127, 0, 0, 1);
+    client.ignoreOutOfSequence = true;
+
+    std::vector<bool> received(100, false);
+    client.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        uint32_t id = std::stoul(std::string(data, count));
+        if(id < received.size())
+        {
+            received[id] = true;
+        }
+    });
+    std::vector<uint32_t> acked;
+    server.setHandleAckedCallback([&acked] (Connection::ConnectionHandle, uint32_t trackingId) {
+        acked.push_back(trackingId);
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    // datagrams of the server are overtaken, and the client drops those
+    // arriving late
+    Connection::Impairment impairment;
+    impairment.reorder = 0.3f;
+    impairment.reorderDelay = 30.0f;
+    impairment.seed = 3;
+    server.setImpairment(impairment);
+    server.coalescePackets = false;
+
+    Connection::ConnectionHandle clientHandle = server.getConnectedHandles().at(0);
+    unsigned int sent = 0;
+    ASSERT_TRUE(runUntil(server, client, [&] () {
+        std::string packet = std::to_string(sent);
+        server.sendTrackedPacket(std::vector<char>(packet.begin(), packet.end()), clientHandle, sent);
+        return ++sent == received.size();
+    }));
+    runUntil(server, client, [] () {
+        return false;
+    }, 2.0f);
+
+    // an ack means the packet was delivered
+    ASSERT_FALSE(acked.empty());
+    EXPECT_GT(client.getStats().total.outOfOrderDatagrams, 0u);
+    for(auto iter = acked.begin(); iter != acked.end(); ++iter)
+    {
+        EXPECT_TRUE(received[*iter]) << "packet " << *iter << " acked but ignored";
+    }
+}
+
+TEST(NetworkConnection, Fragmentation)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12098);
+    Connection client(Connection::CLIENT, 12098);
+    client.connectToServer(127, 0, 0, 1);
+
+    std::vector<std::vector<char> > received;
+    server.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        received.push_back(std::vector<char>(data, data + count));
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    // a level sized packet and an ordered message of many fragments each
+    std::vector<char> packet(100000);
+    std::vector<char> message(30000);
+    for(unsigned int i = 0; i < packet.size(); ++i)
+    {
+        packet[i] = (char)(i * 7);
+    }
+    for(unsigned int i = 0; i < message.size(); ++i)
+    {
+        message[i] = (char)(i * 13);
+    }
+    auto sentBefore = client.getSocketCounters().sentDatagrams;
+    client.sendPacket(packet, 0x7F000001, false);
+    client.sendMessage(message, client.getConnectedHandles().at(0), Connection::RELIABLE_ORDERED);
+
+    ASSERT_TRUE(runUntil(server, client, [&received] () {
+        return received.size() >= 2;
+    }, 20.0f));
+
+    // every datagram fits in maxDatagramSize
+    EXPECT_GE(client.getSocketCounters().sentDatagrams - sentBefore,
+        (packet.size() + message.size()) / client.maxDatagramSize);
+    ASSERT_EQ(received.size(), 2u);
+    EXPECT_TRUE(received[0] == packet || received[1] == packet);
+    EXPECT_TRUE(received[0] == message || received[1] == message);
+}
+
+TEST(NetworkConnection, DiscoverPathMtu)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12099);
+    Connection client(Connection::CLIENT, 12099);
+    client.connectToServer(127, 0, 0, 1);
+    client.setDiscoverPathMtu(true);
+
+    unsigned int receivedCount = 0;
+    server.setReceivedCallback([&receivedCount] (const char*, uint32_t, uint32_t, bool, bool, bool) {
+        ++receivedCount;
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+    Connection::ConnectionHandle serverHandle = client.getConnectedHandles().at(0);
+    EXPECT_EQ(client.getMaxPayload(serverHandle), client.maxDatagramSize - 20);
+    EXPECT_EQ(server.getMaxPayload(server.getConnectedHandles().at(0)), server.maxDatagramSize - 20);
+
+    // loopback takes the largest probe
+    const uint32_t expected = GDT_INTERNAL_NETWORK_MAX_PATH_MTU - GDT_INTERNAL_NETWORK_IP_UDP_HEADER_SIZE - 20;
+    ASSERT_TRUE(runUntil(server, client, [&client, &serverHandle, &expected] () {
+        return client.getMaxPayload(serverHandle) == expected;
+    }));
+
+    // probes are never passed to the callbacks, and packets up to the new
+    // size go in one datagram
+    EXPECT_EQ(receivedCount, 0u);
+    std::vector<char> packet(expected, 'x');
+    client.sendPacket(packet, 0x7F000001, true);
+    ASSERT_TRUE(runUntil(server, client, [&receivedCount] () {
+        return receivedCount == 1;
+    }));
+    EXPECT_EQ(client.getMaxPayload(0x7F000002), 0u);
+}
+
+TEST(NetworkConnection, ReceiveErrors)
+{
+    using Connection = GDT::NetworkConnection;
+    unsigned int receiveCalls = 0;
+    Connection server(Connection::SERVER, 12083);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new FailingTransport(receiveCalls)));
+
+    // without a budget, an update still ends when every read fails
+    server.maxReceivedPerUpdate = 0;
+    server.update(1.0f / 120.0f);
+    EXPECT_EQ(receiveCalls, (unsigned int)GDT_INTERNAL_NETWORK_MAX_RECEIVE_ERRORS);
+
+    server.maxReceivedPerUpdate = 4;
+    receiveCalls = 0;
+    server.update(1.0f / 120.0f);
+    EXPECT_EQ(receiveCalls, 4u);
+}
+
+TEST(NetworkConnection, Coalescing)
+{
+    GDT::NetworkConnection server(GDT::NetworkConnection::SERVER, 12090);
+    GDT::NetworkConnection client(GDT::NetworkConnection::CLIENT, 12090);
+    client.connectToServer(127, 0, 0, 1);
+    client.coalescePackets = true;
+
+    std::vector<std::string> received;
+    server.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        received.push_back(std::string(data, count));
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    const unsigned int packetCount = 50;
+    for(unsigned int i = 0; i < packetCount; ++i)
+    {
+        std::string packet = "packet " + std::to_string(i);
+        client.sendPacket(packet.c_str(), packet.size(), 0x7F000001, true);
+    }
+    auto sentBefore = client.getSocketCounters().sentDatagrams;
+
+    ASSERT_TRUE(runUntil(server, client, [&received, &packetCount] () {
+        return received.size() >= packetCount;
+    }));
+
+    // 50 small packets fit in a single datagram
+    EXPECT_LE(client.getSocketCounters().sentDatagrams - sentBefore, 2u);
+
+    ASSERT_EQ(received.size(), packetCount);
+    for(unsigned int i = 0; i < packetCount; ++i)
+    {
+        EXPECT_EQ(received[i], "packet " + std::to_string(i));
+    }
+}
+
+TEST(NetworkConnection, MovedPacket)
+{
+    GDT::NetworkConnection server(GDT::NetworkConnection::SERVER, 12091);
+    GDT::NetworkConnection client(GDT::NetworkConnection::CLIENT, 12091);
+    client.connectToServer(127, 0, 0, 1);
+
+    std::vector<char> received;
+    server.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        received.assign(data, data + count);
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+
+    std::vector<char> packet(1000);
+    for(unsigned int i = 0; i < packet.size(); ++i)
+    {
+        packet[i] = (char)i;
+    }
+    std::vector<char> expected = packet;
+    client.sendPacket(std::move(packet), 0x7F000001, true);
+
+    ASSERT_TRUE(runUntil(server, client, [&received] () {
+        return !received.empty();
+    }));
+    EXPECT_EQ(received, expected);
+}
+
+TEST(NetworkConnection, EndpointMap)
+{
+    using GDT::Internal::Network::Endpoint;
+    using GDT::Internal::Network::EndpointMap;
+    EndpointMap map;
+
+    EXPECT_EQ(map.find(Endpoint(1, 1)), EndpointMap::NOT_FOUND);
+    EXPECT_FALSE(map.erase(Endpoint(1, 1)));
+
+    // many ports of few addresses, as with clients behind a NAT
+    for(uint32_t i = 0; i < 1000; ++i)
+    {
+        map.insert(Endpoint(0x7F000001 + i % 4, 40000 + i), i);
+    }
+    EXPECT_EQ(map.size(), 1000u);
+
+    for(uint32_t i = 0; i < 1000; i += 2)
+    {
+        EXPECT_TRUE(map.erase(Endpoint(0x7F000001 + i % 4, 40000 + i)));
+    }
+    EXPECT_EQ(map.size(), 500u);
+
+    for(uint32_t i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(map.find(Endpoint(0x7F000001 + i % 4, 40000 + i)),
+            i % 2 == 0 ? EndpointMap::NOT_FOUND : i);
+    }
+
+    map.insert(Endpoint(0x7F000002, 40001), 7);
+    EXPECT_EQ(map.find(Endpoint(0x7F000002, 40001)), 7u);
+    EXPECT_EQ(map.size(), 500u);
+}
+
+TEST(NetworkConnection, ClientsSharingAddress)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12092);
+    Connection clientA(Connection::CLIENT, 12092);
+    Connection clientB(Connection::CLIENT, 12092);
+    clientA.connectToServer(127, 0, 0, 1);
+    clientB.connectToServer(127, 0, 0, 1);
+
+    std::vector<std::pair<Connection::ConnectionHandle, std::string> > serverReceived;
+    server.setHandleReceivedCallback([&serverReceived] (const char* data, uint32_t count, Connection::ConnectionHandle handle, bool, bool, bool) {
+        serverReceived.push_back(std::make_pair(handle, std::string(data, count)));
+    });
+    std::string receivedA;
+    clientA.setReceivedCallback([&receivedA] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        receivedA.assign(data, count);
+    });
+    std::string receivedB;
+    clientB.setReceivedCallback([&receivedB] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        receivedB.assign(data, count);
+    });
+
+    auto runAll = [&] (const std::function<bool()>& done) {
+        const float deltaTime = 1.0f / 120.0f;
+        for(float timer = 0.0f; timer < 5.0f; timer += deltaTime)
+        {
+            server.update(deltaTime);
+            clientA.update(deltaTime);
+            clientB.update(deltaTime);
+            if(done())
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(8333));
+        }
+        return false;
+    };
+
+    ASSERT_TRUE(runAll([&] () {
+        return server.getConnectedHandles().size() == 2
+            && !clientA.getConnected().empty()
+            && !clientB.getConnected().empty();
+    }));
+
+    std::vector<Connection::ConnectionHandle> handles = server.getConnectedHandles();
+    EXPECT_NE(handles[0], handles[1]);
+    EXPECT_EQ(server.getAddress(handles[0]), 0x7F000001u);
+    EXPECT_EQ(server.getAddress(handles[1]), 0x7F000001u);
+    EXPECT_NE(server.getPort(handles[0]), server.getPort(handles[1]));
+    EXPECT_EQ(server.getHandle(0x7F000001, server.getPort(handles[1])), handles[1]);
+
+    clientA.sendPacket(std::string("A").c_str(), 1, 0x7F000001, true);
+    clientB.sendPacket(std::string("B").c_str(), 1, 0x7F000001, true);
+    ASSERT_TRUE(runAll([&serverReceived] () {
+        return serverReceived.size() >= 2;
+    }));
+
+    // reply to each client through the handle its packet arrived from
+    for(auto iter = serverReceived.begin(); iter != serverReceived.end(); ++iter)
+    {
+        server.sendPacket(std::string("to " + iter->second).c_str(), 4, iter->first, true);
+    }
+    ASSERT_TRUE(runAll([&receivedA, &receivedB] () {
+        return !receivedA.empty() && !receivedB.empty();
+    }));
+    EXPECT_EQ(receivedA, "to A");
+    EXPECT_EQ(receivedB, "to B");
+}
+
+TEST(NetworkConnection, StaleHandle)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12093);
+    Connection client(Connection::CLIENT, 12093);
+    client.connectToServer(127, 0, 0, 1);
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+    Connection::ConnectionHandle first = server.getConnectedHandles().at(0);
+    EXPECT_TRUE(first.isValid());
+    EXPECT_TRUE(server.isConnected(first));
+    EXPECT_FALSE(server.isConnected(Connection::ConnectionHandle()));
+
+    // reconnecting reuses the slot, but not the handle
+    server.reset(Connection::SERVER, 12093);
+    client.reset(Connection::CLIENT, 12093);
+    client.connectToServer(127, 0, 0, 1);
+    EXPECT_FALSE(server.isConnected(first));
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+    Connection::ConnectionHandle second = server.getConnectedHandles().at(0);
+    EXPECT_EQ(second.index, first.index);
+    EXPECT_NE(second, first);
+    EXPECT_FALSE(server.isConnected(first));
+    EXPECT_TRUE(server.isConnected(second));
+
+    server.sendPacket(std::vector<char>(4), first, true);
+    EXPECT_EQ(server.getPacketQueueSize(first), 0u);
+    EXPECT_EQ(server.getPacketQueueSize(second), 0u);
+    server.sendPacket(std::vector<char>(4), second, true);
+    EXPECT_EQ(server.getPacketQueueSize(second), 1u);
+    server.clearPacketQueue(second);
+    EXPECT_EQ(server.getPacketQueueSize(second), 0u);
+    EXPECT_GT(server.getRtt(second), 0.0f);
+    EXPECT_EQ(server.getRtt(first), 0.0f);
+}
+
+TEST(NetworkConnection, Threaded)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12094);
+    Connection client(Connection::CLIENT, 12094);
+    client.connectToServer(127, 0, 0, 1);
+
+    const std::thread::id gameThread = std::this_thread::get_id();
+    bool callbacksOnGameThread = true;
+    std::vector<std::string> received;
+    server.setReceivedCallback([&] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        callbacksOnGameThread = callbacksOnGameThread && std::this_thread::get_id() == gameThread;
+        received.push_back(std::string(data, count));
+    });
+    bool serverConnected = false;
+    server.setConnectedCallback([&] (uint32_t) {
+        callbacksOnGameThread = callbacksOnGameThread && std::this_thread::get_id() == gameThread;
+        serverConnected = true;
+    });
+
+    ASSERT_TRUE(server.startThread());
+    ASSERT_TRUE(client.startThread());
+    EXPECT_FALSE(server.startThread());
+    EXPECT_TRUE(server.isThreaded());
+
+    ASSERT_TRUE(runUntil(server, client, [&serverConnected, &client] () {
+        return serverConnected && !client.getConnected().empty();
+    }));
+
+    client.coalescePackets = true;
+    const unsigned int packetCount = 100;
+    for(unsigned int i = 0; i < packetCount; ++i)
+    {
+        std::string packet = "packet " + std::to_string(i);
+        client.sendPacket(packet.c_str(), packet.size(), 0x7F000001, true);
+    }
+
+    // the threads send and receive without update being called
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_TRUE(received.empty());
+    EXPECT_GT(server.getSocketCounters().receivedDatagrams, 0u);
+
+    ASSERT_TRUE(runUntil(server, client, [&received, &packetCount] () {
+        return received.size() >= packetCount;
+    }));
+    EXPECT_TRUE(callbacksOnGameThread);
+    ASSERT_EQ(received.size(), packetCount);
+    for(unsigned int i = 0; i < packetCount; ++i)
+    {
+        EXPECT_EQ(received[i], "packet " + std::to_string(i));
+    }
+
+    client.stopThread();
+    server.stopThread();
+    EXPECT_FALSE(server.isThreaded());
+
+    // back to being updated by update
+    client.sendPacket(std::string("after").c_str(), 5, 0x7F000001, true);
+    ASSERT_TRUE(runUntil(server, client, [&received, &packetCount] () {
+        return received.size() > packetCount;
+    }));
+    EXPECT_EQ(received.back(), "after");
+}
+
+TEST(NetworkConnection, WaitAndUpdate)
+{
+    using Connection = GDT::NetworkConnection;
+    Connection server(Connection::SERVER, 12095);
+    Connection client(Connection::CLIENT, 12095);
+    client.connectToServer(127, 0, 0, 1);
+
+    std::string received;
+    server.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+        received.assign(data, count);
+    });
+
+    // with no peers, the server waits for the whole maxWait
+    auto start = std::chrono::steady_clock::now();
+    float deltaTime = server.waitAndUpdate(0.05f);
+    auto waited = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(waited, std::chrono::milliseconds(45));
+    EXPECT_GE(deltaTime, 0.045f);
+
+    for(unsigned int i = 0; i < 100 && (server.getConnected().empty() || client.getConnected().empty()); ++i)
+    {
+        client.waitAndUpdate(0.01f);
+        server.waitAndUpdate(0.01f);
+    }
+    ASSERT_FALSE(server.getConnected().empty());
+    ASSERT_FALSE(client.getConnected().empty());
+
+    // the server wakes when the packet arrives, well before maxWait
+    std::thread clientThread([&client] () {
+        client.sendPacket(std::string("wake").c_str(), 4, 0x7F000001, true);
+        for(unsigned int i = 0; i < 20; ++i)
+        {
+            client.waitAndUpdate(0.01f);
+        }
+    });
+    start = std::chrono::steady_clock::now();
+    while(received.empty() && std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+    {
+        server.waitAndUpdate(5.0f);
+    }
+    waited = std::chrono::steady_clock::now() - start;
+    clientThread.join();
+    EXPECT_EQ(received, "wake");
+    EXPECT_LT(waited, std::chrono::seconds(1));
+}
+
+TEST(NetworkConnection, ShardedServer)
+{
+    using Connection = GDT::NetworkConnection;
+    using Server = GDT::ShardedNetworkServer;
+    Server server(12096, 4);
+    ASSERT_TRUE(server.start());
+    EXPECT_FALSE(server.start());
+
+    std::vector<std::pair<Server::PeerHandle, std::string> > serverReceived;
+    server.setReceivedCallback([&serverReceived] (const char* data, uint32_t count, Server::PeerHandle peer, bool, bool, bool) {
+        serverReceived.push_back(std::make_pair(peer, std::string(data, count)));
+    });
+
+    const unsigned int clientCount = 8;
+    std::vector<std::unique_ptr<Connection> > clients;
+    std::vector<std::string> clientReceived(clientCount);
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        clients.push_back(std::unique_ptr<Connection>(new Connection(Connection::CLIENT, 12096)));
+        clients[i]->connectToServer(127, 0, 0, 1);
+        std::string* received = &clientReceived[i];
+        clients[i]->setReceivedCallback([received] (const char* data, uint32_t count, uint32_t, bool, bool, bool) {
+            received->assign(data, count);
+        });
+    }
+
+    auto runAll = [&] (const std::function<bool()>& done) {
+        const float deltaTime = 1.0f / 120.0f;
+        for(float timer = 0.0f; timer < 5.0f; timer += deltaTime)
+        {
+            server.update(deltaTime);
+            for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+            {
+                (*iter)->update(deltaTime);
+            }
+            if(done())
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(8333));
+        }
+        return false;
+    };
+
+    ASSERT_TRUE(runAll([&] () {
+        for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+        {
+            if((*iter)->getConnected().empty())
+            {
+                return false;
+            }
+        }
+        return server.getConnectedPeers().size() == clientCount;
+    }));
+
+    // every client stays on one shard
+    std::vector<Server::PeerHandle> peers = server.getConnectedPeers();
+    for(auto iter = peers.begin(); iter != peers.end(); ++iter)
+    {
+        EXPECT_TRUE(server.isConnected(*iter));
+        EXPECT_EQ(server.getAddress(*iter), 0x7F000001u);
+        EXPECT_EQ(server.getShard(iter->shard).getHandle(0x7F000001, server.getPort(*iter)), iter->connection);
+    }
+
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        std::string packet = std::to_string(i);
+        clients[i]->sendPacket(packet.c_str(), packet.size(), 0x7F000001, true);
+    }
+    ASSERT_TRUE(runAll([&serverReceived, &clientCount] () {
+        return serverReceived.size() >= clientCount;
+    }));
+
+    // reply to each client through its peer handle, whichever shard has it
+    for(auto iter = serverReceived.begin(); iter != serverReceived.end(); ++iter)
+    {
+        server.sendPacket(std::string("to " + iter->second).c_str(), 3 + iter->second.size(), iter->first, true);
+    }
+    ASSERT_TRUE(runAll([&clientReceived] () {
+        for(auto iter = clientReceived.begin(); iter != clientReceived.end(); ++iter)
+        {
+            if(iter->empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }));
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        EXPECT_EQ(clientReceived[i], "to " + std::to_string(i));
+    }
+    Server::NetworkStats stats = server.getStats();
+    EXPECT_EQ(stats.connections, clientCount);
+    EXPECT_EQ(stats.connects, clientCount);
+    EXPECT_GE(stats.total.receivedDatagrams, clientCount);
+
+    server.stop();
+    EXPECT_FALSE(server.isStarted());
+}
+
+TEST(NetworkConnection, ShardedServerPortTaken)
+{
+    // a socket without SO_REUSEPORT keeps the shards from binding the port
+    using Connection = GDT::NetworkConnection;
+    std::unique_ptr<Connection> blocker(new Connection(Connection::SERVER, 12082));
+    blocker->update(0.0f);
+    ASSERT_TRUE(blocker->isOpen());
+
+    GDT::ShardedNetworkServer server(12082, 2);
+    EXPECT_FALSE(server.start());
+    EXPECT_FALSE(server.isStarted());
+    for(unsigned int i = 0; i < server.getShardCount(); ++i)
+    {
+        EXPECT_FALSE(server.getShard(i).isOpen());
+    }
+
+    // once the port is free, every shard opens its socket
+    blocker.reset();
+    ASSERT_TRUE(server.start());
+    for(unsigned int i = 0; i < server.getShardCount(); ++i)
+    {
+        EXPECT_TRUE(server.getShard(i).isOpen());
+    }
+    server.stop();
+}
+
+TEST(NetworkConnection, MPSCQueue)
+{
+    GDT::Internal::MPSCQueue<unsigned int> queue(8);
+    EXPECT_EQ(queue.capacity(), 8u);
+    EXPECT_TRUE(queue.empty());
+    unsigned int value = 0;
+    EXPECT_FALSE(queue.pop(value));
+    for(unsigned int i = 0; i < 8; ++i)
+    {
+        value = i;
+        EXPECT_TRUE(queue.push(value));
+    }
+    value = 8;
+    EXPECT_FALSE(queue.push(value));
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 0u);
+
+    // every value of every producer is popped once, in order per producer
+    const unsigned int producerCount = 4;
+    const unsigned int valueCount = 5000;
+    GDT::Internal::MPSCQueue<unsigned int> shared(256);
+    std::vector<std::thread> producers;
+    for(unsigned int producer = 0; producer < producerCount; ++producer)
+    {
+        producers.emplace_back([&shared, producer] () {
+            for(unsigned int i = 0; i < valueCount; ++i)
+            {
+                unsigned int value = producer * valueCount + i;
+                while(!shared.push(value))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    std::vector<unsigned int> next(producerCount, 0);
+    bool isOrdered = true;
+    for(unsigned int popped = 0; popped < producerCount * valueCount;)
+    {
+        if(shared.pop(value))
+        {
+            isOrdered = isOrdered && value % valueCount == next[value / valueCount]++;
+            ++popped;
+        }
+    }
+    for(auto iter = producers.begin(); iter != producers.end(); ++iter)
+    {
+        iter->join();
+    }
+    EXPECT_TRUE(isOrdered);
+    EXPECT_TRUE(shared.empty());
+}
+
+TEST(NetworkConnection, LoopbackTransport)
+{
+    using Transport = GDT::LoopbackTransport;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    Transport first(network);
+    Transport second(network);
+    Transport taken(network);
+    ASSERT_TRUE(first.open(5000, Transport::Options()));
+    ASSERT_TRUE(second.open(0, Transport::Options()));
+    EXPECT_FALSE(taken.open(5000, Transport::Options()));
+    EXPECT_GE(second.getPort(), GDT_INTERNAL_NETWORK_LOOPBACK_FIRST_EPHEMERAL_PORT);
+
+    Transport::SocketCounters counters;
+    GDT::Internal::Network::DatagramBuffers buffers;
+    buffers.allocate(4, 16);
+    EXPECT_EQ(first.receive(buffers, 4, counters), 0);
+
+    // a batch with a header and an attached payload
+    GDT::Internal::Network::SendBatch batch;
+    std::memcpy(batch.stage(3, 0x7F000001, 5000, GDT::Internal::Network::SendBatch::NOT_CHECKED), "abc", 3);
+    const char payload[] = "defghijklmnopqrstuvwxyz";
+    batch.attach(payload, sizeof(payload) - 1);
+    std::memcpy(batch.stage(2, 0x0A000001, 5000, GDT::Internal::Network::SendBatch::NOT_CHECKED), "xy", 2);
+    batch.prepare();
+    second.send(batch, counters);
+    EXPECT_EQ(batch.entries[0].sentBytes, 26);
+    EXPECT_EQ(batch.entries[1].sentBytes, 2);
+    EXPECT_EQ(second.send("z", 1, 0x7F000001, 5000, counters), 1);
+    EXPECT_EQ(counters.sentDatagrams, 3u);
+
+    // the address is ignored and long datagrams are truncated
+    ASSERT_EQ(first.receive(buffers, 4, counters), 3);
+    EXPECT_EQ(std::string(buffers.at(0), buffers.sizes[0]), "abcdefghijklmnop");
+    EXPECT_EQ(std::string(buffers.at(1), buffers.sizes[1]), "xy");
+    EXPECT_EQ(std::string(buffers.at(2), buffers.sizes[2]), "z");
+    EXPECT_EQ(ntohl(buffers.addresses[0].sin_addr.s_addr), 0x7F000001u);
+    EXPECT_EQ(ntohs(buffers.addresses[0].sin_port), second.getPort());
+    EXPECT_EQ(counters.receivedDatagrams, 3u);
+
+    // nothing is bound to the port once closed
+    first.close();
+    second.send("z", 1, 0x7F000001, 5000, counters);
+    EXPECT_EQ(network->getDroppedDatagrams(), 1u);
+    ASSERT_TRUE(taken.open(5000, Transport::Options()));
+    EXPECT_EQ(taken.receive(buffers, 4, counters), 0);
+
+    // a waiting transport wakes as soon as a datagram arrives
+    std::thread sender([&second] () {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Transport::SocketCounters counters;
+        second.send("w", 1, 0x7F000001, 5000, counters);
+    });
+    auto start = std::chrono::steady_clock::now();
+    taken.wait(5.0f);
+    sender.join();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_EQ(taken.receive(buffers, 4, counters), 1);
+}
+
+TEST(NetworkConnection, LoopbackClients)
+{
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    // the port is only bound in the loopback network
+    Connection server(Connection::SERVER, 12084);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    std::vector<std::string> received;
+    server.setReceivedCallback([&received] (const char* data, uint32_t count, uint32_t address, bool, bool, bool) {
+        EXPECT_EQ(address, 0x7F000001u);
+        received.push_back(std::string(data, count));
+    });
+
+    const unsigned int clientCount = 200;
+    std::vector<std::unique_ptr<Connection> > clients;
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        clients.emplace_back(new Connection(Connection::CLIENT, 12084));
+        clients.back()->setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+        clients.back()->connectToServer(127, 0, 0, 1);
+    }
+
+    const float deltaTime = 1.0f / 120.0f;
+    auto tick = [&] () {
+        server.update(deltaTime);
+        for(auto iter = clients.begin(); iter != clients.end(); ++iter)
+        {
+            (*iter)->update(deltaTime);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(8333));
+    };
+    auto isConnected = [&] () {
+        return server.getConnectedHandles().size() == clientCount
+            && std::all_of(clients.begin(), clients.end(), [] (const std::unique_ptr<Connection>& client) {
+                return client->getConnectedHandles().size() == 1;
+            });
+    };
+    for(unsigned int i = 0; i < 600 && !isConnected(); ++i)
+    {
+        tick();
+    }
+    ASSERT_TRUE(isConnected());
+
+    for(unsigned int i = 0; i < clientCount; ++i)
+    {
+        Connection& client = *clients[i];
+        std::string message = "client " + std::to_string(i);
+        client.sendMessage(message.c_str(), message.size(), client.getConnectedHandles().at(0), Connection::RELIABLE_ORDERED);
+    }
+    for(unsigned int i = 0; i < 600 && received.size() < clientCount; ++i)
+    {
+        tick();
+    }
+    ASSERT_EQ(received.size(), clientCount);
+    std::sort(received.begin(), received.end());
+    EXPECT_EQ(std::unique(received.begin(), received.end()), received.end());
+    EXPECT_EQ(network->getDroppedDatagrams(), 0u);
+}
+
+TEST(NetworkConnection, SendRateRampUp)
+{
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    Connection server(Connection::SERVER, 12079);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    Connection client(Connection::CLIENT, 12079);
+    client.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    client.connectToServer(127, 0, 0, 1);
+
+    // a packet every tick, more than the starting rate sends, reaches the
+    // highest rate within half a second over a link without delay; the
+    // client sends every tick too, as heartbeats go by the wall clock
+    const float deltaTime = 1.0f / 120.0f;
+    unsigned int ticks = 0;
+    for(; ticks < 600; ++ticks)
+    {
+        if(!server.getConnectedHandles().empty())
+        {
+            Connection::ConnectionHandle clientHandle = server.getConnectedHandles().at(0);
+            if(server.getSendRate(clientHandle) >= server.maxSendRate)
+            {
+                break;
+            }
+            server.sendPacket(std::vector<char>(100, 'r'), clientHandle, false);
+        }
+        if(!client.getConnectedHandles().empty())
+        {
+            client.sendPacket(std::vector<char>(10, 'a'), client.getConnectedHandles().at(0), false);
+        }
+        server.update(deltaTime);
+        client.update(deltaTime);
+    }
+    ASSERT_FALSE(server.getConnectedHandles().empty());
+    EXPECT_FLOAT_EQ(server.getSendRate(server.getConnectedHandles().at(0)), server.maxSendRate.load());
+    EXPECT_LT(ticks, 60u);
+}
+
+TEST(NetworkConnection, Stats)
+{
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    Connection server(Connection::SERVER, 12085);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    Connection client(Connection::CLIENT, 12085);
+    client.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    client.connectToServer(127, 0, 0, 1);
+
+    std::vector<std::string> csv;
+    std::vector<std::string> json;
+    server.setStatsSink([&csv] (const std::string& line) {
+        csv.push_back(line);
+    }, 0.1f);
+    client.setStatsSink([&json] (const std::string& line) {
+        json.push_back(line);
+    }, 0.1f, Connection::STATS_JSON);
+    ASSERT_EQ(csv.size(), 1u);
+    EXPECT_EQ(csv[0].compare(0, 17, "time,connections,"), 0);
+    EXPECT_TRUE(json.empty());
+
+    unsigned int received = 0;
+    server.setReceivedCallback([&received] (const char*, uint32_t, uint32_t, bool, bool, bool) {
+        ++received;
+    });
+
+    ASSERT_TRUE(runUntil(server, client, [&server, &client] () {
+        return !server.getConnected().empty() && !client.getConnected().empty();
+    }));
+    Connection::NetworkStats stats = server.getStats();
+    EXPECT_EQ(stats.connections, 1u);
+    EXPECT_EQ(stats.connects, 1u);
+    EXPECT_EQ(stats.disconnects, 0u);
+    EXPECT_GT(stats.updates, 0u);
+
+    // a lossy link from the client, so messages are lost and resent
+    Connection::Impairment impairment;
+    impairment.loss = 0.3f;
+    impairment.seed = 1;
+    client.setImpairment(impairment);
+
+    // a message per update, so they are not all coalesced into one datagram
+    const unsigned int count = 50;
+    Connection::ConnectionHandle serverHandle = client.getConnectedHandles().at(0);
+    client.sendMessage("0", 1, serverHandle, Connection::RELIABLE_ORDERED);
+    EXPECT_EQ(client.getStats(serverHandle).queuedMessages, 1u);
+    unsigned int sent = 1;
+    ASSERT_TRUE(runUntil(server, client, [&] () {
+        std::string message = std::to_string(sent);
+        client.sendMessage(message.c_str(), message.size(), serverHandle, Connection::RELIABLE_ORDERED);
+        return ++sent == count;
+    }));
+
+    ASSERT_TRUE(runUntil(server, client, [&received] () {
+        return received >= count;
+    }, 20.0f));
+
+    Connection::ConnectionStats clientStats = client.getStats(serverHandle);
+    Connection::ConnectionStats serverStats = server.getStats(server.getConnectedHandles().at(0));
+    EXPECT_GT(clientStats.sentDatagrams, 0u);
+    EXPECT_GE(clientStats.sentBytes, clientStats.sentDatagrams * 20);
+    EXPECT_GT(clientStats.lostDatagrams, 0u);
+    EXPECT_GT(clientStats.resentMessages, 0u);
+    // the impaired datagrams are counted as sent
+    EXPECT_LT(serverStats.receivedDatagrams, clientStats.sentDatagrams);
+    EXPECT_GT(serverStats.receivedDatagrams, 0u);
+    EXPECT_EQ(server.getStats().total.receivedBytes, serverStats.receivedBytes);
+    EXPECT_EQ(client.getStats(Connection::ConnectionHandle()).sentDatagrams, 0u);
+
+    // every line has a value for every column
+    ASSERT_GT(csv.size(), 2u);
+    auto columns = [] (const std::string& line) {
+        return std::count(line.begin(), line.end(), ',');
+    };
+    EXPECT_EQ(columns(csv[1]), columns(csv[0]));
+    EXPECT_EQ(columns(csv.back()), columns(csv[0]));
+    ASSERT_FALSE(json.empty());
+    EXPECT_EQ(json.back().front(), '{');
+    EXPECT_EQ(json.back().back(), '}');
+    EXPECT_NE(json.back().find("\"lostDatagrams\":"), std::string::npos);
+
+    // disconnected peers are kept in the totals
+    uint64_t sentBytes = client.getStats().total.sentBytes;
+    client.reset(Connection::CLIENT, 12085);
+    stats = client.getStats();
+    EXPECT_EQ(stats.connections, 0u);
+    EXPECT_EQ(stats.disconnects, 1u);
+    EXPECT_EQ(stats.total.sentBytes, sentBytes);
+
+    client.resetStats();
+    stats = client.getStats();
+    EXPECT_EQ(stats.disconnects, 0u);
+    EXPECT_EQ(stats.total.sentBytes, 0u);
+    EXPECT_EQ(stats.updates, 0u);
+}
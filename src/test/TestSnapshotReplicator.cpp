@@ -0,0 +1,202 @@
+
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <GDT/LoopbackTransport.hpp>
+#include <GDT/NetworkConnection.hpp>
+#include <GDT/SnapshotReplicator.hpp>
+
+namespace
+{
+    // Updates both connections once. The client sends a packet every tick
+    // once connected, so acks do not wait for heartbeats, which are timed by
+    // the wall clock.
+    void tick(GDT::NetworkConnection& server, GDT::NetworkConnection& client)
+    {
+        const float deltaTime = 1.0f / 120.0f;
+        if(!client.getConnectedHandles().empty())
+        {
+            client.sendPacket(std::vector<char>(1, 'a'), client.getConnectedHandles().at(0), false);
+        }
+        server.update(deltaTime);
+        client.update(deltaTime);
+    }
+}
+
+TEST(SnapshotReplicator, Delta)
+{
+    std::vector<char> baseline(1000);
+    for(unsigned int i = 0; i < baseline.size(); ++i)
+    {
+        baseline[i] = (char)(i * 7);
+    }
+
+    // a few changed fields, and a snapshot that grew
+    std::vector<char> snapshot(baseline);
+    snapshot[10] ^= 1;
+    snapshot[11] ^= 2;
+    snapshot[500] ^= 3;
+    snapshot.resize(1010, 5);
+
+    std::vector<char> delta;
+    GDT::SnapshotReplicator::encodeDelta(baseline.data(), baseline.size(), snapshot.data(), snapshot.size(), delta);
+    EXPECT_LT(delta.size(), 30u);
+
+    std::vector<char> decoded;
+    ASSERT_TRUE(GDT::SnapshotReplicator::decodeDelta(baseline.data(), baseline.size(), delta.data(), delta.size(), snapshot.size(), decoded));
+    EXPECT_EQ(decoded, snapshot);
+
+    // a snapshot that shrank
+    snapshot.resize(400);
+    delta.clear();
+    GDT::SnapshotReplicator::encodeDelta(baseline.data(), baseline.size(), snapshot.data(), snapshot.size(), delta);
+    ASSERT_TRUE(GDT::SnapshotReplicator::decodeDelta(baseline.data(), baseline.size(), delta.data(), delta.size(), snapshot.size(), decoded));
+    EXPECT_EQ(decoded, snapshot);
+
+    // without a baseline
+    delta.clear();
+    GDT::SnapshotReplicator::encodeDelta(nullptr, 0, snapshot.data(), snapshot.size(), delta);
+    ASSERT_TRUE(GDT::SnapshotReplicator::decodeDelta(nullptr, 0, delta.data(), delta.size(), snapshot.size(), decoded));
+    EXPECT_EQ(decoded, snapshot);
+
+    // runs past the end of the snapshot
+    EXPECT_FALSE(GDT::SnapshotReplicator::decodeDelta(nullptr, 0, delta.data(), delta.size(), snapshot.size() - 1, decoded));
+    // truncated
+    EXPECT_FALSE(GDT::SnapshotReplicator::decodeDelta(nullptr, 0, delta.data(), delta.size() - 1, snapshot.size(), decoded));
+}
+
+TEST(SnapshotReplicator, Loopback)
+{
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    Connection server(Connection::SERVER, 12078);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    Connection client(Connection::CLIENT, 12078);
+    client.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    client.connectToServer(127, 0, 0, 1);
+
+    GDT::SnapshotReplicator serverReplicator(server);
+    GDT::SnapshotReplicator clientReplicator(client);
+
+    std::vector<char> received;
+    unsigned int receivedCount = 0;
+    client.setHandleReceivedCallback([&] (const char* data, uint32_t count, Connection::ConnectionHandle connection, bool, bool, bool) {
+        if(clientReplicator.isSnapshot(data, count)
+            && clientReplicator.receivedSnapshot(data, count, connection, received))
+        {
+            ++receivedCount;
+        }
+    });
+
+    for(unsigned int i = 0; i < 600 && server.getConnectedHandles().empty(); ++i)
+    {
+        tick(server, client);
+    }
+    ASSERT_FALSE(server.getConnectedHandles().empty());
+    Connection::ConnectionHandle clientHandle = server.getConnectedHandles().at(0);
+
+    // larger than a datagram, so the first snapshot is sent in fragments
+    std::vector<char> state(3000);
+    for(unsigned int i = 0; i < state.size(); ++i)
+    {
+        state[i] = (char)(i * 13);
+    }
+
+    for(unsigned int i = 0; i < 360; ++i)
+    {
+        // a few fields change every tick, sent at 20 snapshots per second
+        state[(i * 31) % state.size()] ^= 1;
+        state[(i * 97) % state.size()] ^= 2;
+        if(i % 6 == 0)
+        {
+            serverReplicator.sendSnapshot(state, clientHandle);
+        }
+        tick(server, client);
+    }
+    serverReplicator.sendSnapshot(state, clientHandle);
+    for(unsigned int i = 0; i < 60; ++i)
+    {
+        tick(server, client);
+    }
+
+    EXPECT_GT(receivedCount, 0u);
+    EXPECT_EQ(received, state);
+
+    GDT::SnapshotReplicator::Counters counters = serverReplicator.getCounters();
+    EXPECT_GT(counters.fullSnapshots, 0u);
+    EXPECT_GT(counters.deltaSnapshots, counters.fullSnapshots);
+    // the first snapshots are sent whole until one is acked
+    EXPECT_LT(counters.sentBytes * 3, counters.snapshotBytes);
+}
+
+TEST(SnapshotReplicator, Recovery)
+{
+    using Connection = GDT::NetworkConnection;
+    auto network = std::make_shared<GDT::LoopbackNetwork>();
+    Connection server(Connection::SERVER, 12077);
+    server.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    Connection client(Connection::CLIENT, 12077);
+    client.setTransport(std::unique_ptr<GDT::Transport>(new GDT::LoopbackTransport(network)));
+    client.connectToServer(127, 0, 0, 1);
+
+    GDT::SnapshotReplicator serverReplicator(server);
+    GDT::SnapshotReplicator clientReplicator(client);
+
+    // snapshots that arrive while skipping are acked but never decoded, so
+    // the server takes them as baselines the client does not have
+    bool isSkipping = false;
+    std::vector<char> received;
+    unsigned int receivedCount = 0;
+    client.setHandleReceivedCallback([&] (const char* data, uint32_t count, Connection::ConnectionHandle connection, bool, bool, bool) {
+        if(!isSkipping
+            && clientReplicator.isSnapshot(data, count)
+            && clientReplicator.receivedSnapshot(data, count, connection, received))
+        {
+            ++receivedCount;
+        }
+    });
+
+    for(unsigned int i = 0; i < 600 && server.getConnectedHandles().empty(); ++i)
+    {
+        tick(server, client);
+    }
+    ASSERT_FALSE(server.getConnectedHandles().empty());
+    Connection::ConnectionHandle clientHandle = server.getConnectedHandles().at(0);
+
+    // 20 snapshots per second, with a second of them skipped
+    std::vector<char> state(500);
+    for(unsigned int i = 0; i < 360; ++i)
+    {
+        isSkipping = i >= 60 && i < 180;
+        if(i % 6 == 0)
+        {
+            state[(i * 31) % state.size()] ^= 1;
+            serverReplicator.sendSnapshot(state, clientHandle);
+        }
+        tick(server, client);
+    }
+    unsigned int countBefore = receivedCount;
+    for(unsigned int i = 0; i < 360; ++i)
+    {
+        if(i % 6 == 0)
+        {
+            state[(i * 17) % state.size()] ^= 2;
+            serverReplicator.sendSnapshot(state, clientHandle);
+        }
+        tick(server, client);
+    }
+    for(unsigned int i = 0; i < 60; ++i)
+    {
+        tick(server, client);
+    }
+
+    // whole snapshots let the client decode deltas again
+    EXPECT_GT(receivedCount, countBefore);
+    EXPECT_EQ(received, state);
+    GDT::SnapshotReplicator::Counters counters = serverReplicator.getCounters();
+    EXPECT_GT(counters.fullSnapshots, 1u);
+    EXPECT_GT(counters.deltaSnapshots, counters.fullSnapshots);
+}